@@ -42,6 +42,7 @@ LOCAL_SRC_FILES := \
 	audio_hw.c \
 	voice.c \
 	platform_info.c \
+	platform_backend.c \
 	$(AUDIO_PLATFORM)/platform.c
 
 LOCAL_SRC_FILES += audio_extn/audio_extn.c \
@@ -92,6 +93,10 @@ ifeq ($(strip $(AUDIO_FEATURE_ENABLED_HFP)),true)
     LOCAL_SRC_FILES += audio_extn/hfp.c
 endif
 
+ifneq ($(filter true,$(strip $(AUDIO_FEATURE_ENABLED_FM_POWER_OPT)) $(strip $(AUDIO_FEATURE_ENABLED_HFP))),)
+    LOCAL_SRC_FILES += audio_extn/hostless.c
+endif
+
 ifeq ($(strip $(AUDIO_FEATURE_ENABLED_CUSTOMSTEREO)),true)
     LOCAL_CFLAGS += -DCUSTOM_STEREO_ENABLED
 endif
@@ -42,6 +42,8 @@
 #include <stdlib.h>
 #include <errno.h>
 #include <dlfcn.h>
+#include <pthread.h>
+#include <time.h>
 #include <cutils/properties.h>
 #include <cutils/log.h>
 
@@ -88,9 +90,12 @@ void audio_extn_fm_set_parameters(struct audio_device *adev,
 #endif
 #ifndef HFP_ENABLED
 #define audio_extn_hfp_set_parameters(adev, parms) (0)
+#define audio_extn_hfp_get_parameters(query, reply) (0)
 #else
 void audio_extn_hfp_set_parameters(struct audio_device *adev,
                                            struct str_parms *parms);
+void audio_extn_hfp_get_parameters(struct str_parms *query,
+                                   struct str_parms *reply);
 #endif
 
 #ifndef CUSTOM_STEREO_ENABLED
@@ -550,6 +555,7 @@ void audio_extn_get_parameters(const struct audio_device *adev,
     get_active_offload_usecases(adev, query, reply);
     audio_extn_dts_eagle_get_parameters(adev, query, reply);
     audio_extn_hpx_get_parameters(query, reply);
+    audio_extn_hfp_get_parameters(query, reply);
 
     kv_pairs = str_parms_to_str(reply);
     ALOGD_IF(kv_pairs != NULL, "%s: returns %s", __func__, kv_pairs);
@@ -930,4 +936,271 @@ void audio_extn_perf_lock_release(void)
     else
         ALOGE("%s: Perf lock release error \n", __func__);
 }
+
+/*
+ * Streaming governor: holds its own perf lock only while an audio thread is
+ * running out of time. Every blocking pcm_write/pcm_read is sampled and the
+ * time spent blocked in the driver, relative to the buffer duration, is the
+ * slack left to the client thread. A call arriving later than
+ * PERF_GOV_LATE_PCT of the buffer duration after the previous one counts as
+ * no slack.
+ */
+#define PERF_GOV_BOOST_SLACK_PCT    20
+#define PERF_GOV_RELEASE_SLACK_PCT  50
+/* slack must stay above the release threshold this long before unboosting */
+#define PERF_GOV_RELEASE_HOLD_US    1000000
+#define PERF_GOV_LATE_PCT           150
+/* writes return early while the pcm buffer fills up after start */
+#define PERF_GOV_WARMUP_SAMPLES     8
+#define PERF_GOV_LOG_SIZE           16
+
+enum perf_gov_action {
+    PERF_GOV_BOOST,
+    PERF_GOV_RELEASE,
+};
+
+enum perf_gov_band {
+    PERF_GOV_STARVED,       /* below the boost threshold */
+    PERF_GOV_TIGHT,
+    PERF_GOV_RECOVERED,     /* above the release threshold */
+};
+
+/* written by the stream thread only; active and band also under perf_gov.lock */
+struct perf_gov_stream {
+    bool active;
+    enum perf_gov_band band;
+    int slack_pct;          /* smoothed */
+    uint64_t io_start_us;
+    uint64_t last_start_us;
+    uint32_t samples;
+    uint32_t late_count;
+};
+
+struct perf_gov_event {
+    uint64_t time_us;
+    audio_usecase_t usecase;
+    int slack_pct;
+    enum perf_gov_action action;
+};
+
+/*
+ * The stream threads sample without perf_gov.lock and only take it when a
+ * stream changes band, starts or stops, or a pending release falls due.
+ */
+struct perf_gov {
+    pthread_mutex_t lock;
+    struct perf_gov_stream streams[AUDIO_USECASE_MAX];
+    uint32_t active;        /* active streams */
+    uint32_t starved;       /* active streams in the starved band */
+    uint32_t unrecovered;   /* active streams not in the recovered band */
+    uint64_t release_due_us; /* also read by the stream threads, 0 if none */
+    int handle;
+    bool boosted;
+    uint64_t boost_start_us;
+    uint64_t total_boost_us;
+    uint32_t boosts;
+    struct perf_gov_event log[PERF_GOV_LOG_SIZE];
+    uint32_t log_count;
+};
+
+static struct perf_gov perf_gov = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static const char * const perf_gov_action_name[] = {
+    [PERF_GOV_BOOST] = "boost",
+    [PERF_GOV_RELEASE] = "release",
+};
+
+static void perf_gov_log(uint64_t now_us, audio_usecase_t usecase, int slack_pct,
+                         enum perf_gov_action action)
+{
+    struct perf_gov_event *event = &perf_gov.log[perf_gov.log_count++ % PERF_GOV_LOG_SIZE];
+
+    event->time_us = now_us;
+    event->usecase = usecase;
+    event->slack_pct = slack_pct;
+    event->action = action;
+    ALOGV("%s: %s, usecase %d slack %d%%", __func__, perf_gov_action_name[action],
+          usecase, slack_pct);
+}
+
+static enum perf_gov_band perf_gov_band_of(int slack_pct)
+{
+    if (slack_pct < PERF_GOV_BOOST_SLACK_PCT)
+        return PERF_GOV_STARVED;
+    if (slack_pct < PERF_GOV_RELEASE_SLACK_PCT)
+        return PERF_GOV_TIGHT;
+    return PERF_GOV_RECOVERED;
+}
+
+/* must be called with perf_gov.lock held, usecase is the stream that triggered it */
+static void perf_gov_evaluate(uint64_t now_us, audio_usecase_t usecase)
+{
+    int slack_pct = perf_gov.streams[usecase].slack_pct;
+    uint64_t release_due_us = perf_gov.release_due_us;
+
+    if (!perf_gov.boosted && perf_gov.starved > 0) {
+        perf_gov.handle = perf_lock_acq(perf_gov.handle, 0, perf_lock_opts, 1);
+        perf_gov.boosted = true;
+        perf_gov.boost_start_us = now_us;
+        perf_gov.boosts++;
+        perf_gov_log(now_us, usecase, slack_pct, PERF_GOV_BOOST);
+    }
+
+    if (!perf_gov.boosted || perf_gov.unrecovered > 0)
+        release_due_us = 0;
+    else if (perf_gov.active == 0)
+        release_due_us = now_us;
+    else if (release_due_us == 0)
+        release_due_us = now_us + PERF_GOV_RELEASE_HOLD_US;
+
+    if (release_due_us != 0 && now_us >= release_due_us) {
+        if (perf_gov.handle)
+            perf_lock_rel(perf_gov.handle);
+        perf_gov.boosted = false;
+        perf_gov.total_boost_us += now_us - perf_gov.boost_start_us;
+        perf_gov_log(now_us, usecase, slack_pct, PERF_GOV_RELEASE);
+        release_due_us = 0;
+    }
+    __atomic_store_n(&perf_gov.release_due_us, release_due_us, __ATOMIC_RELAXED);
+}
+
+/* moves a stream between bands, or in and out of the active set */
+static void perf_gov_update(audio_usecase_t usecase, bool active,
+                            enum perf_gov_band band, uint64_t now_us)
+{
+    struct perf_gov_stream *stream = &perf_gov.streams[usecase];
+
+    pthread_mutex_lock(&perf_gov.lock);
+    if (stream->active) {
+        perf_gov.active--;
+        if (stream->band == PERF_GOV_STARVED)
+            perf_gov.starved--;
+        if (stream->band != PERF_GOV_RECOVERED)
+            perf_gov.unrecovered--;
+    }
+    if (active) {
+        perf_gov.active++;
+        if (band == PERF_GOV_STARVED)
+            perf_gov.starved++;
+        if (band != PERF_GOV_RECOVERED)
+            perf_gov.unrecovered++;
+    }
+    stream->active = active;
+    stream->band = band;
+    perf_gov_evaluate(now_us, usecase);
+    pthread_mutex_unlock(&perf_gov.lock);
+}
+
+void audio_extn_perf_lock_io_begin(audio_usecase_t usecase)
+{
+    if (!perf_lock_acq || !perf_lock_rel || usecase < 0 || usecase >= AUDIO_USECASE_MAX)
+        return;
+
+    perf_gov.streams[usecase].io_start_us = audio_extn_utils_get_time_us();
+}
+
+void audio_extn_perf_lock_io_end(audio_usecase_t usecase, uint32_t period_us)
+{
+    struct perf_gov_stream *stream;
+    enum perf_gov_band band;
+    uint64_t now_us, busy_us, release_due_us;
+    int slack_pct;
+    /* called between the pcm call and its errno check */
+    int saved_errno = errno;
+
+    if (!perf_lock_acq || !perf_lock_rel || usecase < 0 || usecase >= AUDIO_USECASE_MAX ||
+        period_us == 0)
+        return;
+
+    now_us = audio_extn_utils_get_time_us();
+    stream = &perf_gov.streams[usecase];
+    busy_us = now_us - stream->io_start_us;
+    slack_pct = (busy_us >= period_us) ? 100 : (int)(busy_us * 100 / period_us);
+
+    if (++stream->samples <= PERF_GOV_WARMUP_SAMPLES) {
+        stream->last_start_us = stream->io_start_us;
+        goto done;
+    }
+
+    if (stream->active) {
+        if (stream->io_start_us - stream->last_start_us >
+                (uint64_t)period_us * PERF_GOV_LATE_PCT / 100) {
+            stream->late_count++;
+            slack_pct = 0;
+        }
+        stream->slack_pct = (3 * stream->slack_pct + slack_pct) / 4;
+    } else {
+        stream->slack_pct = slack_pct;
+    }
+    stream->last_start_us = stream->io_start_us;
+
+    band = perf_gov_band_of(stream->slack_pct);
+    if (!stream->active || band != stream->band) {
+        perf_gov_update(usecase, true, band, now_us);
+        goto done;
+    }
+
+    release_due_us = __atomic_load_n(&perf_gov.release_due_us, __ATOMIC_RELAXED);
+    if (release_due_us != 0 && now_us >= release_due_us) {
+        pthread_mutex_lock(&perf_gov.lock);
+        perf_gov_evaluate(now_us, usecase);
+        pthread_mutex_unlock(&perf_gov.lock);
+    }
+done:
+    errno = saved_errno;
+}
+
+void audio_extn_perf_lock_io_stop(audio_usecase_t usecase)
+{
+    struct perf_gov_stream *stream;
+
+    if (!perf_lock_acq || !perf_lock_rel || usecase < 0 || usecase >= AUDIO_USECASE_MAX)
+        return;
+
+    stream = &perf_gov.streams[usecase];
+    stream->samples = 0;
+    if (stream->active)
+        perf_gov_update(usecase, false, stream->band, audio_extn_utils_get_time_us());
+}
+
+void audio_extn_perf_lock_dump(int fd)
+{
+    struct perf_gov_event *event;
+    uint64_t now_us, boost_us;
+    uint32_t i, first;
+
+    if (!perf_lock_acq || !perf_lock_rel)
+        return;
+
+    pthread_mutex_lock(&perf_gov.lock);
+    now_us = audio_extn_utils_get_time_us();
+    boost_us = perf_gov.total_boost_us;
+    if (perf_gov.boosted)
+        boost_us += now_us - perf_gov.boost_start_us;
+
+    dprintf(fd, " Perf lock governor: %s, %u boosts, %llu us boosted\n",
+            perf_gov.boosted ? "boosted" : "idle", perf_gov.boosts,
+            (unsigned long long)boost_us);
+    /* the stream threads keep sampling, their figures are a racy copy */
+    for (i = 0; i < AUDIO_USECASE_MAX; i++) {
+        if (!perf_gov.streams[i].active)
+            continue;
+        dprintf(fd, "  usecase %s: slack %d%%, samples %u, late %u\n", use_case_table[i],
+                perf_gov.streams[i].slack_pct, perf_gov.streams[i].samples,
+                perf_gov.streams[i].late_count);
+    }
+    first = (perf_gov.log_count > PERF_GOV_LOG_SIZE) ?
+            perf_gov.log_count - PERF_GOV_LOG_SIZE : 0;
+    for (i = first; i < perf_gov.log_count; i++) {
+        event = &perf_gov.log[i % PERF_GOV_LOG_SIZE];
+        dprintf(fd, "  -%llu ms %s: usecase %s slack %d%%\n",
+                (unsigned long long)((now_us - event->time_us) / 1000),
+                perf_gov_action_name[event->action],
+                (event->usecase == USECASE_INVALID) ? "none" : use_case_table[event->usecase],
+                event->slack_pct);
+    }
+    pthread_mutex_unlock(&perf_gov.lock);
+}
 #endif /* KPI_OPTIMIZE_ENABLED */
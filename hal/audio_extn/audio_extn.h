@@ -228,6 +228,7 @@ void audio_extn_listen_set_parameters(struct audio_device *adev,
 #define audio_extn_sound_trigger_set_parameters(adev, parms)           (0)
 #define audio_extn_sound_trigger_check_and_get_session(in)             (0)
 #define audio_extn_sound_trigger_stop_lab(in)                          (0)
+#define audio_extn_sound_trigger_read(in, buffer, bytes)               pcm_read((in)->pcm, buffer, bytes)
 #else
 
 enum st_event_type {
@@ -248,6 +249,7 @@ void audio_extn_sound_trigger_set_parameters(struct audio_device *adev,
                                              struct str_parms *parms);
 void audio_extn_sound_trigger_check_and_get_session(struct stream_in *in);
 void audio_extn_sound_trigger_stop_lab(struct stream_in *in);
+int audio_extn_sound_trigger_read(struct stream_in *in, void *buffer, size_t bytes);
 #endif
 
 #ifndef AUXPCM_BT_ENABLED
@@ -304,6 +306,7 @@ void audio_extn_compr_cap_deinit();
                                     channels, is_playing) (0)
 #define audio_extn_dts_remove_state_notifier_node(stream_out) (0)
 #define audio_extn_check_and_set_dts_hpx_state(adev)       (0)
+#define audio_extn_dts_eagle_send_cached_params(adev, out)   (0)
 #else
 void audio_extn_dts_eagle_set_parameters(struct audio_device *adev,
                                          struct str_parms *parms);
@@ -315,6 +318,8 @@ void audio_extn_dts_notify_playback_state(int stream_out, int has_video, int sam
                                   int channels, int is_playing);
 void audio_extn_dts_remove_state_notifier_node(int stream_out);
 void audio_extn_check_and_set_dts_hpx_state(const struct audio_device *adev);
+void audio_extn_dts_eagle_send_cached_params(const struct audio_device *adev,
+                                             const struct stream_out *out);
 #endif
 
 #if defined(DS1_DOLBY_DDP_ENABLED) || defined(DS1_DOLBY_DAP_ENABLED)
@@ -422,8 +427,15 @@ void audio_extn_utils_update_stream_app_type_cfg(void *platform,
                                   uint32_t bit_width,
                                   struct stream_app_type_cfg *app_type_cfg);
 int audio_extn_utils_send_app_type_cfg(struct audio_usecase *usecase);
+void audio_extn_utils_reset_app_type_cfg(struct audio_usecase *usecase);
+void audio_extn_utils_invalidate_cal_cache(struct audio_device *adev);
+struct mixer *audio_extn_utils_mixer_acquire(int card);
+void audio_extn_utils_mixer_release(struct mixer *mixer);
+struct mixer_ctl *audio_extn_utils_mixer_get_ctl(struct mixer *mixer, const char *name);
+void audio_extn_utils_mixer_pool_dump(int fd);
 void audio_extn_utils_send_audio_calibration(struct audio_device *adev,
                                              struct audio_usecase *usecase);
+int64_t audio_extn_utils_get_time_us(void);
 #ifdef DS2_DOLBY_DAP_ENABLED
 #define LIB_DS2_DAP_HAL "vendor/lib/libhwdaphal.so"
 #define SET_HW_INFO_FUNC "dap_hal_set_hw_info"
@@ -470,13 +482,84 @@ typedef enum {
 int b64decode(char *inp, int ilen, uint8_t* outp);
 int b64encode(uint8_t *inp, int ilen, char* outp);
 
+#define HOSTLESS_MAX_LEGS 4
+
+enum hostless_status {
+    HOSTLESS_STATUS_STOPPED = 0,
+    HOSTLESS_STATUS_STARTING,
+    HOSTLESS_STATUS_RUNNING,
+    HOSTLESS_STATUS_ERROR
+};
+
+/* One pcm of a hostless loopback session, opened and closed on its own thread */
+struct hostless_leg {
+    const char *name;
+    unsigned int flags;
+    int device_id;
+    struct pcm *pcm;
+    pthread_t thread;
+    int64_t open_us;
+    int64_t start_us;
+    int64_t close_us;
+};
+
+/*
+ * DSP loopback (FM, HFP) kept alive by pcms the HAL never reads or writes.
+ * The owner routes the usecase under adev->lock, fills in the leg device ids
+ * and starts the session; the legs are opened in parallel and started in
+ * array order on a background thread. Routing changes are applied with
+ * select_devices() while the legs keep running.
+ */
+struct hostless_session {
+    const char *name;
+    struct hostless_leg *legs;
+    int num_legs;
+    struct pcm_config *config;
+    /*
+     * Called from the bring-up thread once every leg is started, without
+     * adev->lock. State shared with it is guarded by the session lock.
+     */
+    void (*on_running)(struct hostless_session *session);
+    /*
+     * Called from the bring-up thread with adev->lock held when a leg failed,
+     * once the legs are closed, to take down the route of the usecase.
+     * Skipped when the owner stops or restarts the session first.
+     */
+    void (*on_error)(struct hostless_session *session);
+    struct audio_device *adev;
+    pthread_t start_thread;     /* detached, stop waits on cond instead */
+    pthread_mutex_t lock;
+    pthread_cond_t cond;        /* signalled on every status change */
+    enum hostless_status status;
+    uint32_t generation;        /* bumped by start and stop */
+    bool error_pending;         /* on_error not run yet for the failed bring-up */
+};
+
+int audio_extn_hostless_start(struct hostless_session *session,
+                              struct audio_device *adev);
+void audio_extn_hostless_stop(struct hostless_session *session);
+enum hostless_status audio_extn_hostless_get_status(struct hostless_session *session);
+const char *audio_extn_hostless_status_name(enum hostless_status status);
+int audio_extn_hostless_get_leg_timing(struct hostless_session *session,
+                                       char *buf, size_t len);
+
 #ifndef KPI_OPTIMIZE_ENABLED
 #define audio_extn_perf_lock_init() (0)
 #define audio_extn_perf_lock_acquire() (0)
 #define audio_extn_perf_lock_release() (0)
+#define audio_extn_perf_lock_io_begin(usecase) (0)
+#define audio_extn_perf_lock_io_end(usecase, period_us) (0)
+#define audio_extn_perf_lock_io_stop(usecase) (0)
+#define audio_extn_perf_lock_dump(fd) (0)
 #else
 int audio_extn_perf_lock_init(void);
 void audio_extn_perf_lock_acquire(void);
 void audio_extn_perf_lock_release(void);
+/* bracket a blocking pcm write or read of period_us worth of audio */
+void audio_extn_perf_lock_io_begin(audio_usecase_t usecase);
+void audio_extn_perf_lock_io_end(audio_usecase_t usecase, uint32_t period_us);
+/* the stream went to standby, its samples no longer count */
+void audio_extn_perf_lock_io_stop(audio_usecase_t usecase);
+void audio_extn_perf_lock_dump(int fd);
 #endif /* KPI_OPTIMIZE_ENABLED */
 #endif /* AUDIO_EXTN_H */
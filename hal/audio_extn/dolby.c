@@ -149,6 +149,98 @@ static struct ddp_endp_params {
               {1, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0} },
 };
 
+/* Endpoint table lookup by (output device bit, channel cap) */
+#define DDP_ENDP_NUM_DEVICE_BITS 32
+#define DDP_ENDP_NUM_CH_CAPS     3
+static int8_t ddp_endp_index[DDP_ENDP_NUM_DEVICE_BITS][DDP_ENDP_NUM_CH_CAPS];
+static bool ddp_endp_index_valid = false;
+
+/* What was last pushed to the decoder of each offload pcm device */
+#define DDP_MAX_PCM_DEVICES 64
+static struct ddp_stream_params {
+    struct mixer_ctl *ctl;
+    int  param_val[DDP_ENDP_NUM_PARAMS];
+    bool is_param_sent[DDP_ENDP_NUM_PARAMS];
+} ddp_stream_params[DDP_MAX_PCM_DEVICES];
+
+static int ddp_ch_cap_to_index(int dev_ch_cap)
+{
+    switch (dev_ch_cap) {
+    case 2:
+        return 0;
+    case 6:
+        return 1;
+    case 8:
+        return 2;
+    default:
+        return -EINVAL;
+    }
+}
+
+static int ddp_endp_param_index(int param_id)
+{
+    /* RUNNING_MODE and INPUT_MODE share id 0, the first entry wins */
+    switch (param_id) {
+    case PARAM_ID_MAX_OUTPUT_CHANNELS:    return 0;
+    case PARAM_ID_CTL_RUNNING_MODE:       return 1;
+    case PARAM_ID_CTL_ERROR_CONCEAL:      return 2;
+    case PARAM_ID_CTL_ERROR_MAX_RPTS:     return 3;
+    case PARAM_ID_CNV_ERROR_CONCEAL:      return 4;
+    case PARAM_ID_CTL_SUBSTREAM_SELECT:   return 5;
+    case PARAM_ID_OUT_CTL_OUTMODE:        return 7;
+    case PARAM_ID_OUT_CTL_OUTLFE_ON:      return 8;
+    case PARAM_ID_OUT_CTL_COMPMODE:       return 9;
+    case PARAM_ID_OUT_CTL_STEREO_MODE:    return 10;
+    case PARAM_ID_OUT_CTL_DUAL_MODE:      return 11;
+    case PARAM_ID_OUT_CTL_DRCSCALE_HIGH:  return 12;
+    case PARAM_ID_OUT_CTL_DRCSCALE_LOW:   return 13;
+    case PARAM_ID_OUT_CTL_OUT_PCMSCALE:   return 14;
+    case PARAM_ID_OUT_CTL_MDCT_BANDLIMIT: return 15;
+    case PARAM_ID_OUT_CTL_DRC_SUPPRESS:   return 16;
+    default:                              return -EINVAL;
+    }
+}
+
+static void init_ddp_endp_index()
+{
+    int idx, bit, cap;
+
+    memset(ddp_endp_index, -1, sizeof(ddp_endp_index));
+    for (idx = 0; idx < DDP_ENDP_NUM_DEVICES; idx++) {
+        bit = __builtin_ctz(ddp_endp_params[idx].device);
+        cap = ddp_ch_cap_to_index(ddp_endp_params[idx].dev_ch_cap);
+        if (cap < 0 || ddp_endp_index[bit][cap] >= 0)
+            continue;
+        ddp_endp_index[bit][cap] = idx;
+    }
+    ddp_endp_index_valid = true;
+}
+
+/*
+ * Returns the endpoint table entry for the lowest bit of device that has
+ * an entry with the given channel cap.
+ */
+static int get_ddp_endp_index(int device, int dev_ch_cap)
+{
+    uint32_t bits = device & AUDIO_DEVICE_OUT_ALL;
+    int cap = ddp_ch_cap_to_index(dev_ch_cap);
+    int bit;
+
+    if (cap < 0)
+        return -EINVAL;
+
+    if (!ddp_endp_index_valid)
+        init_ddp_endp_index();
+
+    while (bits) {
+        bit = __builtin_ctz(bits);
+        if (ddp_endp_index[bit][cap] >= 0)
+            return ddp_endp_index[bit][cap];
+        bits &= bits - 1;
+    }
+    return -EINVAL;
+}
+
 int update_ddp_endp_table(int device, int dev_ch_cap, int param_id,
                           int param_val)
 {
@@ -157,26 +249,14 @@ int update_ddp_endp_table(int device, int dev_ch_cap, int param_id,
     ALOGV("%s: dev 0x%x dev_ch_cap %d param_id 0x%x param_val %d",
            __func__, device, dev_ch_cap , param_id, param_val);
 
-    for(idx=0; idx<DDP_ENDP_NUM_DEVICES; idx++) {
-        if(ddp_endp_params[idx].device == device) {
-            if(ddp_endp_params[idx].dev_ch_cap == dev_ch_cap) {
-                break;
-            }
-        }
-    }
-
-    if(idx>=DDP_ENDP_NUM_DEVICES) {
+    idx = get_ddp_endp_index(device, dev_ch_cap);
+    if (idx < 0) {
         ALOGE("%s: device not available in DDP endp config table", __func__);
         return -EINVAL;
     }
 
-    for(param_idx=0; param_idx<DDP_ENDP_NUM_PARAMS; param_idx++) {
-        if (ddp_endp_params_id[param_idx] == param_id) {
-            break;
-        }
-    }
-
-    if(param_idx>=DDP_ENDP_NUM_PARAMS) {
+    param_idx = ddp_endp_param_index(param_id);
+    if (param_idx < 0) {
         ALOGE("param not available in DDP endp config table");
         return -EINVAL;
     }
@@ -186,48 +266,80 @@ int update_ddp_endp_table(int device, int dev_ch_cap, int param_id,
     return 0;
 }
 
+/*
+ * Pushes the endpoint params that differ from what the stream decoder
+ * last received. set_cache is true on stream start, where the decoder is
+ * new and the full set is sent.
+ */
 void send_ddp_endp_params_stream(struct stream_out *out,
                                  int device, int dev_ch_cap,
-                                 bool set_cache __unused)
+                                 bool set_cache)
 {
     int idx, i;
     int ddp_endp_params_data[2*DDP_ENDP_NUM_PARAMS + 1];
     int length = 0;
-    for(idx=0; idx<DDP_ENDP_NUM_DEVICES; idx++) {
-        if(ddp_endp_params[idx].device & device) {
-            if(ddp_endp_params[idx].dev_ch_cap == dev_ch_cap) {
-                break;
-            }
-        }
-    }
-    if(idx>=DDP_ENDP_NUM_DEVICES) {
+    int pcm_device_id;
+    struct ddp_stream_params *stream_params;
+
+    idx = get_ddp_endp_index(device, dev_ch_cap);
+    if (idx < 0) {
         ALOGE("device not available in DDP endp config table");
         return;
     }
 
+    pcm_device_id = platform_get_pcm_device_id(out->usecase, PCM_PLAYBACK);
+    if (pcm_device_id < 0 || pcm_device_id >= DDP_MAX_PCM_DEVICES) {
+        ALOGE("%s: invalid pcm device %d", __func__, pcm_device_id);
+        return;
+    }
+    stream_params = &ddp_stream_params[pcm_device_id];
+
+    if (set_cache)
+        memset(stream_params->is_param_sent, 0,
+               sizeof(stream_params->is_param_sent));
+
     length += 1; /* offset 0 is for num of parameter. increase offset by 1 */
     for (i=0; i<DDP_ENDP_NUM_PARAMS; i++) {
-        if(ddp_endp_params[idx].is_param_valid[i]) {
-            ddp_endp_params_data[length++] = ddp_endp_params_id[i];
-            ddp_endp_params_data[length++] = ddp_endp_params[idx].param_val[i];
-        }
+        if (!ddp_endp_params[idx].is_param_valid[i])
+            continue;
+        if (stream_params->is_param_sent[i] &&
+            stream_params->param_val[i] == ddp_endp_params[idx].param_val[i])
+            continue;
+        ddp_endp_params_data[length++] = ddp_endp_params_id[i];
+        ddp_endp_params_data[length++] = ddp_endp_params[idx].param_val[i];
     }
     ddp_endp_params_data[0] = (length-1)/2;
-    if(length) {
+    if (ddp_endp_params_data[0] == 0) {
+        ALOGV("%s: no change for pcm device %d", __func__, pcm_device_id);
+        return;
+    }
+
+    if (!stream_params->ctl) {
         char mixer_ctl_name[128];
         struct audio_device *adev = out->dev;
-        struct mixer_ctl *ctl;
-        int pcm_device_id = platform_get_pcm_device_id(out->usecase,
-                                                       PCM_PLAYBACK);
+
         snprintf(mixer_ctl_name, sizeof(mixer_ctl_name),
                  "Audio Stream %d Dec Params", pcm_device_id);
-        ctl = mixer_get_ctl_by_name(adev->mixer, mixer_ctl_name);
-        if (!ctl) {
+        stream_params->ctl = mixer_get_ctl_by_name(adev->mixer, mixer_ctl_name);
+        if (!stream_params->ctl) {
             ALOGE("%s: Could not get ctl for mixer cmd - %s",
                   __func__, mixer_ctl_name);
             return;
         }
-        mixer_ctl_set_array(ctl, ddp_endp_params_data, length);
+    }
+
+    if (mixer_ctl_set_array(stream_params->ctl, ddp_endp_params_data,
+                            length) < 0) {
+        ALOGE("%s: failed to set params for pcm device %d",
+              __func__, pcm_device_id);
+        return;
+    }
+
+    for (i=0; i<DDP_ENDP_NUM_PARAMS; i++) {
+        if (ddp_endp_params[idx].is_param_valid[i]) {
+            stream_params->param_val[i] = ddp_endp_params[idx].param_val[i];
+            stream_params->is_param_sent[i] = true;
+        }
     }
     return;
 }
@@ -26,6 +26,7 @@
 #include <cutils/str_parms.h>
 #include <sys/ioctl.h>
 #include <sys/stat.h>
+#include <unistd.h>
 #include <sound/asound.h>
 #include <sound/audio_effects.h>
 #include <sound/devdep_params.h>
@@ -43,51 +44,113 @@
 #define MAX_LENGTH_OF_INTEGER_IN_STRING 13
 #define PARAM_GET_MAX_SIZE              512
 
+#define MAX_PCM_DEVICES                 64
+
 struct dts_eagle_param_desc_alsa {
     int alsa_effect_ID;
     struct dts_eagle_param_desc d;
 };
 
+/* per offload pcm device, resolved once */
+struct dts_eagle_stream_ctls {
+    struct mixer_ctl *config_ctl;
+    struct mixer_ctl *query_ctl;
+};
+
+/* last value set for a (id, offset, device) parameter */
+struct dts_eagle_cached_param {
+    struct listnode list;
+    bool pending; /* not delivered to a stream or to the kernel cache yet */
+    struct dts_eagle_param_desc_alsa t; /* followed by t.d.size bytes */
+};
+
 static struct dts_eagle_param_desc_alsa *fade_in_data = NULL;
 static struct dts_eagle_param_desc_alsa *fade_out_data = NULL;
 static int32_t mDevices = 0;
 static int32_t mCurrDevice = 0;
 static const char* DTS_EAGLE_STR = DTS_EAGLE_KEY;
+static struct dts_eagle_stream_ctls stream_ctls[MAX_PCM_DEVICES];
+static list_declare(param_cache);
+static int device_fd = -1;
+static int fade_fd = -1;
 
-static int do_DTS_Eagle_params_stream(struct stream_out *out, struct dts_eagle_param_desc_alsa *t, bool get) {
+static struct dts_eagle_stream_ctls *get_stream_ctls(const struct stream_out *out)
+{
     char mixer_string[128];
-    char mixer_str_query[128];
-    struct mixer_ctl *ctl;
-    struct mixer_ctl *query_ctl;
+    struct dts_eagle_stream_ctls *ctls;
     int pcm_device_id = platform_get_pcm_device_id(out->usecase, PCM_PLAYBACK);
 
+    if (pcm_device_id < 0 || pcm_device_id >= MAX_PCM_DEVICES) {
+        ALOGE("DTS_EAGLE_HAL (%s): invalid pcm device %d", __func__, pcm_device_id);
+        return NULL;
+    }
+
+    ctls = &stream_ctls[pcm_device_id];
+    if (!ctls->config_ctl) {
+        snprintf(mixer_string, sizeof(mixer_string), "%s %d", "Audio Effects Config", pcm_device_id);
+        ctls->config_ctl = mixer_get_ctl_by_name(out->dev->mixer, mixer_string);
+        if (!ctls->config_ctl)
+            ALOGE("DTS_EAGLE_HAL (%s): failed to open mixer %s", __func__, mixer_string);
+    }
+    if (!ctls->query_ctl) {
+        snprintf(mixer_string, sizeof(mixer_string), "%s %d", "Query Audio Effect Param", pcm_device_id);
+        ctls->query_ctl = mixer_get_ctl_by_name(out->dev->mixer, mixer_string);
+    }
+    return ctls;
+}
+
+static int do_DTS_Eagle_params_stream(const struct stream_out *out, struct dts_eagle_param_desc_alsa *t, bool get) {
+    struct dts_eagle_stream_ctls *ctls = get_stream_ctls(out);
+
     ALOGV("DTS_EAGLE_HAL (%s): enter", __func__);
-    snprintf(mixer_string, sizeof(mixer_string), "%s %d", "Audio Effects Config", pcm_device_id);
-    ctl = mixer_get_ctl_by_name(out->dev->mixer, mixer_string);
-    if (!ctl) {
-        ALOGE("DTS_EAGLE_HAL (%s): failed to open mixer %s", __func__, mixer_string);
+    if (!ctls || !ctls->config_ctl) {
+        ALOGE("DTS_EAGLE_HAL (%s): no effects config mixer", __func__);
     } else if (t) {
         int size = t->d.size + sizeof(struct dts_eagle_param_desc_alsa);
-        ALOGD("DTS_EAGLE_HAL (%s): opened mixer %s", __func__, mixer_string);
         if (get) {
             ALOGD("DTS_EAGLE_HAL (%s): get request", __func__);
-            snprintf(mixer_str_query, sizeof(mixer_str_query), "%s %d", "Query Audio Effect Param", pcm_device_id);
-            query_ctl = mixer_get_ctl_by_name(out->dev->mixer, mixer_str_query);
-            if (!query_ctl) {
-                ALOGE("DTS_EAGLE_HAL (%s): failed to open mixer %s", __func__, mixer_str_query);
+            if (!ctls->query_ctl) {
+                ALOGE("DTS_EAGLE_HAL (%s): failed to open query mixer", __func__);
                 return -EINVAL;
             }
-            mixer_ctl_set_array(query_ctl, t, size);
-            return mixer_ctl_get_array(ctl, t, size);
+            mixer_ctl_set_array(ctls->query_ctl, t, size);
+            return mixer_ctl_get_array(ctls->config_ctl, t, size);
         }
         ALOGD("DTS_EAGLE_HAL (%s): set request", __func__);
-        return mixer_ctl_set_array(ctl, t, size);
+        return mixer_ctl_set_array(ctls->config_ctl, t, size);
     } else {
         ALOGD("DTS_EAGLE_HAL (%s): parameter data NULL", __func__);
     }
     return -EINVAL;
 }
 
+static int do_DTS_Eagle_params_node(struct dts_eagle_param_desc_alsa *t, bool get) {
+    int cmd = get ? DTS_EAGLE_IOCTL_GET_PARAM : DTS_EAGLE_IOCTL_SET_PARAM;
+
+    if (get) {
+        ALOGD("DTS_EAGLE_HAL (%s): no stream opened, attempting to retrieve directly from cache", __func__);
+        t->d.device &= ~DTS_EAGLE_FLAG_ALSA_GET;
+    } else {
+        ALOGD("DTS_EAGLE_HAL (%s): no stream opened, attempting to send directly to cache", __func__);
+        t->d.device |= DTS_EAGLE_FLAG_IOCTL_JUSTSETCACHE;
+    }
+
+    if (device_fd < 0) {
+        device_fd = open(DEVICE_NODE, O_RDWR);
+        if (device_fd < 0) {
+            ALOGE("DTS_EAGLE_HAL (%s): couldn't open device %s\n", __func__, DEVICE_NODE);
+            return -EINVAL;
+        }
+    }
+
+    if (ioctl(device_fd, cmd, &t->d) < 0) {
+        ALOGE("DTS_EAGLE_HAL (%s): error sending/getting param\n", __func__);
+        return -EINVAL;
+    }
+    ALOGD("DTS_EAGLE_HAL (%s): sent/retrieved param\n", __func__);
+    return 0;
+}
+
 static int do_DTS_Eagle_params(const struct audio_device *adev, struct dts_eagle_param_desc_alsa *t, bool get, const struct stream_out *out) {
     struct listnode *node;
     struct audio_usecase *usecase;
@@ -117,51 +180,111 @@ static int do_DTS_Eagle_params(const struct audio_device *adev, struct dts_eagle
     }
 
     if (!sent) {
-        int fd = open(DEVICE_NODE, O_RDWR);
+        tret = do_DTS_Eagle_params_node(t, get);
+        if (tret < 0)
+            ret = tret;
+    }
+    return ret;
+}
 
-        if (get) {
-            ALOGD("DTS_EAGLE_HAL (%s): no stream opened, attempting to retrieve directly from cache", __func__);
-            t->d.device &= ~DTS_EAGLE_FLAG_ALSA_GET;
-        } else {
-            ALOGD("DTS_EAGLE_HAL (%s): no stream opened, attempting to send directly to cache", __func__);
-            t->d.device |= DTS_EAGLE_FLAG_IOCTL_JUSTSETCACHE;
-        }
+/* the transport flags a get or set ORs into device are not part of the key */
+#define DTS_EAGLE_DEVICE_KEY(device) \
+    ((device) & ~(DTS_EAGLE_FLAG_ALSA_GET | DTS_EAGLE_FLAG_IOCTL_JUSTSETCACHE))
 
-        if (fd > 0) {
-            int cmd = get ? DTS_EAGLE_IOCTL_GET_PARAM : DTS_EAGLE_IOCTL_SET_PARAM;
-            if (ioctl(fd, cmd, &t->d) < 0) {
-                ALOGE("DTS_EAGLE_HAL (%s): error sending/getting param\n", __func__);
-                ret = -EINVAL;
-            } else {
-                ALOGD("DTS_EAGLE_HAL (%s): sent/retrieved param\n", __func__);
-            }
-            close(fd);
-        } else {
-            ALOGE("DTS_EAGLE_HAL (%s): couldn't open device %s\n", __func__, DEVICE_NODE);
-            ret = -EINVAL;
+static struct dts_eagle_cached_param *find_cached_param(const struct dts_eagle_param_desc *d) {
+    struct listnode *node;
+    struct dts_eagle_cached_param *p;
+
+    list_for_each(node, &param_cache) {
+        p = node_to_item(node, struct dts_eagle_cached_param, list);
+        if (p->t.d.id == d->id && p->t.d.offset == d->offset &&
+            DTS_EAGLE_DEVICE_KEY(p->t.d.device) == DTS_EAGLE_DEVICE_KEY(d->device))
+            return p;
+    }
+    return NULL;
+}
+
+/*
+ * Caches the parameter and sends it once: to the open offload streams, or
+ * to the kernel cache through the device node when none is open. Only a
+ * parameter that could not be delivered stays pending and is replayed on
+ * the next stream start. The caller's copy is sent, the node path tags
+ * its device field with DTS_EAGLE_FLAG_IOCTL_JUSTSETCACHE.
+ */
+static int dts_eagle_set_param(const struct audio_device *adev, struct dts_eagle_param_desc_alsa *t) {
+    struct dts_eagle_cached_param *p = find_cached_param(&t->d);
+    size_t size = sizeof(struct dts_eagle_param_desc_alsa) + t->d.size;
+    int ret;
+
+    if (p && p->t.d.size != t->d.size) {
+        list_remove(&p->list);
+        free(p);
+        p = NULL;
+    }
+    if (!p) {
+        p = (struct dts_eagle_cached_param *)malloc(sizeof(*p) + t->d.size);
+        if (!p) {
+            ALOGE("DTS_EAGLE_HAL (%s): mem alloc for param cache failed.", __func__);
+            return do_DTS_Eagle_params(adev, t, false, NULL);
         }
+        list_add_tail(&param_cache, &p->list);
     }
+    memcpy(&p->t, t, size);
+
+    ret = do_DTS_Eagle_params(adev, t, false, NULL);
+    p->pending = ret < 0;
+    if (p->pending)
+        ALOGV("DTS_EAGLE_HAL (%s): id 0x%X not delivered, pending", __func__, t->d.id);
     return ret;
 }
 
+void audio_extn_dts_eagle_send_cached_params(const struct audio_device *adev __unused,
+                                             const struct stream_out *out) {
+    struct listnode *node;
+    struct dts_eagle_cached_param *p;
+    char prop[PROPERTY_VALUE_MAX];
+    int count = 0;
+
+    property_get("use.dts_eagle", prop, "0");
+    if (strncmp("true", prop, sizeof("true")))
+        return;
+
+    list_for_each(node, &param_cache) {
+        p = node_to_item(node, struct dts_eagle_cached_param, list);
+        /* the others already reached the kernel, which applies them itself */
+        if (!p->pending)
+            continue;
+        if (do_DTS_Eagle_params_stream(out, &p->t, false) < 0) {
+            ALOGE("DTS_EAGLE_HAL (%s): failed to replay id 0x%X", __func__, p->t.d.id);
+            continue;
+        }
+        p->pending = false;
+        count++;
+    }
+    ALOGV("DTS_EAGLE_HAL (%s): replayed %d params", __func__, count);
+}
+
 static void fade_node(bool need_data) {
     char prop[PROPERTY_VALUE_MAX];
     property_get("use.dts_eagle", prop, "0");
     if (strncmp("true", prop, sizeof("true")))
         return;
-    int fd, n = 0;
-    if ((fd = open(FADE_NOTIFY_FILE, O_TRUNC|O_WRONLY)) < 0) {
-        ALOGV("No fade node, create one");
-        fd = creat(FADE_NOTIFY_FILE, S_IRUSR|S_IWUSR|S_IRGRP|S_IROTH);
-        if (fd < 0) {
-            ALOGE("DTS_EAGLE_HAL (%s): Creating fade notifier node failed", __func__);
-            return;
+    int n = 0;
+    /* the notifier node stays open, each notification rewrites it in place */
+    if (fade_fd < 0) {
+        if ((fade_fd = open(FADE_NOTIFY_FILE, O_WRONLY)) < 0) {
+            ALOGV("No fade node, create one");
+            fade_fd = creat(FADE_NOTIFY_FILE, S_IRUSR|S_IWUSR|S_IRGRP|S_IROTH);
+            if (fade_fd < 0) {
+                ALOGE("DTS_EAGLE_HAL (%s): Creating fade notifier node failed", __func__);
+                return;
+            }
+            chmod(FADE_NOTIFY_FILE, S_IRWXU|S_IRGRP|S_IXGRP|S_IROTH);
         }
-        chmod(FADE_NOTIFY_FILE, S_IRWXU|S_IRGRP|S_IXGRP|S_IROTH);
     }
     char *str = need_data ? "need" : "have";
-    n = write(fd, str, strlen(str));
-    close(fd);
+    if (ftruncate(fade_fd, 0) == 0)
+        n = pwrite(fade_fd, str, strlen(str), 0);
     if (n > 0)
         ALOGI("DTS_EAGLE_HAL (%s): fade notifier node set to \"%s\", %i bytes written", __func__, str, n);
     else
@@ -302,7 +425,7 @@ void audio_extn_dts_eagle_set_parameters(struct audio_device *adev, struct str_p
                 ALOGD("DTS_EAGLE_HAL (%s): id: 0x%X, size: %d, offset: %d, device: %d", __func__,
                        (*t)->d.id, (*t)->d.size, (*t)->d.offset, (*t)->d.device);
                 if (!fade_in) {
-                    ret = do_DTS_Eagle_params(adev, *t, false, NULL);
+                    ret = dts_eagle_set_param(adev, *t);
                     if (ret < 0)
                         ALOGE("DTS_EAGLE_HAL (%s): failed setting params in kernel with error %i", __func__, ret);
                 }
@@ -383,7 +506,15 @@ int audio_extn_dts_eagle_get_parameters(const struct audio_device *adev,
                     ALOGE("%s: requested data too large", __func__);
                     return -1;
                 }
-                ret = do_DTS_Eagle_params(adev, t, true, NULL);
+                struct dts_eagle_cached_param *p = find_cached_param(&t->d);
+                if (p && p->pending && (int)p->t.d.size >= size) {
+                    /* not sent to the kernel yet, answer from the cache */
+                    memcpy(params + sizeof(struct dts_eagle_param_desc_alsa),
+                           (char *)&p->t + sizeof(struct dts_eagle_param_desc_alsa), size);
+                    ret = 0;
+                } else {
+                    ret = do_DTS_Eagle_params(adev, t, true, NULL);
+                }
                 if (ret >= 0) {
                     data = (int*)(params + sizeof(struct dts_eagle_param_desc_alsa));
                     for (i = 0; i < count; i++)
@@ -23,9 +23,11 @@
 
 #include <errno.h>
 #include <math.h>
+#include <pthread.h>
 #include <cutils/log.h>
 
 #include "audio_hw.h"
+#include "audio_extn.h"
 #include "platform.h"
 #include "platform_api.h"
 #include <stdlib.h>
@@ -46,30 +48,72 @@ static struct pcm_config pcm_config_fm = {
     .avail_min = 0,
 };
 
+/* in the order the legs are started */
+enum fm_leg_id {
+    FM_LEG_RX = 0,
+    FM_LEG_TX,
+    FM_LEG_MAX
+};
+
 struct fm_module {
-    struct pcm *fm_pcm_rx;
-    struct pcm *fm_pcm_tx;
+    struct hostless_leg legs[FM_LEG_MAX];
+    struct hostless_session session;
+    /* guarded by session.lock, the bring-up thread applies the volume too */
     bool is_fm_running;
     float fm_volume;
     bool restart_fm;
     int scard_state;
 };
 
+static void fm_on_running(struct hostless_session *session);
+static void fm_on_error(struct hostless_session *session);
+
 static struct fm_module fmmod = {
-  .fm_pcm_rx = NULL,
-  .fm_pcm_tx = NULL,
+  .legs = {
+      [FM_LEG_RX] = { .name = "fm_rx", .flags = PCM_OUT },
+      [FM_LEG_TX] = { .name = "fm_tx", .flags = PCM_IN },
+  },
+  .session = {
+      .name = "fm",
+      .legs = fmmod.legs,
+      .num_legs = FM_LEG_MAX,
+      .config = &pcm_config_fm,
+      .on_running = fm_on_running,
+      .on_error = fm_on_error,
+      .lock = PTHREAD_MUTEX_INITIALIZER,
+      .cond = PTHREAD_COND_INITIALIZER,
+      .status = HOSTLESS_STATUS_STOPPED,
+  },
   .fm_volume = 0,
   .is_fm_running = 0,
   .restart_fm = 0,
   .scard_state = SND_CARD_STATE_ONLINE,
 };
 
-static int32_t fm_set_volume(struct audio_device *adev, float value)
+/* fmmod.session.lock held */
+static int32_t fm_apply_volume(struct audio_device *adev)
 {
-    int32_t vol, ret = 0;
+    int32_t vol;
     struct mixer_ctl *ctl;
     const char *mixer_ctl_name = FM_RX_VOLUME;
 
+    vol  = lrint((fmmod.fm_volume * 0x2000) + 0.5);
+
+    ALOGD("%s: Setting FM volume to %d \n", __func__, vol);
+    ctl = mixer_get_ctl_by_name(adev->mixer, mixer_ctl_name);
+    if (!ctl) {
+        ALOGE("%s: Could not get ctl for mixer cmd - %s",
+              __func__, mixer_ctl_name);
+        return -EINVAL;
+    }
+    mixer_ctl_set_value(ctl, 0, vol);
+    return 0;
+}
+
+static int32_t fm_set_volume(struct audio_device *adev, float value)
+{
+    int32_t ret;
+
     ALOGV("%s: entry", __func__);
     ALOGD("%s: (%f)\n", __func__, value);
 
@@ -80,60 +124,83 @@ static int32_t fm_set_volume(struct audio_device *adev, float value)
         ALOGW("%s: (%f) Over 1.0, assuming 1.0\n", __func__, value);
         value = 1.0;
     }
-    vol  = lrint((value * 0x2000) + 0.5);
-    fmmod.fm_volume = value;
 
+    pthread_mutex_lock(&fmmod.session.lock);
+    fmmod.fm_volume = value;
     if (!fmmod.is_fm_running) {
         ALOGV("%s: FM not active, ignoring set_fm_volume call", __func__);
-        return -EIO;
+        ret = -EIO;
+    } else {
+        ret = fm_apply_volume(adev);
     }
+    pthread_mutex_unlock(&fmmod.session.lock);
 
-    ALOGD("%s: Setting FM volume to %d \n", __func__, vol);
-    ctl = mixer_get_ctl_by_name(adev->mixer, mixer_ctl_name);
-    if (!ctl) {
-        ALOGE("%s: Could not get ctl for mixer cmd - %s",
-              __func__, mixer_ctl_name);
-        return -EINVAL;
-    }
-    mixer_ctl_set_value(ctl, 0, vol);
     ALOGV("%s: exit", __func__);
     return ret;
 }
 
-static int32_t fm_stop(struct audio_device *adev)
+/*
+ * Runs on the bring-up thread, which cannot take adev->lock since fm_stop()
+ * waits for it under adev->lock. The session lock orders it against
+ * fm_set_volume(), so the last volume set is the one applied.
+ */
+static void fm_on_running(struct hostless_session *session)
 {
-    int32_t i, ret = 0;
-    struct audio_usecase *uc_info;
+    pthread_mutex_lock(&session->lock);
+    fmmod.is_fm_running = true;
+    fm_apply_volume(session->adev);
+    pthread_mutex_unlock(&session->lock);
+}
 
-    ALOGD("%s: enter", __func__);
-    fmmod.is_fm_running = false;
+static bool fm_is_active(struct audio_device *adev)
+{
+    return get_usecase_from_list(adev, USECASE_AUDIO_PLAYBACK_FM) != NULL;
+}
 
-    /* 1. Close the PCM devices */
-    if (fmmod.fm_pcm_rx) {
-        pcm_close(fmmod.fm_pcm_rx);
-        fmmod.fm_pcm_rx = NULL;
-    }
-    if (fmmod.fm_pcm_tx) {
-        pcm_close(fmmod.fm_pcm_tx);
-        fmmod.fm_pcm_tx = NULL;
-    }
+/* adev->lock held, the pcms are already closed */
+static int32_t fm_disable_route(struct audio_device *adev)
+{
+    struct audio_usecase *uc_info;
 
     uc_info = get_usecase_from_list(adev, USECASE_AUDIO_PLAYBACK_FM);
     if (uc_info == NULL) {
         ALOGE("%s: Could not find the usecase (%d) in the list",
-              __func__, USECASE_VOICE_CALL);
+              __func__, USECASE_AUDIO_PLAYBACK_FM);
         return -EINVAL;
     }
 
-    /* 2. Get and set stream specific mixer controls */
+    /* Get and set stream specific mixer controls */
     disable_audio_route(adev, uc_info);
 
-    /* 3. Disable the rx and tx devices */
+    /* Disable the rx and tx devices */
     disable_snd_device(adev, uc_info->out_snd_device);
     disable_snd_device(adev, uc_info->in_snd_device);
 
     list_remove(&uc_info->list);
     free(uc_info);
+    return 0;
+}
+
+static void fm_on_error(struct hostless_session *session)
+{
+    ALOGE("%s: FM bring-up failed, disabling its route", __func__);
+    fm_disable_route(session->adev);
+}
+
+static int32_t fm_stop(struct audio_device *adev)
+{
+    int32_t ret;
+
+    ALOGD("%s: enter", __func__);
+
+    /* 1. Close the PCM devices, waiting for a pending bring-up first */
+    audio_extn_hostless_stop(&fmmod.session);
+    pthread_mutex_lock(&fmmod.session.lock);
+    fmmod.is_fm_running = false;
+    pthread_mutex_unlock(&fmmod.session.lock);
+
+    /* 2. Take down the route */
+    ret = fm_disable_route(adev);
 
     ALOGD("%s: exit: status(%d)", __func__, ret);
     return ret;
@@ -176,32 +243,13 @@ static int32_t fm_start(struct audio_device *adev)
     ALOGV("%s: FM PCM devices (rx: %d tx: %d) for the usecase(%d)",
               __func__, pcm_dev_rx_id, pcm_dev_tx_id, uc_info->id);
 
-    ALOGV("%s: Opening PCM playback device card_id(%d) device_id(%d)",
-          __func__, adev->snd_card, pcm_dev_rx_id);
-    fmmod.fm_pcm_rx = pcm_open(adev->snd_card,
-                               pcm_dev_rx_id,
-                               PCM_OUT, &pcm_config_fm);
-    if (fmmod.fm_pcm_rx && !pcm_is_ready(fmmod.fm_pcm_rx)) {
-        ALOGE("%s: %s", __func__, pcm_get_error(fmmod.fm_pcm_rx));
-        ret = -EIO;
-        goto exit;
-    }
+    fmmod.legs[FM_LEG_RX].device_id = pcm_dev_rx_id;
+    fmmod.legs[FM_LEG_TX].device_id = pcm_dev_tx_id;
 
-    ALOGV("%s: Opening PCM capture device card_id(%d) device_id(%d)",
-          __func__, adev->snd_card, pcm_dev_tx_id);
-    fmmod.fm_pcm_tx = pcm_open(adev->snd_card,
-                               pcm_dev_tx_id,
-                               PCM_IN, &pcm_config_fm);
-    if (fmmod.fm_pcm_tx && !pcm_is_ready(fmmod.fm_pcm_tx)) {
-        ALOGE("%s: %s", __func__, pcm_get_error(fmmod.fm_pcm_tx));
-        ret = -EIO;
+    /* only the routing above needs adev->lock, the pcms come up in the background */
+    ret = audio_extn_hostless_start(&fmmod.session, adev);
+    if (ret != 0)
         goto exit;
-    }
-    pcm_start(fmmod.fm_pcm_rx);
-    pcm_start(fmmod.fm_pcm_tx);
-
-    fmmod.is_fm_running = true;
-    fm_set_volume(adev, fmmod.fm_volume);
 
     ALOGD("%s: exit: status(%d)", __func__, ret);
     return 0;
@@ -230,18 +278,19 @@ void audio_extn_fm_set_parameters(struct audio_device *adev,
             fmmod.scard_state = SND_CARD_STATE_ONLINE;
         }
     }
-    if(fmmod.is_fm_running) {
+    if (fm_is_active(adev)) {
         if (fmmod.scard_state == SND_CARD_STATE_OFFLINE) {
             ALOGD("sound card is OFFLINE, stop FM");
             fm_stop(adev);
             fmmod.restart_fm = 1;
         }
 
+        /* the loopback keeps running while the route is switched */
         ret = str_parms_get_str(parms, AUDIO_PARAMETER_STREAM_ROUTING,
                                 value, sizeof(value));
         if (ret >= 0) {
             val = atoi(value);
-            if(val > 0)
+            if (val > 0 && fm_is_active(adev))
                 select_devices(adev, USECASE_AUDIO_PLAYBACK_FM);
         }
     }
@@ -258,11 +307,11 @@ void audio_extn_fm_set_parameters(struct audio_device *adev,
         ALOGD("%s: FM usecase", __func__);
         if (val != 0) {
             if(val & AUDIO_DEVICE_OUT_FM
-               && fmmod.is_fm_running == false) {
+               && !fm_is_active(adev)) {
                 adev->primary_output->devices = val & ~AUDIO_DEVICE_OUT_FM;
                 fm_start(adev);
             } else if (!(val & AUDIO_DEVICE_OUT_FM)
-                     && fmmod.is_fm_running == true)
+                     && fm_is_active(adev))
                 fm_stop(adev);
        }
     }
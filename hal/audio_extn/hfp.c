@@ -32,9 +32,11 @@ IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.*/
 
 #include <errno.h>
 #include <math.h>
+#include <pthread.h>
 #include <cutils/log.h>
 
 #include "audio_hw.h"
+#include "audio_extn.h"
 #include "platform.h"
 #include "platform_api.h"
 #include <stdlib.h>
@@ -44,6 +46,8 @@ IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.*/
 #define AUDIO_PARAMETER_HFP_ENABLE      "hfp_enable"
 #define AUDIO_PARAMETER_HFP_SET_SAMPLING_RATE "hfp_set_sampling_rate"
 #define AUDIO_PARAMETER_KEY_HFP_VOLUME "hfp_volume"
+#define AUDIO_PARAMETER_HFP_STATUS      "hfp_status"
+#define AUDIO_PARAMETER_HFP_LEG_TIMING  "hfp_leg_timing"
 
 #ifdef PLATFORM_MSM8994
 #define HFP_RX_VOLUME     "SEC AUXPCM LOOPBACK Volume"
@@ -56,25 +60,27 @@ static int32_t start_hfp(struct audio_device *adev,
 
 static int32_t stop_hfp(struct audio_device *adev);
 
+/* in the order the DSP expects the legs to be started */
+enum hfp_leg_id {
+    HFP_LEG_SCO_RX = 0,
+    HFP_LEG_SCO_TX,
+    HFP_LEG_PCM_RX,
+    HFP_LEG_PCM_TX,
+    HFP_LEG_MAX
+};
+
 struct hfp_module {
-    struct pcm *hfp_sco_rx;
-    struct pcm *hfp_sco_tx;
-    struct pcm *hfp_pcm_rx;
-    struct pcm *hfp_pcm_tx;
+    struct hostless_leg legs[HFP_LEG_MAX];
+    struct hostless_session session;
+    /* guarded by session.lock, the bring-up thread applies the volume too */
     bool is_hfp_running;
     float hfp_volume;
     audio_usecase_t ucid;
 };
 
-static struct hfp_module hfpmod = {
-    .hfp_sco_rx = NULL,
-    .hfp_sco_tx = NULL,
-    .hfp_pcm_rx = NULL,
-    .hfp_pcm_tx = NULL,
-    .hfp_volume = 0,
-    .is_hfp_running = 0,
-    .ucid = USECASE_AUDIO_HFP_SCO,
-};
+static void hfp_on_running(struct hostless_session *session);
+static void hfp_on_error(struct hostless_session *session);
+
 static struct pcm_config pcm_config_hfp = {
     .channels = 1,
     .rate = 8000,
@@ -86,16 +92,37 @@ static struct pcm_config pcm_config_hfp = {
     .avail_min = 0,
 };
 
-static int32_t hfp_set_volume(struct audio_device *adev, float value)
+static struct hfp_module hfpmod = {
+    .legs = {
+        [HFP_LEG_SCO_RX] = { .name = "sco_rx", .flags = PCM_OUT },
+        [HFP_LEG_SCO_TX] = { .name = "sco_tx", .flags = PCM_IN },
+        [HFP_LEG_PCM_RX] = { .name = "pcm_rx", .flags = PCM_OUT },
+        [HFP_LEG_PCM_TX] = { .name = "pcm_tx", .flags = PCM_IN },
+    },
+    .session = {
+        .name = "hfp",
+        .legs = hfpmod.legs,
+        .num_legs = HFP_LEG_MAX,
+        .config = &pcm_config_hfp,
+        .on_running = hfp_on_running,
+        .on_error = hfp_on_error,
+        .lock = PTHREAD_MUTEX_INITIALIZER,
+        .cond = PTHREAD_COND_INITIALIZER,
+        .status = HOSTLESS_STATUS_STOPPED,
+    },
+    .hfp_volume = 0,
+    .is_hfp_running = 0,
+    .ucid = USECASE_AUDIO_HFP_SCO,
+};
+
+/* hfpmod.session.lock held */
+static int32_t hfp_apply_volume(struct audio_device *adev)
 {
-    int32_t vol, ret = 0;
+    int32_t vol;
+    float value = hfpmod.hfp_volume;
     struct mixer_ctl *ctl;
     const char *mixer_ctl_name = HFP_RX_VOLUME;
 
-    ALOGV("%s: entry", __func__);
-    ALOGD("%s: (%f)\n", __func__, value);
-
-    hfpmod.hfp_volume = value;
     if (value < 0.0) {
         ALOGW("%s: (%f) Under 0.0, assuming 0.0\n", __func__, value);
         value = 0.0;
@@ -105,11 +132,6 @@ static int32_t hfp_set_volume(struct audio_device *adev, float value)
     }
     vol  = lrint((value * 0x2000) + 0.5);
 
-    if (!hfpmod.is_hfp_running) {
-        ALOGV("%s: HFP not active, ignoring set_hfp_volume call", __func__);
-        return -EIO;
-    }
-
     ALOGD("%s: Setting HFP volume to %d \n", __func__, vol);
     ctl = mixer_get_ctl_by_name(adev->mixer, mixer_ctl_name);
     if (!ctl) {
@@ -121,11 +143,43 @@ static int32_t hfp_set_volume(struct audio_device *adev, float value)
         ALOGE("%s: Couldn't set HFP Volume: [%d]", __func__, vol);
         return -EINVAL;
     }
+    return 0;
+}
+
+static int32_t hfp_set_volume(struct audio_device *adev, float value)
+{
+    int32_t ret;
+
+    ALOGV("%s: entry", __func__);
+    ALOGD("%s: (%f)\n", __func__, value);
+
+    pthread_mutex_lock(&hfpmod.session.lock);
+    hfpmod.hfp_volume = value;
+    if (!hfpmod.is_hfp_running) {
+        ALOGV("%s: HFP not active, ignoring set_hfp_volume call", __func__);
+        ret = -EIO;
+    } else {
+        ret = hfp_apply_volume(adev);
+    }
+    pthread_mutex_unlock(&hfpmod.session.lock);
 
     ALOGV("%s: exit", __func__);
     return ret;
 }
 
+/*
+ * Runs on the bring-up thread, which cannot take adev->lock since stop_hfp()
+ * waits for it under adev->lock. The session lock orders it against
+ * hfp_set_volume(), so the last volume set is the one applied.
+ */
+static void hfp_on_running(struct hostless_session *session)
+{
+    pthread_mutex_lock(&session->lock);
+    hfpmod.is_hfp_running = true;
+    hfp_apply_volume(session->adev);
+    pthread_mutex_unlock(&session->lock);
+}
+
 static int32_t start_hfp(struct audio_device *adev,
                          struct str_parms *parms __unused)
 {
@@ -135,6 +189,11 @@ static int32_t start_hfp(struct audio_device *adev,
 
     ALOGD("%s: enter", __func__);
 
+    if (get_usecase_from_list(adev, hfpmod.ucid) != NULL) {
+        ALOGW("%s: HFP session already started", __func__);
+        return -EBUSY;
+    }
+
     uc_info = (struct audio_usecase *)calloc(1, sizeof(struct audio_usecase));
 
     if (!uc_info)
@@ -166,67 +225,15 @@ static int32_t start_hfp(struct audio_device *adev,
     ALOGV("%s: HFP PCM devices (hfp rx tx: %d pcm rx tx: %d) for the usecase(%d)",
               __func__, pcm_dev_rx_id, pcm_dev_tx_id, uc_info->id);
 
-    ALOGV("%s: Opening PCM playback device card_id(%d) device_id(%d)",
-          __func__, adev->snd_card, pcm_dev_rx_id);
-    hfpmod.hfp_sco_rx = pcm_open(adev->snd_card,
-                                  pcm_dev_asm_rx_id,
-                                  PCM_OUT, &pcm_config_hfp);
-    if (hfpmod.hfp_sco_rx && !pcm_is_ready(hfpmod.hfp_sco_rx)) {
-        ALOGE("%s: %s", __func__, pcm_get_error(hfpmod.hfp_sco_rx));
-        ret = -EIO;
-        goto exit;
-    }
-    ALOGD("%s: Opening PCM capture device card_id(%d) device_id(%d)",
-          __func__, adev->snd_card, pcm_dev_tx_id);
-    hfpmod.hfp_pcm_rx = pcm_open(adev->snd_card,
-                                   pcm_dev_rx_id,
-                                   PCM_OUT, &pcm_config_hfp);
-    if (hfpmod.hfp_pcm_rx && !pcm_is_ready(hfpmod.hfp_pcm_rx)) {
-        ALOGE("%s: %s", __func__, pcm_get_error(hfpmod.hfp_pcm_rx));
-        ret = -EIO;
-        goto exit;
-    }
-    hfpmod.hfp_sco_tx = pcm_open(adev->snd_card,
-                                  pcm_dev_asm_tx_id,
-                                  PCM_IN, &pcm_config_hfp);
-    if (hfpmod.hfp_sco_tx && !pcm_is_ready(hfpmod.hfp_sco_tx)) {
-        ALOGE("%s: %s", __func__, pcm_get_error(hfpmod.hfp_sco_tx));
-        ret = -EIO;
-        goto exit;
-    }
-    ALOGV("%s: Opening PCM capture device card_id(%d) device_id(%d)",
-          __func__, adev->snd_card, pcm_dev_tx_id);
-    hfpmod.hfp_pcm_tx = pcm_open(adev->snd_card,
-                                   pcm_dev_tx_id,
-                                   PCM_IN, &pcm_config_hfp);
-    if (hfpmod.hfp_pcm_tx && !pcm_is_ready(hfpmod.hfp_pcm_tx)) {
-        ALOGE("%s: %s", __func__, pcm_get_error(hfpmod.hfp_pcm_tx));
-        ret = -EIO;
-        goto exit;
-    }
-    if (pcm_start(hfpmod.hfp_sco_rx) < 0) {
-        ALOGE("%s: pcm start for hfp sco rx failed", __func__);
-        ret = -EINVAL;
-        goto exit;
-    }
-    if (pcm_start(hfpmod.hfp_sco_tx) < 0) {
-        ALOGE("%s: pcm start for hfp sco tx failed", __func__);
-        ret = -EINVAL;
-        goto exit;
-    }
-    if (pcm_start(hfpmod.hfp_pcm_rx) < 0) {
-        ALOGE("%s: pcm start for hfp pcm rx failed", __func__);
-        ret = -EINVAL;
-        goto exit;
-    }
-    if (pcm_start(hfpmod.hfp_pcm_tx) < 0) {
-        ALOGE("%s: pcm start for hfp pcm tx failed", __func__);
-        ret = -EINVAL;
-        goto exit;
-    }
+    hfpmod.legs[HFP_LEG_SCO_RX].device_id = pcm_dev_asm_rx_id;
+    hfpmod.legs[HFP_LEG_SCO_TX].device_id = pcm_dev_asm_tx_id;
+    hfpmod.legs[HFP_LEG_PCM_RX].device_id = pcm_dev_rx_id;
+    hfpmod.legs[HFP_LEG_PCM_TX].device_id = pcm_dev_tx_id;
 
-    hfpmod.is_hfp_running = true;
-    hfp_set_volume(adev, hfpmod.hfp_volume);
+    /* the pcms come up in the background, progress is reported by hfp_status */
+    ret = audio_extn_hostless_start(&hfpmod.session, adev);
+    if (ret != 0)
+        goto exit;
 
     ALOGD("%s: exit: status(%d)", __func__, ret);
     return 0;
@@ -237,32 +244,11 @@ exit:
     return ret;
 }
 
-static int32_t stop_hfp(struct audio_device *adev)
+/* adev->lock held, the pcms are already closed */
+static int32_t hfp_disable_route(struct audio_device *adev)
 {
-    int32_t i, ret = 0;
     struct audio_usecase *uc_info;
 
-    ALOGD("%s: enter", __func__);
-    hfpmod.is_hfp_running = false;
-
-    /* 1. Close the PCM devices */
-    if (hfpmod.hfp_sco_rx) {
-        pcm_close(hfpmod.hfp_sco_rx);
-        hfpmod.hfp_sco_rx = NULL;
-    }
-    if (hfpmod.hfp_sco_tx) {
-        pcm_close(hfpmod.hfp_sco_tx);
-        hfpmod.hfp_sco_tx = NULL;
-    }
-    if (hfpmod.hfp_pcm_rx) {
-        pcm_close(hfpmod.hfp_pcm_rx);
-        hfpmod.hfp_pcm_rx = NULL;
-    }
-    if (hfpmod.hfp_pcm_tx) {
-        pcm_close(hfpmod.hfp_pcm_tx);
-        hfpmod.hfp_pcm_tx = NULL;
-    }
-
     uc_info = get_usecase_from_list(adev, hfpmod.ucid);
     if (uc_info == NULL) {
         ALOGE("%s: Could not find the usecase (%d) in the list",
@@ -270,18 +256,41 @@ static int32_t stop_hfp(struct audio_device *adev)
         return -EINVAL;
     }
 
-    /* 2. Disable echo reference while stopping hfp */
+    /* Disable echo reference while stopping hfp */
     platform_set_echo_reference(adev->platform, false);
 
-    /* 3. Get and set stream specific mixer controls */
+    /* Get and set stream specific mixer controls */
     disable_audio_route(adev, uc_info);
 
-    /* 4. Disable the rx and tx devices */
+    /* Disable the rx and tx devices */
     disable_snd_device(adev, uc_info->out_snd_device);
     disable_snd_device(adev, uc_info->in_snd_device);
 
     list_remove(&uc_info->list);
     free(uc_info);
+    return 0;
+}
+
+static void hfp_on_error(struct hostless_session *session)
+{
+    ALOGE("%s: HFP bring-up failed, disabling its route", __func__);
+    hfp_disable_route(session->adev);
+}
+
+static int32_t stop_hfp(struct audio_device *adev)
+{
+    int32_t ret;
+
+    ALOGD("%s: enter", __func__);
+
+    /* 1. Close the PCM devices, waiting for a pending bring-up first */
+    audio_extn_hostless_stop(&hfpmod.session);
+    pthread_mutex_lock(&hfpmod.session.lock);
+    hfpmod.is_hfp_running = false;
+    pthread_mutex_unlock(&hfpmod.session.lock);
+
+    /* 2. Take down the route */
+    ret = hfp_disable_route(adev);
 
     ALOGD("%s: exit: status(%d)", __func__, ret);
     return ret;
@@ -303,6 +312,23 @@ audio_usecase_t audio_extn_hfp_get_usecase()
     return hfpmod.ucid;
 }
 
+void audio_extn_hfp_get_parameters(struct str_parms *query, struct str_parms *reply)
+{
+    char value[256] = {0};
+
+    if (str_parms_get_str(query, AUDIO_PARAMETER_HFP_STATUS, value,
+                          sizeof(value)) >= 0)
+        str_parms_add_str(reply, AUDIO_PARAMETER_HFP_STATUS,
+                          audio_extn_hostless_status_name(
+                              audio_extn_hostless_get_status(&hfpmod.session)));
+
+    if (str_parms_get_str(query, AUDIO_PARAMETER_HFP_LEG_TIMING, value,
+                          sizeof(value)) >= 0) {
+        audio_extn_hostless_get_leg_timing(&hfpmod.session, value, sizeof(value));
+        str_parms_add_str(reply, AUDIO_PARAMETER_HFP_LEG_TIMING, value);
+    }
+}
+
 void audio_extn_hfp_set_parameters(struct audio_device *adev, struct str_parms *parms)
 {
     int ret;
@@ -311,20 +337,14 @@ void audio_extn_hfp_set_parameters(struct audio_device *adev, struct str_parms *
     float vol;
     char value[32]={0};
 
-    ret = str_parms_get_str(parms, AUDIO_PARAMETER_HFP_ENABLE, value,
-                            sizeof(value));
-    if (ret >= 0) {
-           if (!strncmp(value,"true",sizeof(value)))
-               ret = start_hfp(adev,parms);
-           else
-               stop_hfp(adev);
-    }
-    memset(value, 0, sizeof(value));
     ret = str_parms_get_str(parms,AUDIO_PARAMETER_HFP_SET_SAMPLING_RATE, value,
                             sizeof(value));
     if (ret >= 0) {
            rate = atoi(value);
-           if (rate == 8000){
+           /* the bring-up thread reads the config, and stop_hfp() needs the ucid */
+           if (audio_extn_hfp_is_active(adev))
+               ALOGE("%s: HFP active, ignoring sampling rate %d", __func__, rate);
+           else if (rate == 8000){
                hfpmod.ucid = USECASE_AUDIO_HFP_SCO;
                pcm_config_hfp.rate = rate;
            } else if (rate == 16000){
@@ -334,7 +354,18 @@ void audio_extn_hfp_set_parameters(struct audio_device *adev, struct str_parms *
                ALOGE("Unsupported rate..");
     }
 
-    if (hfpmod.is_hfp_running) {
+    memset(value, 0, sizeof(value));
+    ret = str_parms_get_str(parms, AUDIO_PARAMETER_HFP_ENABLE, value,
+                            sizeof(value));
+    if (ret >= 0) {
+           if (!strncmp(value,"true",sizeof(value)))
+               ret = start_hfp(adev,parms);
+           else
+               stop_hfp(adev);
+    }
+
+    /* the route can switch while the pcms are still coming up */
+    if (audio_extn_hfp_is_active(adev)) {
         memset(value, 0, sizeof(value));
         ret = str_parms_get_str(parms, AUDIO_PARAMETER_STREAM_ROUTING,
                                 value, sizeof(value));
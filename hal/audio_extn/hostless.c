@@ -0,0 +1,292 @@
+/* hostless.c
+Copyright (c) 2012-2014, The Linux Foundation. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are
+met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above
+      copyright notice, this list of conditions and the following
+      disclaimer in the documentation and/or other materials provided
+      with the distribution.
+    * Neither the name of The Linux Foundation nor the names of its
+      contributors may be used to endorse or promote products derived
+      from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED "AS IS" AND ANY EXPRESS OR IMPLIED
+WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT
+ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS
+BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.*/
+
+#define LOG_TAG "audio_hw_hostless"
+/*#define LOG_NDEBUG 0*/
+#define LOG_NDDEBUG 0
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <cutils/log.h>
+
+#include "audio_hw.h"
+#include "audio_extn.h"
+
+static const char * const hostless_status_name[] = {
+    [HOSTLESS_STATUS_STOPPED] = "stopped",
+    [HOSTLESS_STATUS_STARTING] = "starting",
+    [HOSTLESS_STATUS_RUNNING] = "running",
+    [HOSTLESS_STATUS_ERROR] = "error",
+};
+
+struct leg_context {
+    struct hostless_session *session;
+    struct hostless_leg *leg;
+};
+
+static void hostless_set_status(struct hostless_session *session,
+                                enum hostless_status status)
+{
+    pthread_mutex_lock(&session->lock);
+    session->status = status;
+    pthread_cond_broadcast(&session->cond);
+    pthread_mutex_unlock(&session->lock);
+}
+
+static void *hostless_leg_open(void *context)
+{
+    struct hostless_session *session = ((struct leg_context *)context)->session;
+    struct hostless_leg *leg = ((struct leg_context *)context)->leg;
+    int64_t begin_us = audio_extn_utils_get_time_us();
+
+    ALOGV("%s: %s: opening %s card_id(%d) device_id(%d)", __func__, session->name,
+          leg->name, session->adev->snd_card, leg->device_id);
+    ROUTING_STATS_INC(session->adev, pcm_opens);
+    leg->pcm = pcm_open(session->adev->snd_card, leg->device_id,
+                        leg->flags, session->config);
+    if (leg->pcm && !pcm_is_ready(leg->pcm)) {
+        ALOGE("%s: %s %s: %s", __func__, session->name, leg->name,
+              pcm_get_error(leg->pcm));
+        pcm_close(leg->pcm);
+        leg->pcm = NULL;
+    }
+    leg->open_us = audio_extn_utils_get_time_us() - begin_us;
+    return NULL;
+}
+
+static void *hostless_leg_close(void *context)
+{
+    struct hostless_leg *leg = ((struct leg_context *)context)->leg;
+    int64_t begin_us = audio_extn_utils_get_time_us();
+
+    if (leg->pcm) {
+        pcm_close(leg->pcm);
+        leg->pcm = NULL;
+    }
+    leg->close_us = audio_extn_utils_get_time_us() - begin_us;
+    return NULL;
+}
+
+/* Runs op on every leg concurrently and waits for all of them */
+static void hostless_run_legs(struct hostless_session *session, void *(*op)(void *))
+{
+    struct leg_context context[HOSTLESS_MAX_LEGS];
+    bool spawned[HOSTLESS_MAX_LEGS] = {false};
+    int i;
+
+    for (i = 0; i < session->num_legs; i++) {
+        context[i].session = session;
+        context[i].leg = &session->legs[i];
+        if (pthread_create(&session->legs[i].thread, (const pthread_attr_t *) NULL,
+                           op, &context[i]) == 0)
+            spawned[i] = true;
+        else
+            op(&context[i]);
+    }
+    for (i = 0; i < session->num_legs; i++) {
+        if (spawned[i])
+            pthread_join(session->legs[i].thread, (void **) NULL);
+    }
+}
+
+static void hostless_log_leg_timing(struct hostless_session *session)
+{
+    int i;
+
+    for (i = 0; i < session->num_legs; i++)
+        ALOGD("%s: %s %s open %lld us start %lld us close %lld us", __func__,
+              session->name, session->legs[i].name,
+              (long long)session->legs[i].open_us,
+              (long long)session->legs[i].start_us,
+              (long long)session->legs[i].close_us);
+}
+
+/*
+ * Brings up the pcms of the session. All legs are prepared in parallel,
+ * then started back to back in array order so the paths come up together.
+ * On failure the legs are closed again and -EIO is returned.
+ */
+static int hostless_bring_up(struct hostless_session *session)
+{
+    struct hostless_leg *leg;
+    int64_t begin_us = audio_extn_utils_get_time_us();
+    int i;
+
+    hostless_run_legs(session, hostless_leg_open);
+    for (i = 0; i < session->num_legs; i++) {
+        if (!session->legs[i].pcm)
+            goto error;
+    }
+
+    for (i = 0; i < session->num_legs; i++) {
+        leg = &session->legs[i];
+        leg->start_us = audio_extn_utils_get_time_us();
+        if (pcm_start(leg->pcm) < 0) {
+            ALOGE("%s: pcm start for %s %s failed", __func__, session->name, leg->name);
+            goto error;
+        }
+        leg->start_us = audio_extn_utils_get_time_us() - leg->start_us;
+    }
+
+    if (session->on_running)
+        session->on_running(session);
+    hostless_set_status(session, HOSTLESS_STATUS_RUNNING);
+    ALOGD("%s: %s pcms running after %lld us", __func__, session->name,
+          (long long)(audio_extn_utils_get_time_us() - begin_us));
+    hostless_log_leg_timing(session);
+    return 0;
+
+error:
+    hostless_run_legs(session, hostless_leg_close);
+    ALOGE("%s: Problem in %s start", __func__, session->name);
+    return -EIO;
+}
+
+static void *hostless_start_thread_loop(void *context)
+{
+    struct hostless_session *session = (struct hostless_session *)context;
+    uint32_t generation;
+    bool run_on_error;
+
+    if (hostless_bring_up(session) == 0)
+        return NULL;
+
+    pthread_mutex_lock(&session->lock);
+    session->status = HOSTLESS_STATUS_ERROR;
+    session->error_pending = (session->on_error != NULL);
+    generation = session->generation;
+    pthread_cond_broadcast(&session->cond);
+    pthread_mutex_unlock(&session->lock);
+    if (session->on_error == NULL)
+        return NULL;
+
+    /*
+     * Take the route down now rather than leave it to the next request. Nobody
+     * joins this thread, so it can block on adev->lock; an owner that stopped
+     * or restarted the session meanwhile has already dealt with the route.
+     */
+    pthread_mutex_lock(&session->adev->lock);
+    pthread_mutex_lock(&session->lock);
+    run_on_error = session->error_pending && session->generation == generation;
+    if (run_on_error)
+        session->error_pending = false;
+    pthread_mutex_unlock(&session->lock);
+    if (run_on_error)
+        session->on_error(session);
+    pthread_mutex_unlock(&session->adev->lock);
+    return NULL;
+}
+
+/* adev->lock held */
+int audio_extn_hostless_start(struct hostless_session *session,
+                              struct audio_device *adev)
+{
+    int i;
+
+    pthread_mutex_lock(&session->lock);
+    if (session->status == HOSTLESS_STATUS_STARTING ||
+        session->status == HOSTLESS_STATUS_RUNNING) {
+        pthread_mutex_unlock(&session->lock);
+        ALOGW("%s: %s session already started", __func__, session->name);
+        return -EBUSY;
+    }
+    /* the owner has routed the usecase again, a stale teardown must not run */
+    session->generation++;
+    session->error_pending = false;
+    session->status = HOSTLESS_STATUS_STARTING;
+    pthread_mutex_unlock(&session->lock);
+
+    session->adev = adev;
+    for (i = 0; i < session->num_legs; i++) {
+        session->legs[i].open_us = 0;
+        session->legs[i].start_us = 0;
+        session->legs[i].close_us = 0;
+    }
+
+    /* the pcms come up in the background, progress is reported by the status */
+    if (pthread_create(&session->start_thread, (const pthread_attr_t *) NULL,
+                       hostless_start_thread_loop, session) == 0) {
+        pthread_detach(session->start_thread);
+        return 0;
+    }
+
+    /* adev->lock is held here, the owner takes the route down on error */
+    ALOGW("%s: starting %s pcms synchronously", __func__, session->name);
+    if (hostless_bring_up(session) < 0) {
+        hostless_set_status(session, HOSTLESS_STATUS_ERROR);
+        return -EIO;
+    }
+    return 0;
+}
+
+/* adev->lock held, the owner takes the route down */
+void audio_extn_hostless_stop(struct hostless_session *session)
+{
+    /* let a pending bring-up finish before tearing the legs down */
+    pthread_mutex_lock(&session->lock);
+    while (session->status == HOSTLESS_STATUS_STARTING)
+        pthread_cond_wait(&session->cond, &session->lock);
+    session->generation++;
+    session->error_pending = false;
+    pthread_mutex_unlock(&session->lock);
+
+    hostless_run_legs(session, hostless_leg_close);
+    hostless_log_leg_timing(session);
+    hostless_set_status(session, HOSTLESS_STATUS_STOPPED);
+}
+
+enum hostless_status audio_extn_hostless_get_status(struct hostless_session *session)
+{
+    enum hostless_status status;
+
+    pthread_mutex_lock(&session->lock);
+    status = session->status;
+    pthread_mutex_unlock(&session->lock);
+    return status;
+}
+
+const char *audio_extn_hostless_status_name(enum hostless_status status)
+{
+    return hostless_status_name[status];
+}
+
+int audio_extn_hostless_get_leg_timing(struct hostless_session *session,
+                                       char *buf, size_t len)
+{
+    int i, written = 0;
+
+    buf[0] = '\0';
+    for (i = 0; i < session->num_legs && written < (int)len; i++)
+        written += snprintf(buf + written, len - written, "%s%s:%lld/%lld/%lld",
+                            i ? "," : "", session->legs[i].name,
+                            (long long)session->legs[i].open_us,
+                            (long long)session->legs[i].start_us,
+                            (long long)session->legs[i].close_us);
+    return written;
+}
@@ -33,6 +33,7 @@
 #include <stdbool.h>
 #include <stdlib.h>
 #include <dlfcn.h>
+#include <time.h>
 #include <cutils/log.h>
 #include "audio_hw.h"
 #include "audio_extn.h"
@@ -43,37 +44,144 @@
 #define XSTR(x) STR(x)
 #define STR(x) #x
 
+#define ST_MAX_SESSIONS 8
+/* upper bound of one LAB burst read */
+#define ST_LAB_BURST_MAX_BYTES (64 * 1024)
+
+/*
+ * Look-ahead buffer backlog drained right after detection. The first read
+ * is passed through so the client gets its first period without waiting
+ * for a burst. From then on, while audio is queued in the driver it is
+ * read in chunks as large as possible and served to the client from
+ * memory, so the client catches up with real time in a few syscalls.
+ */
+struct sound_trigger_lab_burst {
+    uint8_t *buf;
+    size_t size;
+    size_t offset;
+    size_t filled;
+    bool done;
+    uint32_t reads;
+    size_t bytes;
+};
+
 struct sound_trigger_info  {
     struct sound_trigger_session_info st_ses;
     bool lab_stopped;
-    struct listnode list;
+    int64_t open_us;
+    bool first_read_done;
+    struct sound_trigger_lab_burst burst;
+    int refs;                   /* readers using the session, under ref_lock */
 };
 
+/*
+ * Sessions are published in a small table indexed by capture handle.
+ * Readers (stream open, LAB reads, stop_lab) never take st_dev->lock: they
+ * take a reference on the session under ref_lock, which is only held for
+ * the lookup. Register/deregister serialize on st_dev->lock; deregister
+ * unpublishes the session and waits for its own references to drop, so
+ * capture on another session never holds it up.
+ */
 struct sound_trigger_audio_device {
     void *lib_handle;
     struct audio_device *adev;
     sound_trigger_hw_call_back_t st_callback;
-    struct listnode st_ses_list;
+    struct sound_trigger_info *sessions[ST_MAX_SESSIONS];
+    pthread_mutex_t ref_lock;
+    pthread_cond_t ref_cond;    /* a session lost its last reference */
     pthread_mutex_t lock;
 };
 
 static struct sound_trigger_audio_device *st_dev;
 
+static inline int st_session_slot(int capture_handle, int probe)
+{
+    return (unsigned int)(capture_handle + probe) % ST_MAX_SESSIONS;
+}
+
+/* Call with ref_lock or st_dev->lock held, the table changes under both */
 static struct sound_trigger_info *
 get_sound_trigger_info(int capture_handle)
 {
-    struct sound_trigger_info  *st_ses_info = NULL;
-    struct listnode *node;
-    ALOGD("%s: list %d capture_handle %d", __func__,
-           list_empty(&st_dev->st_ses_list), capture_handle);
-    list_for_each(node, &st_dev->st_ses_list) {
-        st_ses_info = node_to_item(node, struct sound_trigger_info , list);
-        if (st_ses_info->st_ses.capture_handle == capture_handle)
+    struct sound_trigger_info  *st_ses_info;
+    int i;
+
+    for (i = 0; i < ST_MAX_SESSIONS; i++) {
+        st_ses_info = st_dev->sessions[st_session_slot(capture_handle, i)];
+        if (st_ses_info && st_ses_info->st_ses.capture_handle == capture_handle)
             return st_ses_info;
     }
+    ALOGV("%s: capture_handle %d not registered", __func__, capture_handle);
     return NULL;
 }
 
+/* Looks the session up and keeps it alive until st_session_put() */
+static struct sound_trigger_info *st_session_get(int capture_handle)
+{
+    struct sound_trigger_info  *st_ses_info;
+
+    pthread_mutex_lock(&st_dev->ref_lock);
+    st_ses_info = get_sound_trigger_info(capture_handle);
+    if (st_ses_info)
+        st_ses_info->refs++;
+    pthread_mutex_unlock(&st_dev->ref_lock);
+    return st_ses_info;
+}
+
+static void st_session_put(struct sound_trigger_info *st_ses_info)
+{
+    pthread_mutex_lock(&st_dev->ref_lock);
+    if (--st_ses_info->refs == 0)
+        pthread_cond_broadcast(&st_dev->ref_cond);
+    pthread_mutex_unlock(&st_dev->ref_lock);
+}
+
+/* st_dev->lock held */
+static int add_sound_trigger_info(struct sound_trigger_info *st_ses_info)
+{
+    int i, slot, ret = -ENOSPC;
+
+    pthread_mutex_lock(&st_dev->ref_lock);
+    for (i = 0; i < ST_MAX_SESSIONS; i++) {
+        slot = st_session_slot(st_ses_info->st_ses.capture_handle, i);
+        if (st_dev->sessions[slot] == NULL) {
+            st_dev->sessions[slot] = st_ses_info;
+            ret = 0;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&st_dev->ref_lock);
+    return ret;
+}
+
+/* st_dev->lock held, returns once no reader uses the session any more */
+static void remove_sound_trigger_info(struct sound_trigger_info *st_ses_info)
+{
+    int i, slot;
+
+    pthread_mutex_lock(&st_dev->ref_lock);
+    for (i = 0; i < ST_MAX_SESSIONS; i++) {
+        slot = st_session_slot(st_ses_info->st_ses.capture_handle, i);
+        if (st_dev->sessions[slot] == st_ses_info) {
+            st_dev->sessions[slot] = NULL;
+            break;
+        }
+    }
+    /* no new reference can be taken now, wait for the reads in flight */
+    while (st_ses_info->refs != 0)
+        pthread_cond_wait(&st_dev->ref_cond, &st_dev->ref_lock);
+    pthread_mutex_unlock(&st_dev->ref_lock);
+}
+
+static void release_lab_burst(struct sound_trigger_lab_burst *burst)
+{
+    free(burst->buf);
+    burst->buf = NULL;
+    burst->size = 0;
+    burst->offset = 0;
+    burst->filled = 0;
+}
+
 int audio_hw_call_back(sound_trigger_event_type_t event,
                        sound_trigger_event_info_t* config)
 {
@@ -100,7 +208,12 @@ int audio_hw_call_back(sound_trigger_event_type_t event,
         memcpy(&st_ses_info->st_ses, &config->st_ses, sizeof (config->st_ses));
         ALOGV("%s: add capture_handle %d pcm %p", __func__,
               st_ses_info->st_ses.capture_handle, st_ses_info->st_ses.pcm);
-        list_add_tail(&st_dev->st_ses_list, &st_ses_info->list);
+        status = add_sound_trigger_info(st_ses_info);
+        if (status) {
+            ALOGE("%s: no free session slot for capture_handle %d", __func__,
+                  st_ses_info->st_ses.capture_handle);
+            free(st_ses_info);
+        }
         break;
 
     case ST_EVENT_SESSION_DEREGISTER:
@@ -117,7 +230,8 @@ int audio_hw_call_back(sound_trigger_event_type_t event,
         }
         ALOGV("%s: remove capture_handle %d pcm %p", __func__,
               st_ses_info->st_ses.capture_handle, st_ses_info->st_ses.pcm);
-        list_remove(&st_ses_info->list);
+        remove_sound_trigger_info(st_ses_info);
+        release_lab_burst(&st_ses_info->burst);
         free(st_ses_info);
         break;
     default:
@@ -133,44 +247,130 @@ void audio_extn_sound_trigger_stop_lab(struct stream_in *in)
     int status = 0;
     struct sound_trigger_info  *st_ses_info = NULL;
     audio_event_info_t event;
+    bool found = false;
 
     if (!st_dev || !in)
        return;
 
-    pthread_mutex_lock(&st_dev->lock);
-    st_ses_info = get_sound_trigger_info(in->capture_handle);
-    pthread_mutex_unlock(&st_dev->lock);
+    st_ses_info = st_session_get(in->capture_handle);
     if (st_ses_info) {
         event.u.ses_info = st_ses_info->st_ses;
-        ALOGV("%s: AUDIO_EVENT_STOP_LAB pcm %p", __func__, st_ses_info->st_ses.pcm);
+        /* in->lock held, no LAB read can be using the burst buffer */
+        release_lab_burst(&st_ses_info->burst);
+        found = true;
+        st_session_put(st_ses_info);
+    }
+    if (found) {
+        ALOGV("%s: AUDIO_EVENT_STOP_LAB pcm %p", __func__, event.u.ses_info.pcm);
         st_dev->st_callback(AUDIO_EVENT_STOP_LAB, &event);
     }
 }
+
 void audio_extn_sound_trigger_check_and_get_session(struct stream_in *in)
 {
     struct sound_trigger_info  *st_ses_info = NULL;
-    struct listnode *node;
 
     if (!st_dev || !in)
        return;
 
-    pthread_mutex_lock(&st_dev->lock);
     in->is_st_session = false;
-    ALOGV("%s: list %d capture_handle %d", __func__,
-          list_empty(&st_dev->st_ses_list), in->capture_handle);
-    list_for_each(node, &st_dev->st_ses_list) {
-        st_ses_info = node_to_item(node, struct sound_trigger_info , list);
-        if (st_ses_info->st_ses.capture_handle == in->capture_handle) {
-            in->pcm = st_ses_info->st_ses.pcm;
-            in->config = st_ses_info->st_ses.config;
-            in->channel_mask = audio_channel_in_mask_from_count(in->config.channels);
-            in->is_st_session = true;
-            in->is_st_session_active = true;
-            ALOGD("%s: capture_handle %d is sound trigger", __func__, in->capture_handle);
-            break;
+    st_ses_info = st_session_get(in->capture_handle);
+    if (st_ses_info) {
+        in->pcm = st_ses_info->st_ses.pcm;
+        in->config = st_ses_info->st_ses.config;
+        in->channel_mask = audio_channel_in_mask_from_count(in->config.channels);
+        in->is_st_session = true;
+        in->is_st_session_active = true;
+        st_ses_info->open_us = audio_extn_utils_get_time_us();
+        st_ses_info->first_read_done = false;
+        release_lab_burst(&st_ses_info->burst);
+        memset(&st_ses_info->burst, 0, sizeof(st_ses_info->burst));
+        ALOGD("%s: capture_handle %d is sound trigger", __func__, in->capture_handle);
+        st_session_put(st_ses_info);
+    }
+}
+
+/* Returns true while LAB backlog is served from the burst buffer */
+static bool read_lab_burst(struct stream_in *in, struct sound_trigger_lab_burst *burst,
+                           void *buffer, size_t bytes, size_t *copied)
+{
+    unsigned int avail = 0;
+    struct timespec ts;
+    size_t chunk;
+
+    *copied = 0;
+    if (burst->offset == burst->filled) {
+        if (pcm_get_htimestamp(in->pcm, &avail, &ts) < 0 ||
+            pcm_frames_to_bytes(in->pcm, avail) <= bytes) {
+            /* caught up with the capture, plain reads from here on */
+            ALOGD("%s: LAB backlog drained in %u reads, %zu bytes", __func__,
+                  burst->reads, burst->bytes);
+            release_lab_burst(burst);
+            burst->done = true;
+            return false;
         }
+        if (!burst->buf) {
+            burst->size = pcm_frames_to_bytes(in->pcm,
+                    in->config.period_size * in->config.period_count);
+            if (burst->size > ST_LAB_BURST_MAX_BYTES || burst->size < bytes)
+                burst->size = ST_LAB_BURST_MAX_BYTES;
+            burst->buf = (uint8_t *)malloc(burst->size);
+            if (!burst->buf) {
+                burst->done = true;
+                return false;
+            }
+        }
+        chunk = pcm_frames_to_bytes(in->pcm, avail);
+        if (chunk > burst->size)
+            chunk = pcm_frames_to_bytes(in->pcm,
+                                        pcm_bytes_to_frames(in->pcm, burst->size));
+        if (pcm_read(in->pcm, burst->buf, chunk) < 0) {
+            release_lab_burst(burst);
+            burst->done = true;
+            return false;
+        }
+        burst->offset = 0;
+        burst->filled = chunk;
+        burst->reads++;
+        burst->bytes += chunk;
     }
-    pthread_mutex_unlock(&st_dev->lock);
+
+    *copied = burst->filled - burst->offset;
+    if (*copied > bytes)
+        *copied = bytes;
+    memcpy(buffer, burst->buf + burst->offset, *copied);
+    burst->offset += *copied;
+    return true;
+}
+
+int audio_extn_sound_trigger_read(struct stream_in *in, void *buffer, size_t bytes)
+{
+    struct sound_trigger_info  *st_ses_info;
+    size_t copied = 0;
+    int64_t open_us = 0;
+    int ret = 0;
+
+    if (!st_dev)
+        return pcm_read(in->pcm, buffer, bytes);
+
+    st_ses_info = st_session_get(in->capture_handle);
+    if (st_ses_info) {
+        /* the first period goes straight to the client, the backlog after it */
+        if (!st_ses_info->first_read_done) {
+            st_ses_info->first_read_done = true;
+            open_us = st_ses_info->open_us;
+        } else if (!st_ses_info->burst.done) {
+            read_lab_burst(in, &st_ses_info->burst, buffer, bytes, &copied);
+        }
+        st_session_put(st_ses_info);
+    }
+
+    if (copied < bytes)
+        ret = pcm_read(in->pcm, (uint8_t *)buffer + copied, bytes - copied);
+    if (open_us)
+        ALOGD("%s: first LAB samples delivered %lld us after stream open",
+              __func__, (long long)(audio_extn_utils_get_time_us() - open_us));
+    return ret;
 }
 
 void audio_extn_sound_trigger_update_device_status(snd_device_t snd_device,
@@ -310,6 +510,9 @@ int audio_extn_sound_trigger_init(struct audio_device *adev)
         ALOGE("%s: ERROR. sound trigger alloc failed", __func__);
         return -ENOMEM;
     }
+    pthread_mutex_init(&st_dev->lock, (const pthread_mutexattr_t *) NULL);
+    pthread_mutex_init(&st_dev->ref_lock, (const pthread_mutexattr_t *) NULL);
+    pthread_cond_init(&st_dev->ref_cond, (const pthread_condattr_t *) NULL);
 
     snprintf(sound_trigger_lib, sizeof(sound_trigger_lib),
              "/system/vendor/lib/hw/sound_trigger.primary.%s.so",
@@ -335,7 +538,6 @@ int audio_extn_sound_trigger_init(struct audio_device *adev)
     }
 
     st_dev->adev = adev;
-    list_init(&st_dev->st_ses_list);
 
     return 0;
 
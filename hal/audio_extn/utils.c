@@ -21,6 +21,9 @@
 /* #define LOG_NDEBUG 0 */
 
 #include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <time.h>
 #include <cutils/properties.h>
 #include <cutils/config_utils.h>
 #include <stdlib.h>
@@ -52,6 +55,31 @@
 #define BASE_TABLE_SIZE 64
 #define MAX_BASEINDEX_LEN 256
 
+#define MAX_APP_TYPE_CFG_PCM_DEVICES 64
+
+#define MIXER_POOL_MAX_CARDS 8
+#define APP_TYPE_CFG_LEN 3
+
+/* Process wide mixer handles, shared by the HAL and by the effect libraries through the ops
+ * passed to them at load time, so that a card's controls are enumerated only once. Each
+ * handle has an index of its control names built on the first lookup. */
+struct mixer_pool_entry {
+    int card;
+    struct mixer *mixer;
+    unsigned int refs;
+    uint32_t *ctl_index;  /* open addressing table of control number + 1, 0 if empty */
+    uint32_t ctl_index_mask;
+};
+
+static struct {
+    pthread_mutex_t lock;
+    struct mixer_pool_entry entries[MIXER_POOL_MAX_CARDS];
+    unsigned int opens;
+    unsigned int shared;
+} mixer_pool = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
 struct string_to_enum {
     const char *name;
     uint32_t value;
@@ -118,6 +146,35 @@ static char bTable[BASE_TABLE_SIZE] = {
             '8','9','+','/'
 };
 
+/* Reverse of bTable. '=' decodes as 0, anything else outside the alphabet as 0xFF */
+static const uint8_t bIndex[MAX_BASEINDEX_LEN] = {
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x3E, 0xFF, 0xFF, 0xFF, 0x3F,
+    0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3A, 0x3B, 0x3C, 0x3D, 0xFF, 0xFF, 0xFF, 0x00, 0xFF, 0xFF,
+    0xFF, 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0A, 0x0B, 0x0C, 0x0D, 0x0E,
+    0x0F, 0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0x1A, 0x1B, 0x1C, 0x1D, 0x1E, 0x1F, 0x20, 0x21, 0x22, 0x23, 0x24, 0x25, 0x26, 0x27, 0x28,
+    0x29, 0x2A, 0x2B, 0x2C, 0x2D, 0x2E, 0x2F, 0x30, 0x31, 0x32, 0x33, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+};
+
+/* App type config last programmed on each front end, by pcm device id */
+struct app_type_cfg_cache_entry {
+    bool valid;
+    int cfg[APP_TYPE_CFG_LEN];
+};
+
+static struct app_type_cfg_cache_entry app_type_cfg_cache[MAX_APP_TYPE_CFG_PCM_DEVICES];
+static uint32_t app_type_cfg_skipped;
+
 static uint32_t string_to_enum(const struct string_to_enum *table, size_t size,
                                const char *name)
 {
@@ -513,6 +570,7 @@ int audio_extn_utils_send_app_type_cfg(struct audio_usecase *usecase)
     struct stream_out *out;
     struct audio_device *adev;
     struct mixer_ctl *ctl;
+    struct app_type_cfg_cache_entry *entry = NULL;
     int pcm_device_id, acdb_dev_id, snd_device = usecase->out_snd_device;
     int32_t sample_rate = DEFAULT_OUTPUT_SAMPLING_RATE;
 
@@ -538,16 +596,6 @@ int audio_extn_utils_send_app_type_cfg(struct audio_usecase *usecase)
 
     pcm_device_id = platform_get_pcm_device_id(out->usecase, PCM_PLAYBACK);
 
-    snprintf(mixer_ctl_name, sizeof(mixer_ctl_name),
-             "Audio Stream %d App Type Cfg", pcm_device_id);
-
-    ctl = mixer_get_ctl_by_name(adev->mixer, mixer_ctl_name);
-    if (!ctl) {
-        ALOGE("%s: Could not get ctl for mixer cmd - %s", __func__,
-              mixer_ctl_name);
-        rc = -EINVAL;
-        goto exit_send_app_type_cfg;
-    }
     snd_device = (snd_device == SND_DEVICE_OUT_SPEAKER) ?
                  audio_extn_get_spkr_prot_snd_device(snd_device) : snd_device;
     acdb_dev_id = platform_get_snd_device_acdb_id(snd_device);
@@ -575,7 +623,33 @@ int audio_extn_utils_send_app_type_cfg(struct audio_usecase *usecase)
         app_type_cfg[len++] = sample_rate * 4;
     else
         app_type_cfg[len++] = sample_rate;
+
+    if (pcm_device_id >= 0 && pcm_device_id < MAX_APP_TYPE_CFG_PCM_DEVICES) {
+        entry = &app_type_cfg_cache[pcm_device_id];
+        if (entry->valid && !memcmp(entry->cfg, app_type_cfg, sizeof(entry->cfg))) {
+            app_type_cfg_skipped++;
+            ALOGV("%s: app type cfg on pcm device %d is live, skipped %u",
+                  __func__, pcm_device_id, app_type_cfg_skipped);
+            rc = 0;
+            goto exit_send_app_type_cfg;
+        }
+    }
+
+    snprintf(mixer_ctl_name, sizeof(mixer_ctl_name),
+             "Audio Stream %d App Type Cfg", pcm_device_id);
+
+    ctl = audio_extn_utils_mixer_get_ctl(adev->mixer, mixer_ctl_name);
+    if (!ctl) {
+        ALOGE("%s: Could not get ctl for mixer cmd - %s", __func__,
+              mixer_ctl_name);
+        rc = -EINVAL;
+        goto exit_send_app_type_cfg;
+    }
     mixer_ctl_set_array(ctl, app_type_cfg, len);
+    if (entry) {
+        memcpy(entry->cfg, app_type_cfg, sizeof(entry->cfg));
+        entry->valid = true;
+    }
     ALOGI("%s app_type %d, acdb_dev_id %d, sample_rate %d",
            __func__, out->app_type_cfg.app_type, acdb_dev_id, sample_rate);
     rc = 0;
@@ -583,6 +657,25 @@ exit_send_app_type_cfg:
     return rc;
 }
 
+/* The front end drops its app type config when the stream using it stops */
+void audio_extn_utils_reset_app_type_cfg(struct audio_usecase *usecase)
+{
+    int pcm_device_id;
+
+    if (usecase->type != PCM_PLAYBACK)
+        return;
+
+    pcm_device_id = platform_get_pcm_device_id(usecase->id, PCM_PLAYBACK);
+    if (pcm_device_id >= 0 && pcm_device_id < MAX_APP_TYPE_CFG_PCM_DEVICES)
+        app_type_cfg_cache[pcm_device_id].valid = false;
+}
+
+void audio_extn_utils_invalidate_cal_cache(struct audio_device *adev)
+{
+    memset(app_type_cfg_cache, 0, sizeof(app_type_cfg_cache));
+    platform_invalidate_calibration_cache(adev->platform);
+}
+
 void audio_extn_utils_send_audio_calibration(struct audio_device *adev,
                                              struct audio_usecase *usecase)
 {
@@ -613,6 +706,15 @@ void audio_extn_utils_send_audio_calibration(struct audio_device *adev,
     }
 }
 
+/* CLOCK_MONOTONIC time in microseconds, for interval measurements */
+int64_t audio_extn_utils_get_time_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
 // Base64 Encode and Decode
 // Not all features supported. This must be used only with following conditions.
 // Decode Modes: Support with and without padding
@@ -620,37 +722,30 @@ void audio_extn_utils_send_audio_calibration(struct audio_device *adev,
 // Encode Modes: Supports only padding
 int b64decode(char *inp, int ilen, uint8_t* outp)
 {
-    int i, j, k, ii, num;
+    const uint8_t *in = (const uint8_t *)inp;
+    int i, k, num;
     int rem, pcnt;
     uint32_t res=0;
-    uint8_t getIndex[MAX_BASEINDEX_LEN];
-    uint8_t tmp, cflag;
+    uint8_t a, b, c, d, cflag;
 
     if(inp == NULL || outp == NULL || ilen <= 0) {
         ALOGE("[%s] received NULL pointer or zero length",__func__);
         return -1;
     }
 
-    memset(getIndex, MAX_BASEINDEX_LEN-1, sizeof(getIndex));
-    for(i=0;i<BASE_TABLE_SIZE;i++) {
-        getIndex[(uint8_t)bTable[i]] = (uint8_t)i;
-    }
-    getIndex[(uint8_t)'=']=0;
-
-    j=0;k=0;
+    k=0;
     num = ilen/4;
     rem = ilen%4;
     if(rem==0)
         num = num-1;
     cflag=0;
-    for(i=0; i<num; i++) {
-        res=0;
-        for(ii=0;ii<4;ii++) {
-            res = res << 6;
-            tmp = getIndex[(uint8_t)inp[j++]];
-            res = res | tmp;
-            cflag = cflag | tmp;
-        }
+    for(i=0; i<num; i++, in += 4) {
+        a = bIndex[in[0]];
+        b = bIndex[in[1]];
+        c = bIndex[in[2]];
+        d = bIndex[in[3]];
+        cflag |= a | b | c | d;
+        res = (a << 18) | (b << 12) | (c << 6) | d;
         outp[k++] = (res >> 16)&0xFF;
         outp[k++] = (res >> 8)&0xFF;
         outp[k++] = res & 0xFF;
@@ -658,46 +753,32 @@ int b64decode(char *inp, int ilen, uint8_t* outp)
 
     // Handle last bytes special
     pcnt=0;
+    res = 0;
     if(rem == 0) {
         //With padding or full data
-        res = 0;
-        for(ii=0;ii<4;ii++) {
-            if(inp[j] == '=')
+        for(i=0;i<4;i++) {
+            if(in[i] == '=')
                 pcnt++;
-            res = res << 6;
-            tmp = getIndex[(uint8_t)inp[j++]];
-            res = res | tmp;
-            cflag = cflag | tmp;
+            res = (res << 6) | bIndex[in[i]];
+            cflag |= bIndex[in[i]];
         }
-        outp[k++] = res >> 16;
-        if(pcnt == 2)
-            goto done;
-        outp[k++] = (res>>8)&0xFF;
-        if(pcnt == 1)
-            goto done;
-        outp[k++] = res&0xFF;
     } else {
         //without padding
-        res = 0;
         for(i=0;i<rem;i++) {
-            res = res << 6;
-            tmp = getIndex[(uint8_t)inp[j++]];
-            res = res | tmp;
-            cflag = cflag | tmp;
+            res = (res << 6) | bIndex[in[i]];
+            cflag |= bIndex[in[i]];
         }
         for(i=rem;i<4;i++) {
             res = res << 6;
             pcnt++;
         }
-        outp[k++] = res >> 16;
-        if(pcnt == 2)
-            goto done;
+    }
+    outp[k++] = (res >> 16)&0xFF;
+    if(pcnt < 2)
         outp[k++] = (res>>8)&0xFF;
-        if(pcnt == 1)
-            goto done;
+    if(pcnt < 1)
         outp[k++] = res&0xFF;
-    }
-done:
+
     if(cflag == 0xFF) {
         ALOGE("[%s] base64 decode failed. Invalid character found %s",
             __func__, inp);
@@ -755,3 +836,159 @@ done:
     outp[k] = '\0';
     return k;
 }
+
+static uint32_t mixer_ctl_name_hash(const char *name)
+{
+    uint32_t hash = 2166136261u;
+
+    while (*name) {
+        hash ^= (uint8_t)*name++;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static struct mixer_pool_entry *mixer_pool_find(struct mixer *mixer)
+{
+    int i;
+
+    for (i = 0; i < MIXER_POOL_MAX_CARDS; i++) {
+        if (mixer_pool.entries[i].mixer == mixer)
+            return &mixer_pool.entries[i];
+    }
+    return NULL;
+}
+
+/* Called with mixer_pool.lock held */
+static int mixer_pool_build_index(struct mixer_pool_entry *entry)
+{
+    unsigned int num_ctls = mixer_get_num_ctls(entry->mixer);
+    uint32_t size = 1;
+    unsigned int i;
+
+    while (size < 2 * num_ctls)
+        size <<= 1;
+    entry->ctl_index = calloc(size, sizeof(uint32_t));
+    if (!entry->ctl_index)
+        return -ENOMEM;
+    entry->ctl_index_mask = size - 1;
+
+    for (i = 0; i < num_ctls; i++) {
+        const char *name = mixer_ctl_get_name(mixer_get_ctl(entry->mixer, i));
+        uint32_t slot;
+
+        if (!name)
+            continue;
+        /* keep the first control of a given name, like mixer_get_ctl_by_name() */
+        for (slot = mixer_ctl_name_hash(name) & entry->ctl_index_mask;
+             entry->ctl_index[slot] != 0;
+             slot = (slot + 1) & entry->ctl_index_mask) {
+            struct mixer_ctl *ctl = mixer_get_ctl(entry->mixer, entry->ctl_index[slot] - 1);
+            if (!strcmp(mixer_ctl_get_name(ctl), name))
+                break;
+        }
+        if (entry->ctl_index[slot] == 0)
+            entry->ctl_index[slot] = i + 1;
+    }
+    ALOGV("%s: indexed %u controls of card %d", __func__, num_ctls, entry->card);
+    return 0;
+}
+
+struct mixer *audio_extn_utils_mixer_acquire(int card)
+{
+    struct mixer_pool_entry *entry = NULL;
+    struct mixer *mixer = NULL;
+    int i;
+
+    pthread_mutex_lock(&mixer_pool.lock);
+    for (i = 0; i < MIXER_POOL_MAX_CARDS; i++) {
+        if (mixer_pool.entries[i].mixer && mixer_pool.entries[i].card == card) {
+            entry = &mixer_pool.entries[i];
+            entry->refs++;
+            mixer_pool.shared++;
+            mixer = entry->mixer;
+            goto exit;
+        }
+    }
+    for (i = 0; i < MIXER_POOL_MAX_CARDS; i++) {
+        if (!mixer_pool.entries[i].mixer) {
+            entry = &mixer_pool.entries[i];
+            break;
+        }
+    }
+    mixer = mixer_open(card);
+    if (!mixer || !entry) {
+        /* still usable, just not shared */
+        ALOGW_IF(mixer, "%s: mixer pool full, card %d not shared", __func__, card);
+        goto exit;
+    }
+    mixer_pool.opens++;
+    entry->card = card;
+    entry->mixer = mixer;
+    entry->refs = 1;
+    entry->ctl_index = NULL;
+exit:
+    pthread_mutex_unlock(&mixer_pool.lock);
+    return mixer;
+}
+
+void audio_extn_utils_mixer_release(struct mixer *mixer)
+{
+    struct mixer_pool_entry *entry;
+
+    if (!mixer)
+        return;
+    pthread_mutex_lock(&mixer_pool.lock);
+    entry = mixer_pool_find(mixer);
+    if (!entry) {
+        mixer_close(mixer);
+    } else if (--entry->refs == 0) {
+        mixer_close(entry->mixer);
+        free(entry->ctl_index);
+        memset(entry, 0, sizeof(*entry));
+    }
+    pthread_mutex_unlock(&mixer_pool.lock);
+}
+
+struct mixer_ctl *audio_extn_utils_mixer_get_ctl(struct mixer *mixer, const char *name)
+{
+    struct mixer_pool_entry *entry;
+    struct mixer_ctl *ctl = NULL;
+    uint32_t slot;
+
+    if (!mixer || !name)
+        return NULL;
+    pthread_mutex_lock(&mixer_pool.lock);
+    entry = mixer_pool_find(mixer);
+    if (!entry || (!entry->ctl_index && mixer_pool_build_index(entry) != 0)) {
+        pthread_mutex_unlock(&mixer_pool.lock);
+        return mixer_get_ctl_by_name(mixer, name);
+    }
+    for (slot = mixer_ctl_name_hash(name) & entry->ctl_index_mask;
+         entry->ctl_index[slot] != 0;
+         slot = (slot + 1) & entry->ctl_index_mask) {
+        struct mixer_ctl *candidate = mixer_get_ctl(mixer, entry->ctl_index[slot] - 1);
+        if (!strcmp(mixer_ctl_get_name(candidate), name)) {
+            ctl = candidate;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&mixer_pool.lock);
+    return ctl;
+}
+
+void audio_extn_utils_mixer_pool_dump(int fd)
+{
+    int i;
+
+    pthread_mutex_lock(&mixer_pool.lock);
+    dprintf(fd, "  Mixer pool: %u opens, %u shared acquisitions\n",
+            mixer_pool.opens, mixer_pool.shared);
+    for (i = 0; i < MIXER_POOL_MAX_CARDS; i++) {
+        if (mixer_pool.entries[i].mixer)
+            dprintf(fd, "    card %d: %u refs, %s\n", mixer_pool.entries[i].card,
+                    mixer_pool.entries[i].refs,
+                    mixer_pool.entries[i].ctl_index ? "indexed" : "not indexed");
+    }
+    pthread_mutex_unlock(&mixer_pool.lock);
+}
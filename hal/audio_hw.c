@@ -47,6 +47,7 @@
 #include <errno.h>
 #include <pthread.h>
 #include <stdint.h>
+#include <stdio.h>
 #include <sys/time.h>
 #include <stdlib.h>
 #include <math.h>
@@ -429,6 +430,7 @@ int enable_audio_route(struct audio_device *adev,
     platform_add_backend_name(mixer_path, snd_device);
     ALOGD("%s: apply mixer and update path: %s", __func__, mixer_path);
     audio_route_apply_and_update_path(adev->audio_route, mixer_path);
+    ROUTING_STATS_INC(adev, path_applies);
     ALOGV("%s: exit", __func__);
     return 0;
 }
@@ -451,6 +453,7 @@ int disable_audio_route(struct audio_device *adev,
     platform_add_backend_name(mixer_path, snd_device);
     ALOGD("%s: reset and update mixer path: %s", __func__, mixer_path);
     audio_route_reset_and_update_path(adev->audio_route, mixer_path);
+    ROUTING_STATS_INC(adev, path_resets);
     audio_extn_sound_trigger_update_stream_status(usecase, ST_EVENT_STREAM_FREE);
     audio_extn_listen_update_stream_status(usecase, LISTEN_EVENT_STREAM_FREE);
     ALOGV("%s: exit", __func__);
@@ -522,6 +525,7 @@ int enable_snd_device(struct audio_device *adev,
         }
         audio_extn_dev_arbi_acquire(snd_device);
         audio_route_apply_and_update_path(adev->audio_route, device_name);
+        ROUTING_STATS_INC(adev, path_applies);
     }
     return 0;
 }
@@ -565,6 +569,7 @@ int disable_snd_device(struct audio_device *adev,
             audio_extn_spkr_prot_stop_processing(snd_device);
         } else {
             audio_route_reset_and_update_path(adev->audio_route, device_name);
+            ROUTING_STATS_INC(adev, path_resets);
         }
 
         audio_extn_dev_arbi_release(snd_device);
@@ -795,7 +800,7 @@ struct audio_usecase *get_usecase_from_list(struct audio_device *adev,
     return NULL;
 }
 
-int select_devices(struct audio_device *adev, audio_usecase_t uc_id)
+static int do_select_devices(struct audio_device *adev, audio_usecase_t uc_id)
 {
     snd_device_t out_snd_device = SND_DEVICE_NONE;
     snd_device_t in_snd_device = SND_DEVICE_NONE;
@@ -987,6 +992,22 @@ int select_devices(struct audio_device *adev, audio_usecase_t uc_id)
     return status;
 }
 
+int select_devices(struct audio_device *adev, audio_usecase_t uc_id)
+{
+    struct routing_stats *stats = &adev->routing_stats;
+    uint64_t start, elapsed;
+    int ret;
+
+    start = audio_extn_utils_get_time_us();
+    ret = do_select_devices(adev, uc_id);
+    elapsed = audio_extn_utils_get_time_us() - start;
+    stats->transitions++;
+    stats->total_transition_us += elapsed;
+    if (elapsed > stats->max_transition_us)
+        stats->max_transition_us = elapsed;
+    return ret;
+}
+
 static int stop_input_stream(struct stream_in *in)
 {
     int i, ret = 0;
@@ -1024,6 +1045,10 @@ static int stop_input_stream(struct stream_in *in)
     return ret;
 }
 
+/*
+ * Called and returns with adev->lock held. The lock is dropped around the pcm
+ * open and prepare, which only touch this stream under its own lock.
+ */
 int start_input_stream(struct stream_in *in)
 {
     /* 1. Enable output device and stream routing controls */
@@ -1096,7 +1121,10 @@ int start_input_stream(struct stream_in *in)
         pcm_open_retry_count = PROXY_OPEN_RETRY_COUNT;
     }
 
+    /* the pcm is only used under in->lock, other streams need not wait for it */
+    pthread_mutex_unlock(&adev->lock);
     while (1) {
+        ROUTING_STATS_INC(adev, pcm_opens);
         in->pcm = pcm_open(adev->snd_card, in->pcm_device_id,
                            flags, &in->config);
         if (in->pcm == NULL || !pcm_is_ready(in->pcm)) {
@@ -1107,6 +1135,7 @@ int start_input_stream(struct stream_in *in)
             }
             if (pcm_open_retry_count-- == 0) {
                 ret = -EIO;
+                lock_adev(adev, ADEV_LOCK_IN_START);
                 goto error_open;
             }
             usleep(PROXY_OPEN_WAIT_TIME * 1000);
@@ -1117,6 +1146,7 @@ int start_input_stream(struct stream_in *in)
 
     ALOGV("%s: pcm_prepare", __func__);
     ret = pcm_prepare(in->pcm);
+    lock_adev(adev, ADEV_LOCK_IN_START);
     if (ret < 0) {
         ALOGE("%s: pcm_prepare returned %d", __func__, ret);
         pcm_close(in->pcm);
@@ -1155,6 +1185,29 @@ void lock_output_stream(struct stream_out *out)
     pthread_mutex_unlock(&out->pre_lock);
 }
 
+/*
+ * Takes adev->lock and accounts the wait to the given site. The clock is
+ * only read when the lock is contended.
+ */
+static void lock_adev(struct audio_device *adev, int site)
+{
+    struct lock_site_stats *stats = &adev->lock_stats[site];
+    uint64_t start, wait;
+
+    if (pthread_mutex_trylock(&adev->lock) == 0) {
+        stats->count++;
+        return;
+    }
+    start = audio_extn_utils_get_time_us();
+    pthread_mutex_lock(&adev->lock);
+    wait = audio_extn_utils_get_time_us() - start;
+    stats->count++;
+    stats->contended++;
+    stats->total_wait_us += wait;
+    if (wait > stats->max_wait_us)
+        stats->max_wait_us = wait;
+}
+
 /* must be called with out->lock locked */
 static int send_offload_cmd_l(struct stream_out* out, int command)
 {
@@ -1482,6 +1535,7 @@ static int stop_output_stream(struct stream_out *out)
 
     /* 1. Get and set stream specific mixer controls */
     disable_audio_route(adev, uc_info);
+    audio_extn_utils_reset_app_type_cfg(uc_info);
 
     /* 2. Disable the rx device */
     disable_snd_device(adev, uc_info->out_snd_device);
@@ -1506,6 +1560,10 @@ static int stop_output_stream(struct stream_out *out)
     return ret;
 }
 
+/*
+ * Called and returns with adev->lock held. The lock is dropped around the pcm
+ * open and prepare, which only touch this stream under its own lock.
+ */
 int start_output_stream(struct stream_out *out)
 {
     int ret = 0;
@@ -1591,7 +1649,10 @@ int start_output_stream(struct stream_out *out)
         } else
             flags |= PCM_MONOTONIC;
 
+        /* the pcm is only used under out->lock, other streams need not wait for it */
+        pthread_mutex_unlock(&adev->lock);
         while (1) {
+            ROUTING_STATS_INC(adev, pcm_opens);
             out->pcm = pcm_open(adev->snd_card, out->pcm_device_id,
                                flags, &out->config);
             if (out->pcm == NULL || !pcm_is_ready(out->pcm)) {
@@ -1602,6 +1663,7 @@ int start_output_stream(struct stream_out *out)
                 }
                 if (pcm_open_retry_count-- == 0) {
                     ret = -EIO;
+                    lock_adev(adev, ADEV_LOCK_OUT_START);
                     goto error_open;
                 }
                 usleep(PROXY_OPEN_WAIT_TIME * 1000);
@@ -1610,23 +1672,26 @@ int start_output_stream(struct stream_out *out)
             break;
         }
 
+        /* pcm_open resets the channel map, it is applied by pcm_prepare */
+        lock_adev(adev, ADEV_LOCK_OUT_START);
         platform_set_stream_channel_map(adev->platform, out->channel_mask,
                                     out->pcm_device_id);
+        pthread_mutex_unlock(&adev->lock);
 
         ALOGV("%s: pcm_prepare", __func__);
-        if (pcm_is_ready(out->pcm)) {
-            ret = pcm_prepare(out->pcm);
-            if (ret < 0) {
-                ALOGE("%s: pcm_prepare returned %d", __func__, ret);
-                pcm_close(out->pcm);
-                out->pcm = NULL;
-                goto error_open;
-            }
+        ret = pcm_prepare(out->pcm);
+        lock_adev(adev, ADEV_LOCK_OUT_START);
+        if (ret < 0) {
+            ALOGE("%s: pcm_prepare returned %d", __func__, ret);
+            pcm_close(out->pcm);
+            out->pcm = NULL;
+            goto error_open;
         }
     } else {
         platform_set_stream_channel_map(adev->platform, out->channel_mask,
                                     out->pcm_device_id);
         out->pcm = NULL;
+        ROUTING_STATS_INC(adev, compress_opens);
         out->compr = compress_open(adev->snd_card,
                                    out->pcm_device_id,
                                    COMPRESS_IN, &out->compr_config);
@@ -1655,6 +1720,7 @@ int start_output_stream(struct stream_out *out)
         audio_extn_dts_notify_playback_state(out->usecase, 0, out->sample_rate,
                                              popcount(out->channel_mask),
                                              out->playback_started);
+        audio_extn_dts_eagle_send_cached_params(adev, out);
 
 #ifdef DS1_DOLBY_DDP_ENABLED
         if (audio_extn_is_dolby_format(out->format))
@@ -1809,14 +1875,15 @@ static int out_standby(struct audio_stream *stream)
         if (adev->adm_deregister_stream)
             adev->adm_deregister_stream(adev->adm_data, out->handle);
 
-        pthread_mutex_lock(&adev->lock);
+        /* the pcm is only used under out->lock, close it before blocking the device */
+        if (!is_offload_usecase(out->usecase) && out->pcm) {
+            pcm_close(out->pcm);
+            out->pcm = NULL;
+        }
+        audio_extn_perf_lock_io_stop(out->usecase);
+        lock_adev(adev, ADEV_LOCK_OUT_STANDBY);
         out->standby = true;
-        if (!is_offload_usecase(out->usecase)) {
-            if (out->pcm) {
-                pcm_close(out->pcm);
-                out->pcm = NULL;
-            }
-        } else {
+        if (is_offload_usecase(out->usecase)) {
             ALOGD("copl(%p):standby", out);
             stop_compressed_output_l(out);
             out->send_next_track_params = false;
@@ -1892,6 +1959,7 @@ static int out_set_parameters(struct audio_stream *stream, const char *kvpairs)
     char value[32];
     int ret = 0, val = 0, err;
     bool select_new_device = false;
+    bool need_adev_lock;
 
     ALOGD("%s: enter: usecase(%d: %s) kvpairs: %s",
           __func__, out->usecase, use_case_table[out->usecase], kvpairs);
@@ -1902,7 +1970,15 @@ static int out_set_parameters(struct audio_stream *stream, const char *kvpairs)
     if (err >= 0) {
         val = atoi(value);
         lock_output_stream(out);
-        pthread_mutex_lock(&adev->lock);
+        /*
+         * A standby output that does not carry a call is in no usecase list,
+         * so its new devices only matter once it starts under its own lock.
+         * primary_output and voice_tx_output only point at this stream from
+         * its open to its close, so they can be checked without adev->lock.
+         */
+        need_adev_lock = !out->standby || output_drives_call(adev, out);
+        if (need_adev_lock)
+            lock_adev(adev, ADEV_LOCK_OUT_ROUTING);
 
         /*
          * When HDMI cable is unplugged/usb hs is disconnected the
@@ -1956,7 +2032,8 @@ static int out_set_parameters(struct audio_stream *stream, const char *kvpairs)
                 select_devices(adev, out->usecase);
         }
 
-        pthread_mutex_unlock(&adev->lock);
+        if (need_adev_lock)
+            pthread_mutex_unlock(&adev->lock);
         pthread_mutex_unlock(&out->lock);
     }
 
@@ -2067,6 +2144,16 @@ static uint32_t out_get_latency(const struct audio_stream_out *stream)
            (out->config.rate);
     }
 
+    latency += platform_sink_render_latency(out->dev->platform, out->devices) / 1000;
+
+    /* frames still queued in the voip jitter buffer are not in the pcm yet */
+    if (out->usecase == USECASE_COMPRESS_VOIP_CALL) {
+        lock_output_stream(out);
+        latency += voice_extn_compress_voip_out_get_queued_frames(out) * 1000 /
+                   out->sample_rate;
+        pthread_mutex_unlock(&out->lock);
+    }
+
     ALOGV("%s: Latency %d", __func__, latency);
     return latency;
 }
@@ -2139,7 +2226,7 @@ static ssize_t out_write(struct audio_stream_out *stream, const void *buffer,
 
     if (out->standby) {
         out->standby = false;
-        pthread_mutex_lock(&adev->lock);
+        lock_adev(adev, ADEV_LOCK_OUT_START);
         if (out->usecase == USECASE_COMPRESS_VOIP_CALL)
             ret = voice_extn_compress_voip_start_output_stream(out);
         else
@@ -2206,8 +2293,15 @@ static ssize_t out_write(struct audio_stream_out *stream, const void *buffer,
 
             if (out->usecase == USECASE_AUDIO_PLAYBACK_AFE_PROXY)
                 ret = pcm_mmap_write(out->pcm, (void *)buffer, bytes);
-            else
+            else if (out->usecase == USECASE_COMPRESS_VOIP_CALL)
+                ret = voice_extn_compress_voip_out_write(out, buffer, bytes);
+            else {
+                audio_extn_perf_lock_io_begin(out->usecase);
                 ret = pcm_write(out->pcm, (void *)buffer, bytes);
+                audio_extn_perf_lock_io_end(out->usecase,
+                        bytes * 1000000LL / audio_stream_out_frame_size(stream) /
+                        out->sample_rate);
+            }
 
             if (ret < 0)
                 ret = -errno;
@@ -2307,6 +2401,7 @@ static int out_get_presentation_position(const struct audio_stream_out *stream,
     struct stream_out *out = (struct stream_out *)stream;
     int ret = -1;
     unsigned long dsp_frames;
+    uint64_t sink_frames;
 
     lock_output_stream(out);
 
@@ -2316,7 +2411,10 @@ static int out_get_presentation_position(const struct audio_stream_out *stream,
                     &out->sample_rate);
             ALOGVV("%s rendered frames %ld sample_rate %d",
                    __func__, dsp_frames, out->sample_rate);
-            *frames = dsp_frames;
+            // Account for the sink's own audio latency (e.g. HDMI TVs).
+            sink_frames = platform_sink_render_latency(out->dev->platform,
+                                  out->devices) * out->sample_rate / 1000000LL;
+            *frames = (dsp_frames > sink_frames) ? dsp_frames - sink_frames : 0;
             ret = 0;
             /* this is the best we can do */
             clock_gettime(CLOCK_MONOTONIC, timestamp);
@@ -2330,7 +2428,12 @@ static int out_get_presentation_position(const struct audio_stream_out *stream,
                 // This adjustment accounts for buffering after app processor.
                 // It is based on estimated DSP latency per use case, rather than exact.
                 signed_frames -=
-                    (platform_render_latency(out->usecase) * out->sample_rate / 1000000LL);
+                    ((platform_render_latency(out->usecase) +
+                      platform_sink_render_latency(out->dev->platform, out->devices)) *
+                     out->sample_rate / 1000000LL);
+                // Voip frames are counted in written when queued in the HAL.
+                if (out->usecase == USECASE_COMPRESS_VOIP_CALL)
+                    signed_frames -= voice_extn_compress_voip_out_get_queued_frames(out);
 
                 // It would be unusual for this value to be negative, but check just in case ...
                 if (signed_frames >= 0) {
@@ -2518,12 +2621,13 @@ static int in_standby(struct audio_stream *stream)
         if (adev->adm_deregister_stream)
             adev->adm_deregister_stream(adev->adm_data, in->capture_handle);
 
-        pthread_mutex_lock(&adev->lock);
-        in->standby = true;
         if (in->pcm) {
             pcm_close(in->pcm);
             in->pcm = NULL;
         }
+        audio_extn_perf_lock_io_stop(in->usecase);
+        lock_adev(adev, ADEV_LOCK_IN_STANDBY);
+        in->standby = true;
         status = stop_input_stream(in);
         pthread_mutex_unlock(&adev->lock);
     }
@@ -2546,14 +2650,33 @@ static int in_set_parameters(struct audio_stream *stream, const char *kvpairs)
     char *str;
     char value[32];
     int ret = 0, val = 0, err;
+    bool has_source;
 
     ALOGD("%s: enter: kvpairs=%s", __func__, kvpairs);
     parms = str_parms_create_str(kvpairs);
 
     if (!parms)
         goto error;
+
+    /* only the source and routing keys need the device lock */
+    has_source = str_parms_get_str(parms, AUDIO_PARAMETER_STREAM_INPUT_SOURCE,
+                                   value, sizeof(value)) >= 0;
+    if (!has_source &&
+        str_parms_get_str(parms, AUDIO_PARAMETER_STREAM_ROUTING, value, sizeof(value)) < 0)
+        goto done_unlocked;
+
     lock_input_stream(in);
-    pthread_mutex_lock(&adev->lock);
+
+    /* rerouting a standby input is picked up when it starts, under its own lock */
+    if (!has_source && in->standby) {
+        val = atoi(value);
+        if (val != 0)
+            in->device = val;
+        pthread_mutex_unlock(&in->lock);
+        goto done_unlocked;
+    }
+
+    lock_adev(adev, ADEV_LOCK_IN_ROUTING);
 
     err = str_parms_get_str(parms, AUDIO_PARAMETER_STREAM_INPUT_SOURCE, value, sizeof(value));
     if (err >= 0) {
@@ -2590,6 +2713,7 @@ done:
     pthread_mutex_unlock(&adev->lock);
     pthread_mutex_unlock(&in->lock);
 
+done_unlocked:
     str_parms_destroy(parms);
 error:
     ALOGV("%s: exit: status(%d)", __func__, ret);
@@ -2654,7 +2778,7 @@ static ssize_t in_read(struct audio_stream_in *stream, void *buffer,
 
     if (in->standby) {
         if (!in->is_st_session) {
-            pthread_mutex_lock(&adev->lock);
+            lock_adev(adev, ADEV_LOCK_IN_START);
             if (in->usecase == USECASE_COMPRESS_VOIP_CALL)
                 ret = voice_extn_compress_voip_start_input_stream(in);
             else
@@ -2679,8 +2803,15 @@ static ssize_t in_read(struct audio_stream_in *stream, void *buffer,
             ret = audio_extn_compr_cap_read(in, buffer, bytes);
         else if (in->usecase == USECASE_AUDIO_RECORD_AFE_PROXY)
             ret = pcm_mmap_read(in->pcm, buffer, bytes);
-        else
+        else if (in->is_st_session)
+            ret = audio_extn_sound_trigger_read(in, buffer, bytes);
+        else {
+            audio_extn_perf_lock_io_begin(in->usecase);
             ret = pcm_read(in->pcm, buffer, bytes);
+            audio_extn_perf_lock_io_end(in->usecase,
+                    bytes * 1000000LL / audio_stream_in_frame_size(stream) /
+                    in->config.rate);
+        }
         if (ret < 0)
             ret = -errno;
     }
@@ -3212,13 +3343,17 @@ static int adev_set_parameters(struct audio_hw_device *dev, const char *kvpairs)
             set_snd_card_state(adev,SND_CARD_STATE_OFFLINE);
             //close compress sessions on OFFLINE status
             close_compress_sessions(adev);
+            //calibration does not survive a dsp restart
+            lock_adev(adev, ADEV_LOCK_SET_PARAMETERS);
+            audio_extn_utils_invalidate_cal_cache(adev);
+            pthread_mutex_unlock(&adev->lock);
         } else if (strstr(snd_card_status, "ONLINE")) {
             ALOGD("Received sound card ONLINE status");
             set_snd_card_state(adev,SND_CARD_STATE_ONLINE);
         }
     }
 
-    pthread_mutex_lock(&adev->lock);
+    lock_adev(adev, ADEV_LOCK_SET_PARAMETERS);
     status = voice_set_parameters(adev, parms);
     if (status != 0)
         goto done;
@@ -3227,6 +3362,13 @@ static int adev_set_parameters(struct audio_hw_device *dev, const char *kvpairs)
     if (status != 0)
         goto done;
 
+    ret = str_parms_get_str(parms, AUDIO_PARAMETER_KEY_ROUTING_STATS_RESET,
+                            value, sizeof(value));
+    if (ret >= 0 && !strcmp(value, "true")) {
+        memset(adev->lock_stats, 0, sizeof(adev->lock_stats));
+        memset(&adev->routing_stats, 0, sizeof(adev->routing_stats));
+    }
+
     ret = str_parms_get_str(parms, AUDIO_PARAMETER_KEY_BT_NREC, value, sizeof(value));
     if (ret >= 0) {
         /* When set to false, HAL should disable EC and NS */
@@ -3315,16 +3457,43 @@ error:
     return status;
 }
 
+static char *adev_get_hal_state(struct audio_device *adev)
+{
+    char value[64];
+    uint32_t voip_out_count = 0, voip_sample_rate = 0;
+    int in_call, mode;
+    bool voip_supported;
+
+    pthread_mutex_lock(&adev->lock);
+    mode = adev->mode;
+    in_call = adev->voice.is_in_call;
+    voip_supported = (voice_extn_compress_voip_get_state(&voip_out_count,
+                                                         &voip_sample_rate) == 0);
+    pthread_mutex_unlock(&adev->lock);
+
+    snprintf(value, sizeof(value), "%s=%d,%d,%d,%d", AUDIO_PARAMETER_KEY_HAL_STATE,
+             mode, in_call, voip_supported ? (int)voip_out_count : -1,
+             voip_supported ? (int)voip_sample_rate : -1);
+    return strdup(value);
+}
+
 static char* adev_get_parameters(const struct audio_hw_device *dev,
                                  const char *keys)
 {
     struct audio_device *adev = (struct audio_device *)dev;
-    struct str_parms *reply = str_parms_create();
-    struct str_parms *query = str_parms_create_str(keys);
+    struct str_parms *reply;
+    struct str_parms *query;
     char *str;
     char value[256] = {0};
     int ret = 0;
 
+    /* polled by the audio policy on every VoIP output selection: answer without
+     * going through str_parms */
+    if (keys && !strcmp(keys, AUDIO_PARAMETER_KEY_HAL_STATE))
+        return adev_get_hal_state(adev);
+
+    reply = str_parms_create();
+    query = str_parms_create_str(keys);
     if (!query || !reply) {
         ALOGE("adev_get_parameters: failed to create query or reply");
         return NULL;
@@ -3401,7 +3570,7 @@ static int adev_set_mode(struct audio_hw_device *dev, audio_mode_t mode)
 {
     struct audio_device *adev = (struct audio_device *)dev;
 
-    pthread_mutex_lock(&adev->lock);
+    lock_adev(adev, ADEV_LOCK_SET_MODE);
     if (adev->mode != mode) {
         ALOGD("%s: mode %d\n", __func__, mode);
         adev->mode = mode;
@@ -3629,9 +3798,66 @@ static void adev_close_input_stream(struct audio_hw_device *dev,
     return;
 }
 
-static int adev_dump(const audio_hw_device_t *device __unused,
-                     int fd __unused)
+static const char * const adev_lock_site_names[ADEV_LOCK_SITE_MAX] = {
+    [ADEV_LOCK_OUT_STANDBY] = "out_standby",
+    [ADEV_LOCK_OUT_ROUTING] = "out_routing",
+    [ADEV_LOCK_OUT_START] = "out_start",
+    [ADEV_LOCK_IN_STANDBY] = "in_standby",
+    [ADEV_LOCK_IN_ROUTING] = "in_routing",
+    [ADEV_LOCK_IN_START] = "in_start",
+    [ADEV_LOCK_SET_PARAMETERS] = "set_parameters",
+    [ADEV_LOCK_SET_MODE] = "set_mode",
+};
+
+static void adev_dump_lock_stats(const struct lock_site_stats *stats, int fd)
+{
+    int i;
+
+    dprintf(fd, " Device lock contention:\n");
+    dprintf(fd, "  %-16s %10s %10s %14s %12s\n",
+            "site", "count", "contended", "total_wait_us", "max_wait_us");
+    for (i = 0; i < ADEV_LOCK_SITE_MAX; i++)
+        dprintf(fd, "  %-16s %10u %10u %14llu %12llu\n", adev_lock_site_names[i],
+                stats[i].count, stats[i].contended,
+                (unsigned long long)stats[i].total_wait_us,
+                (unsigned long long)stats[i].max_wait_us);
+}
+
+static void adev_dump_routing_stats(const struct routing_stats *stats, int fd)
+{
+    dprintf(fd, " Routing cost:\n");
+    dprintf(fd, "  transitions %u, total %llu us, max %llu us\n", stats->transitions,
+            (unsigned long long)stats->total_transition_us,
+            (unsigned long long)stats->max_transition_us);
+    dprintf(fd, "  mixer paths applied %u, reset %u\n",
+            stats->path_applies, stats->path_resets);
+    dprintf(fd, "  calibration sends %u, pcm opens %u, compress opens %u\n",
+            stats->calibration_sends, stats->pcm_opens, stats->compress_opens);
+}
+
+static int adev_dump(const audio_hw_device_t *device, int fd)
 {
+    struct audio_device *adev = (struct audio_device *)device;
+    struct lock_site_stats lock_stats[ADEV_LOCK_SITE_MAX];
+    struct routing_stats routing_stats;
+    bool locked;
+
+    /* never block dumpsys on a stuck device lock, print a racy copy instead */
+    locked = (pthread_mutex_trylock(&adev->lock) == 0);
+    memcpy(lock_stats, adev->lock_stats, sizeof(lock_stats));
+    routing_stats = adev->routing_stats;
+    if (locked)
+        pthread_mutex_unlock(&adev->lock);
+
+    dprintf(fd, "\nAudio HAL state:\n");
+    if (!locked)
+        dprintf(fd, " (device lock busy, statistics unsynchronized)\n");
+    adev_dump_lock_stats(lock_stats, fd);
+    adev_dump_routing_stats(&routing_stats, fd);
+    platform_dump(adev->platform, fd);
+    audio_extn_utils_mixer_pool_dump(fd);
+    audio_extn_perf_lock_dump(fd);
+    voice_extn_dump(adev, fd);
     return 0;
 }
 
@@ -3772,6 +3998,13 @@ static int adev_open(const hw_module_t *module, const char *name,
             adev->visualizer_stop_output =
                         (int (*)(audio_io_handle_t, int))dlsym(adev->visualizer_lib,
                                                         "visualizer_hal_stop_output");
+            adev->visualizer_set_mixer_ops =
+                        (mixer_ops_setter_t)dlsym(adev->visualizer_lib,
+                                                  "visualizer_hal_set_mixer_ops");
+            if (adev->visualizer_set_mixer_ops)
+                adev->visualizer_set_mixer_ops(audio_extn_utils_mixer_acquire,
+                                               audio_extn_utils_mixer_release,
+                                               audio_extn_utils_mixer_get_ctl);
         }
     }
     audio_extn_listen_init(adev, adev->snd_card);
@@ -3794,6 +4027,13 @@ static int adev_open(const hw_module_t *module, const char *name,
             adev->offload_effects_set_hpx_state =
                         (int (*)(bool))dlsym(adev->offload_effects_lib,
                                          "offload_effects_bundle_set_hpx_state");
+            adev->offload_effects_set_mixer_ops =
+                        (mixer_ops_setter_t)dlsym(adev->offload_effects_lib,
+                                         "offload_effects_bundle_hal_set_mixer_ops");
+            if (adev->offload_effects_set_mixer_ops)
+                adev->offload_effects_set_mixer_ops(audio_extn_utils_mixer_acquire,
+                                                    audio_extn_utils_mixer_release,
+                                                    audio_extn_utils_mixer_get_ctl);
         }
     }
 
@@ -74,6 +74,17 @@
 #define SND_CARD_STATE_OFFLINE 0
 #define SND_CARD_STATE_ONLINE 1
 
+/* Batched query of the HAL state polled by the audio policy. The reply is
+ * "hal_state=<mode>,<in_call>,<voip_out_stream_count>,<voip_sample_rate>",
+ * with the voip fields set to -1 when compress VoIP is not supported.
+ */
+#define AUDIO_PARAMETER_KEY_HAL_STATE "hal_state"
+
+/* Clears the lock contention and routing cost statistics reported by dumpsys,
+ * e.g. before replaying a routing scenario: "routing_stats_reset=true"
+ */
+#define AUDIO_PARAMETER_KEY_ROUTING_STATS_RESET "routing_stats_reset"
+
 /* These are the supported use cases by the hardware.
  * Each usecase is mapped to a specific PCM device.
  * Refer to pcm_device_table[].
@@ -301,6 +312,51 @@ typedef void (*adm_register_input_stream_t)(void *, audio_io_handle_t, audio_inp
 typedef void (*adm_deregister_stream_t)(void *, audio_io_handle_t);
 typedef void (*adm_request_focus_t)(void *, audio_io_handle_t);
 typedef void (*adm_abandon_focus_t)(void *, audio_io_handle_t);
+/* hands the shared mixer pool (acquire, release, control lookup) to an effect library */
+typedef void (*mixer_ops_setter_t)(struct mixer *(*)(int), void (*)(struct mixer *),
+                                   struct mixer_ctl *(*)(struct mixer *, const char *));
+
+/* adev->lock acquisition sites reported by the lock contention dump */
+enum {
+    ADEV_LOCK_OUT_STANDBY,
+    ADEV_LOCK_OUT_ROUTING,
+    ADEV_LOCK_OUT_START,
+    ADEV_LOCK_IN_STANDBY,
+    ADEV_LOCK_IN_ROUTING,
+    ADEV_LOCK_IN_START,
+    ADEV_LOCK_SET_PARAMETERS,
+    ADEV_LOCK_SET_MODE,
+    ADEV_LOCK_SITE_MAX,
+};
+
+/* updated with adev->lock held */
+struct lock_site_stats {
+    uint32_t count;
+    uint32_t contended;
+    uint64_t total_wait_us;
+    uint64_t max_wait_us;
+};
+
+/*
+ * Cost of routing operations. The transition times are updated with adev->lock
+ * held; the counters go through ROUTING_STATS_INC() as hostless sessions open
+ * their pcms on a bring-up thread without it. The pcm opens cover the stream,
+ * voice, VoIP and hostless (FM, HFP) paths; speaker protection and the USB
+ * proxy are not counted.
+ */
+struct routing_stats {
+    uint32_t transitions;        /* select_devices() calls */
+    uint64_t total_transition_us;
+    uint64_t max_transition_us;
+    uint32_t path_applies;       /* mixer paths applied */
+    uint32_t path_resets;        /* mixer paths reset */
+    uint32_t calibration_sends;  /* counted by the platform when acdb is called */
+    uint32_t pcm_opens;
+    uint32_t compress_opens;
+};
+
+#define ROUTING_STATS_INC(adev, counter) \
+    __atomic_add_fetch(&(adev)->routing_stats.counter, 1, __ATOMIC_RELAXED)
 
 struct audio_device {
     struct audio_hw_device device;
@@ -339,6 +395,8 @@ struct audio_device {
 
     struct sound_card_status snd_card_status;
     int (*offload_effects_set_hpx_state)(bool);
+    mixer_ops_setter_t visualizer_set_mixer_ops;
+    mixer_ops_setter_t offload_effects_set_mixer_ops;
 
     void *adm_data;
     void *adm_lib;
@@ -349,6 +407,9 @@ struct audio_device {
     adm_deregister_stream_t adm_deregister_stream;
     adm_request_focus_t adm_request_focus;
     adm_abandon_focus_t adm_abandon_focus;
+
+    struct lock_site_stats lock_stats[ADEV_LOCK_SITE_MAX];
+    struct routing_stats routing_stats;
 };
 
 int select_devices(struct audio_device *adev,
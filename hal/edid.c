@@ -685,3 +685,97 @@ bool edid_get_sink_caps(edid_audio_info* info, char *edid_data)
     dump_edid_data(info);
     return true;
 }
+
+static int get_edid_latency(unsigned char byte)
+{
+    /* 0: not provided, 255: no audio/video output, else 2 * (byte - 1) ms */
+    if (byte == 0 || byte == 255)
+        return EDID_LATENCY_UNKNOWN;
+    return 2 * (byte - 1);
+}
+
+static uint32_t get_edid_sink_hash(const unsigned char *base_block)
+{
+    /* FNV-1a over manufacturer, product code, serial and date (bytes 8-17) */
+    uint32_t hash = 2166136261u;
+    int i;
+
+    for (i = 8; i < 18; i++) {
+        hash ^= base_block[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static bool parse_hdmi_vsdb(edid_audio_info* info, const unsigned char *vsdb,
+                            int length)
+{
+    uint32_t oui;
+
+    if (length < 3)
+        return false;
+
+    oui = vsdb[1] | (vsdb[2] << 8) | (vsdb[3] << 16);
+    if (oui != HDMI_VSDB_IEEE_OUI)
+        return false;
+
+    if (length < HDMI_VSDB_LATENCY_FLAGS_OFFSET + 2 ||
+        !(vsdb[HDMI_VSDB_LATENCY_FLAGS_OFFSET] & HDMI_VSDB_LATENCY_PRESENT)) {
+        ALOGV("%s: HDMI VSDB without latency fields", __func__);
+        return true;
+    }
+
+    info->video_latency = get_edid_latency(vsdb[HDMI_VSDB_LATENCY_FLAGS_OFFSET + 1]);
+    info->audio_latency = get_edid_latency(vsdb[HDMI_VSDB_LATENCY_FLAGS_OFFSET + 2]);
+    return true;
+}
+
+bool edid_get_sink_latency(edid_audio_info* info, const unsigned char *raw_edid,
+                           int length)
+{
+    const unsigned char *block;
+    int ext_count, i, pos, dtd_offset;
+    int tag, len;
+
+    if (!info)
+        return false;
+
+    info->video_latency = EDID_LATENCY_UNKNOWN;
+    info->audio_latency = EDID_LATENCY_UNKNOWN;
+    info->sink_hash = 0;
+
+    if (!raw_edid || length < EDID_BLOCK_SIZE) {
+        ALOGE("%s: No valid raw EDID", __func__);
+        return false;
+    }
+
+    info->sink_hash = get_edid_sink_hash(raw_edid);
+    ext_count = raw_edid[EDID_EXTENSION_COUNT_OFFSET];
+
+    for (i = 1; i <= ext_count && (i + 1) * EDID_BLOCK_SIZE <= length; i++) {
+        block = raw_edid + i * EDID_BLOCK_SIZE;
+        if (block[0] != CEA_EXTENSION_TAG)
+            continue;
+
+        dtd_offset = block[2];
+        if (dtd_offset > EDID_BLOCK_SIZE)
+            dtd_offset = EDID_BLOCK_SIZE;
+
+        for (pos = CEA_DATA_BLOCK_OFFSET; pos < dtd_offset; pos += len + 1) {
+            tag = block[pos] >> 5;
+            len = block[pos] & 0x1f;
+            if (pos + len >= dtd_offset)
+                break;
+            if (tag == CEA_DATA_BLOCK_TAG_VSDB &&
+                parse_hdmi_vsdb(info, block + pos, len)) {
+                ALOGD("%s: sink 0x%08x video latency %d ms audio latency %d ms",
+                      __func__, info->sink_hash, info->video_latency,
+                      info->audio_latency);
+                return true;
+            }
+        }
+    }
+
+    ALOGV("%s: no HDMI VSDB found for sink 0x%08x", __func__, info->sink_hash);
+    return true;
+}
@@ -41,6 +41,17 @@
 #define MAX_FRAME_BUFFER_NAME_SIZE      80
 #define MAX_CHAR_PER_INT                13
 
+/* Raw EDID layout (E-EDID / CEA-861) */
+#define EDID_BLOCK_SIZE                 128
+#define EDID_EXTENSION_COUNT_OFFSET     126
+#define CEA_EXTENSION_TAG               0x02
+#define CEA_DATA_BLOCK_OFFSET           4
+#define CEA_DATA_BLOCK_TAG_VSDB         3
+#define HDMI_VSDB_IEEE_OUI              0x000C03
+#define HDMI_VSDB_LATENCY_FLAGS_OFFSET  8
+#define HDMI_VSDB_LATENCY_PRESENT       BIT(7)
+#define EDID_LATENCY_UNKNOWN            -1
+
 #define PCM_CHANNEL_FL    1  /* Front left channel.                           */
 #define PCM_CHANNEL_FR    2  /* Front right channel.                          */
 #define PCM_CHANNEL_FC    3  /* Front center channel.                         */
@@ -90,7 +101,14 @@ typedef struct edid_audio_info {
     edid_audio_block_info audio_blocks_array[MAX_EDID_BLOCKS];
     char channel_map[MAX_CHANNELS_SUPPORTED];
     int  channel_allocation;
+    /* progressive latencies from the HDMI VSDB in ms, EDID_LATENCY_UNKNOWN if absent */
+    int  video_latency;
+    int  audio_latency;
+    /* identifies the sink (vendor/product/serial) for latency overrides */
+    uint32_t sink_hash;
 } edid_audio_info;
 
 bool edid_get_sink_caps(edid_audio_info* info, char *edid_data);
+bool edid_get_sink_latency(edid_audio_info* info, const unsigned char *raw_edid,
+                           int length);
 #endif /* EDID_H */
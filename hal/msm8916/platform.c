@@ -290,6 +290,24 @@ static const char * const device_table[SND_DEVICE_MAX] = {
     [SND_DEVICE_IN_SSR_3MIC] = "three-mic",
 };
 
+/* Default backend names appended to the mixer path of each sound device */
+static const struct platform_backend_default backend_defaults[] = {
+    {SND_DEVICE_IN_BT_SCO_MIC, "bt-sco"},
+    {SND_DEVICE_IN_BT_SCO_MIC_NREC, "bt-sco"},
+    {SND_DEVICE_IN_BT_SCO_MIC_WB, "bt-sco-wb"},
+    {SND_DEVICE_IN_BT_SCO_MIC_WB_NREC, "bt-sco-wb"},
+    {SND_DEVICE_OUT_BT_SCO, "bt-sco"},
+    {SND_DEVICE_OUT_BT_SCO_WB, "bt-sco-wb"},
+    {SND_DEVICE_OUT_HDMI, "hdmi"},
+    {SND_DEVICE_OUT_SPEAKER_AND_HDMI, "speaker-and-hdmi"},
+    {SND_DEVICE_OUT_AFE_PROXY, "afe-proxy"},
+    {SND_DEVICE_OUT_USB_HEADSET, "usb-headphones"},
+    {SND_DEVICE_OUT_SPEAKER_AND_USB_HEADSET, "speaker-and-usb-headphones"},
+    {SND_DEVICE_IN_USB_HEADSET_MIC, "usb-headset-mic"},
+    {SND_DEVICE_IN_CAPTURE_FM, "capture-fm"},
+    {SND_DEVICE_OUT_TRANSMISSION_FM, "transmission-fm"},
+};
+
 /* ACDB IDs (audio DSP path configuration IDs) for each sound device */
 static int acdb_device_table[SND_DEVICE_MAX] = {
     [SND_DEVICE_NONE] = -1,
@@ -902,11 +920,11 @@ void *platform_init(struct audio_device *adev)
     my_data = calloc(1, sizeof(struct platform_data));
 
     while (snd_card_num < MAX_SND_CARD) {
-        adev->mixer = mixer_open(snd_card_num);
+        adev->mixer = audio_extn_utils_mixer_acquire(snd_card_num);
 
         while (!adev->mixer && retry_num < RETRY_NUMBER) {
             usleep(RETRY_US);
-            adev->mixer = mixer_open(snd_card_num);
+            adev->mixer = audio_extn_utils_mixer_acquire(snd_card_num);
             retry_num++;
         }
 
@@ -924,6 +942,8 @@ void *platform_init(struct audio_device *adev)
         my_data->hw_info = hw_info_init(snd_card_name);
         if (!my_data->hw_info) {
             ALOGE("%s: Failed to init hardware info", __func__);
+            audio_extn_utils_mixer_release(adev->mixer);
+            adev->mixer = NULL;
         } else {
             query_platform(snd_card_name, mixer_xml_path);
             ALOGD("%s: mixer path file is %s", __func__,
@@ -1064,6 +1084,8 @@ void *platform_init(struct audio_device *adev)
     }
 
 acdb_init_fail:
+    platform_backend_init(backend_defaults, ARRAY_SIZE(backend_defaults));
+
     /* Initialize ACDB ID's */
     platform_info_init(PLATFORM_INFO_XML_PATH);
 
@@ -1091,6 +1113,7 @@ void platform_deinit(void *platform)
 
     hw_info_deinit(my_data->hw_info);
     close_csd_client(my_data->csd);
+    platform_backend_deinit();
 
     free(platform);
     /* deinit usb */
@@ -1122,37 +1145,6 @@ int platform_get_snd_device_name_extn(void *platform, snd_device_t snd_device,
     return 0;
 }
 
-void platform_add_backend_name(char *mixer_path, snd_device_t snd_device)
-{
-    if ((snd_device == SND_DEVICE_IN_BT_SCO_MIC) ||
-         (snd_device == SND_DEVICE_IN_BT_SCO_MIC_NREC))
-        strlcat(mixer_path, " bt-sco", MIXER_PATH_MAX_LENGTH);
-    else if ((snd_device == SND_DEVICE_IN_BT_SCO_MIC_WB) ||
-              (snd_device == SND_DEVICE_IN_BT_SCO_MIC_WB_NREC))
-        strlcat(mixer_path, " bt-sco-wb", MIXER_PATH_MAX_LENGTH);
-    else if(snd_device == SND_DEVICE_OUT_BT_SCO)
-        strlcat(mixer_path, " bt-sco", MIXER_PATH_MAX_LENGTH);
-    else if(snd_device == SND_DEVICE_OUT_BT_SCO_WB)
-        strlcat(mixer_path, " bt-sco-wb", MIXER_PATH_MAX_LENGTH);
-    else if (snd_device == SND_DEVICE_OUT_HDMI)
-        strlcat(mixer_path, " hdmi", MIXER_PATH_MAX_LENGTH);
-    else if (snd_device == SND_DEVICE_OUT_SPEAKER_AND_HDMI)
-        strlcat(mixer_path, " speaker-and-hdmi", MIXER_PATH_MAX_LENGTH);
-    else if (snd_device == SND_DEVICE_OUT_AFE_PROXY)
-        strlcat(mixer_path, " afe-proxy", MIXER_PATH_MAX_LENGTH);
-    else if (snd_device == SND_DEVICE_OUT_USB_HEADSET)
-        strlcat(mixer_path, " usb-headphones", MIXER_PATH_MAX_LENGTH);
-    else if (snd_device == SND_DEVICE_OUT_SPEAKER_AND_USB_HEADSET)
-        strlcat(mixer_path, " speaker-and-usb-headphones",
-                MIXER_PATH_MAX_LENGTH);
-    else if (snd_device == SND_DEVICE_IN_USB_HEADSET_MIC)
-        strlcat(mixer_path, " usb-headset-mic", MIXER_PATH_MAX_LENGTH);
-    else if (snd_device == SND_DEVICE_IN_CAPTURE_FM)
-        strlcat(mixer_path, " capture-fm", MIXER_PATH_MAX_LENGTH);
-    else if (snd_device == SND_DEVICE_OUT_TRANSMISSION_FM)
-        strlcat(mixer_path, " transmission-fm", MIXER_PATH_MAX_LENGTH);
-}
-
 int platform_get_pcm_device_id(audio_usecase_t usecase, int device_type)
 {
     int device_id;
@@ -1314,6 +1306,7 @@ int platform_send_audio_calibration(void *platform, snd_device_t snd_device,
             acdb_dev_type = ACDB_DEV_TYPE_IN;
         my_data->acdb_send_audio_cal(acdb_dev_id, acdb_dev_type, app_type,
                                      sample_rate);
+        ROUTING_STATS_INC(my_data->adev, calibration_sends);
     }
     return 0;
 }
@@ -1374,9 +1367,10 @@ int platform_switch_voice_call_device_post(void *platform,
         acdb_rx_id = acdb_device_table[out_snd_device];
         acdb_tx_id = acdb_device_table[in_snd_device];
 
-        if (acdb_rx_id > 0 && acdb_tx_id > 0)
+        if (acdb_rx_id > 0 && acdb_tx_id > 0) {
             my_data->acdb_send_voice_cal(acdb_rx_id, acdb_tx_id);
-        else
+            ROUTING_STATS_INC(my_data->adev, calibration_sends);
+        } else
             ALOGE("%s: Incorrect ACDB IDs (rx: %d tx: %d)", __func__,
                   acdb_rx_id, acdb_tx_id);
     }
@@ -2405,6 +2399,26 @@ int64_t platform_render_latency(audio_usecase_t usecase)
     }
 }
 
+int64_t platform_sink_render_latency(void *platform __unused,
+                                     audio_devices_t devices __unused)
+{
+    return 0;
+}
+
+int platform_set_sink_latency_override(uint32_t sink_hash __unused,
+                                       int audio_latency __unused)
+{
+    return -ENOSYS;
+}
+
+void platform_invalidate_calibration_cache(void *platform __unused)
+{
+}
+
+void platform_dump(void *platform __unused, int fd __unused)
+{
+}
+
 int platform_update_usecase_from_source(int source, int usecase)
 {
     ALOGV("%s: input source :%d", __func__, source);
@@ -2626,12 +2640,6 @@ int platform_set_usecase_pcm_id(audio_usecase_t usecase __unused, int32_t type _
     return -ENOSYS;
 }
 
-int platform_set_snd_device_backend(snd_device_t snd_device __unused,
-                                    const char * backend __unused)
-{
-    return -ENOSYS;
-}
-
 int platform_get_edid_info(void *platform __unused)
 {
    return -ENOSYS;
@@ -38,6 +38,7 @@
  */
 #define AUDIO_DATA_BLOCK_PATH "/sys/class/graphics/fb1/audio_data_block"
 #define MIXER_XML_PATH "/system/etc/mixer_paths.xml"
+#define PLATFORM_INFO_XML_PATH "/system/etc/audio_platform_info.xml"
 
 /*
  * This file will have a maximum of 38 bytes:
@@ -156,6 +157,16 @@ static const char * const device_table[SND_DEVICE_MAX] = {
     [SND_DEVICE_IN_USB_HEADSET_MIC] = "usb-headset-mic",
 };
 
+/* Default backend names appended to the mixer path of each sound device */
+static const struct platform_backend_default backend_defaults[] = {
+    {SND_DEVICE_IN_BT_SCO_MIC, "bt-sco"},
+    {SND_DEVICE_IN_BT_SCO_MIC_WB, "bt-sco-wb"},
+    {SND_DEVICE_OUT_BT_SCO, "bt-sco"},
+    {SND_DEVICE_OUT_BT_SCO_WB, "bt-sco-wb"},
+    {SND_DEVICE_OUT_HDMI, "hdmi"},
+    {SND_DEVICE_OUT_SPEAKER_AND_HDMI, "speaker-and-hdmi"},
+};
+
 /* ACDB IDs (audio DSP path configuration IDs) for each sound device */
 static const int acdb_device_table[SND_DEVICE_MAX] = {
     [SND_DEVICE_NONE] = -1,
@@ -231,7 +242,7 @@ void *platform_init(struct audio_device *adev)
     struct platform_data *my_data;
     const char *snd_card_name;
 
-    adev->mixer = mixer_open(MIXER_CARD);
+    adev->mixer = audio_extn_utils_mixer_acquire(MIXER_CARD);
 
     if (!adev->mixer) {
         ALOGE("Unable to open the mixer, aborting.");
@@ -241,6 +252,8 @@ void *platform_init(struct audio_device *adev)
     adev->audio_route = audio_route_init(MIXER_CARD, MIXER_XML_PATH);
     if (!adev->audio_route) {
         ALOGE("%s: Failed to init audio route controls, aborting.", __func__);
+        audio_extn_utils_mixer_release(adev->mixer);
+        adev->mixer = NULL;
         return NULL;
     }
 
@@ -340,6 +353,11 @@ void *platform_init(struct audio_device *adev)
         }
     }
 
+    platform_backend_init(backend_defaults, ARRAY_SIZE(backend_defaults));
+
+    /* only the backend overrides apply here, the other sections are rejected */
+    platform_info_init(PLATFORM_INFO_XML_PATH);
+
     return my_data;
 }
 
@@ -347,6 +365,7 @@ void platform_deinit(void *platform)
 {
     struct platform_data *my_data = (struct platform_data *)platform;
 
+    platform_backend_deinit();
     free(platform);
 }
 
@@ -373,22 +392,6 @@ int platform_get_snd_device_name_extn(void *platform, snd_device_t snd_device,
     return 0;
 }
 
-void platform_add_backend_name(char *mixer_path, snd_device_t snd_device)
-{
-    if (snd_device == SND_DEVICE_IN_BT_SCO_MIC)
-        strlcat(mixer_path, " bt-sco", MIXER_PATH_MAX_LENGTH);
-    else if (snd_device == SND_DEVICE_IN_BT_SCO_MIC_WB)
-        strlcat(mixer_path, " bt-sco-wb", MIXER_PATH_MAX_LENGTH);
-    else if(snd_device == SND_DEVICE_OUT_BT_SCO)
-        strlcat(mixer_path, " bt-sco", MIXER_PATH_MAX_LENGTH);
-    else if(snd_device == SND_DEVICE_OUT_BT_SCO_WB)
-        strlcat(mixer_path, " bt-sco-wb", MIXER_PATH_MAX_LENGTH);
-    else if (snd_device == SND_DEVICE_OUT_HDMI)
-        strlcat(mixer_path, " hdmi", MIXER_PATH_MAX_LENGTH);
-    else if (snd_device == SND_DEVICE_OUT_SPEAKER_AND_HDMI)
-        strlcat(mixer_path, " speaker-and-hdmi", MIXER_PATH_MAX_LENGTH);
-}
-
 int platform_get_pcm_device_id(audio_usecase_t usecase, int device_type)
 {
     int device_id;
@@ -498,6 +501,7 @@ int platform_send_audio_calibration(void *platform, snd_device_t snd_device,
         else
             acdb_dev_type = ACDB_DEV_TYPE_IN;
         my_data->acdb_send_audio_cal(acdb_dev_id, acdb_dev_type);
+        ROUTING_STATS_INC(my_data->adev, calibration_sends);
     }
     return 0;
 }
@@ -1025,6 +1029,26 @@ int64_t platform_render_latency(audio_usecase_t usecase)
     }
 }
 
+int64_t platform_sink_render_latency(void *platform __unused,
+                                     audio_devices_t devices __unused)
+{
+    return 0;
+}
+
+int platform_set_sink_latency_override(uint32_t sink_hash __unused,
+                                       int audio_latency __unused)
+{
+    return -ENOSYS;
+}
+
+void platform_invalidate_calibration_cache(void *platform __unused)
+{
+}
+
+void platform_dump(void *platform __unused, int fd __unused)
+{
+}
+
 int platform_update_usecase_from_source(int source, int usecase)
 {
     ALOGV("%s: input source :%d", __func__, source);
@@ -1058,12 +1082,6 @@ int platform_set_usecase_pcm_id(audio_usecase_t usecase __unused, int32_t type _
     return -ENOSYS;
 }
 
-int platform_set_snd_device_backend(snd_device_t snd_device __unused,
-                                    const char * backend __unused)
-{
-    return -ENOSYS;
-}
-
 bool platform_sound_trigger_device_needs_event(snd_device_t snd_device __unused)
 {
     return false;
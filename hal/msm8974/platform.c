@@ -28,9 +28,13 @@
 #endif
 
 #include <stdlib.h>
+#include <unistd.h>
 #include <dlfcn.h>
 #include <fcntl.h>
 #include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <stdio.h>
+#include <time.h>
 #include <cutils/log.h>
 #include <cutils/properties.h>
 #include <cutils/str_parms.h>
@@ -53,6 +57,9 @@
 
 #define LIB_ACDB_LOADER "libacdbloader.so"
 #define AUDIO_DATA_BLOCK_MIXER_CTL "HDMI EDID"
+#define HDMI_FB_TYPE_PATH "/sys/class/graphics/fb%d/msm_fb_type"
+#define HDMI_RAW_EDID_PATH "/sys/class/graphics/fb%d/edid_raw_data"
+#define HDMI_FB_TYPE_DTV "dtv panel"
 #define CVD_VERSION_MIXER_CTL "CVD Version"
 
 #define MAX_COMPRESS_OFFLOAD_FRAGMENT_SIZE (256 * 1024)
@@ -90,6 +97,10 @@
 
 #define MAX_CVD_VERSION_STRING_SIZE    100
 
+/* Raw EDID is read from the HDMI frame buffer node, up to MAX_EDID_BLOCKS */
+#define MAX_RAW_EDID_SIZE   (MAX_EDID_BLOCKS * EDID_BLOCK_SIZE)
+#define MAX_SINK_LATENCY_OVERRIDES 16
+
 /* EDID format ID for LPCM audio */
 #define EDID_FORMAT_LPCM    1
 
@@ -105,6 +116,12 @@
 #define SAMPLE_RATE_16KHZ 16000
 
 #define MAX_SET_CAL_BYTE_SIZE 65536
+/* Calibration blobs exchanged through files are not bound by str_parms */
+#define MAX_CAL_FILE_BYTE_SIZE (4 * 1024 * 1024)
+#define CAL_FILE_CHUNK_SIZE 16384
+#define CAL_FILE_DIR "/data/misc/audio/"
+/* calibration read back through the file channel always lands here */
+#define CAL_GET_FILE CAL_FILE_DIR "audio_cal_get.bin"
 
 #define AUDIO_PARAMETER_KEY_FLUENCE_TYPE  "fluence"
 #define AUDIO_PARAMETER_KEY_SLOWTALK      "st_enable"
@@ -112,6 +129,8 @@
 #define AUDIO_PARAMETER_KEY_VOLUME_BOOST  "volume_boost"
 #define AUDIO_PARAMETER_KEY_AUD_CALDATA   "cal_data"
 #define AUDIO_PARAMETER_KEY_AUD_CALRESULT "cal_result"
+#define AUDIO_PARAMETER_KEY_AUD_CALFILE   "cal_file"
+#define AUDIO_PARAMETER_KEY_AUD_CALSIZE   "cal_size"
 
 
 /* Query external audio device connection status */
@@ -164,6 +183,37 @@ acdb_loader_get_calibration_t acdb_loader_get_calibration;
 typedef int (*acdb_set_audio_cal_t) (void *, void *, uint32_t);
 typedef int (*acdb_get_audio_cal_t) (void *, void *, uint32_t*);
 
+/*
+ * Calibration last pushed on each ACDB path, indexed by acdb_dev_type.
+ * A send for any device on a direction replaces what that path holds, so
+ * one entry per direction is all that can still be live.
+ */
+struct cal_cache_entry {
+    bool valid;
+    int acdb_dev_id;
+    int app_type;
+    int sample_rate;
+    int bit_width;
+};
+
+struct cal_cache {
+    pthread_mutex_t lock;
+    struct cal_cache_entry path[ACDB_DEV_TYPE_IN + 1];
+    uint32_t sent;
+    uint32_t skipped;
+    uint32_t invalidated;
+    int64_t send_time_us;
+};
+
+/* State bits the output snd_device rules depend on outside of calls */
+#define OUT_RULE_ANC         0x1
+#define OUT_RULE_FB_ANC      0x2
+#define OUT_RULE_LR_SWAP     0x4
+#define OUT_RULE_BT_WB       0x8
+#define OUT_RULE_STATES      16
+/* one output snd_device table row per audio_devices_t bit */
+#define OUT_RULE_DEVICES     32
+
 struct platform_data {
     struct audio_device *adev;
     bool fluence_in_spkr_mode;
@@ -196,6 +246,11 @@ struct platform_data {
     struct csd_data *csd;
     void *edid_info;
     bool edid_valid;
+    /* sink render delay of the cached EDID, read without adev->lock */
+    int64_t sink_latency_us;
+    struct cal_cache cal_cache;
+    /* output snd_device outside of calls, by device bit and OUT_RULE_* state */
+    uint16_t out_snd_device_table[OUT_RULE_DEVICES][OUT_RULE_STATES];
 };
 
 static int pcm_device_table[AUDIO_USECASE_MAX][2] = {
@@ -568,7 +623,6 @@ static struct name_to_index snd_device_name_index[SND_DEVICE_MAX] = {
     {TO_NAME_INDEX(SND_DEVICE_IN_SPEAKER_QMIC_AEC_NS)},
 };
 
-static char * backend_table[SND_DEVICE_MAX] = {0};
 
 static struct name_to_index usecase_name_index[AUDIO_USECASE_MAX] = {
     {TO_NAME_INDEX(USECASE_AUDIO_PLAYBACK_DEEP_BUFFER)},
@@ -664,6 +718,15 @@ static int msm_be_id_array_len  =
 #define DEEP_BUFFER_PLATFORM_DELAY (29*1000LL)
 #define LOW_LATENCY_PLATFORM_DELAY (13*1000LL)
 
+/* sinks known to report wrong EDID latencies, filled from platform info xml */
+struct sink_latency_override {
+    uint32_t sink_hash;
+    int audio_latency;
+};
+
+static struct sink_latency_override sink_latency_overrides[MAX_SINK_LATENCY_OVERRIDES];
+static int num_sink_latency_overrides;
+
 void platform_set_echo_reference(void *platform, bool enable)
 {
     struct platform_data *my_data = (struct platform_data *)platform;
@@ -852,36 +915,86 @@ static bool platform_is_i2s_ext_modem(const char *snd_card_name,
     return plat_data->is_i2s_ext_modem;
 }
 
+static const struct platform_backend_default backend_defaults[] = {
+    {SND_DEVICE_IN_BT_SCO_MIC, "bt-sco"},
+    {SND_DEVICE_IN_BT_SCO_MIC_WB, "bt-sco-wb"},
+    {SND_DEVICE_IN_BT_SCO_MIC_NREC, "bt-sco"},
+    {SND_DEVICE_IN_BT_SCO_MIC_WB_NREC, "bt-sco-wb"},
+    {SND_DEVICE_OUT_BT_SCO, "bt-sco"},
+    {SND_DEVICE_OUT_BT_SCO_WB, "bt-sco-wb"},
+    {SND_DEVICE_OUT_HDMI, "hdmi"},
+    {SND_DEVICE_OUT_SPEAKER_AND_HDMI, "speaker-and-hdmi"},
+    {SND_DEVICE_OUT_VOICE_TX, "afe-proxy"},
+    {SND_DEVICE_IN_VOICE_RX, "afe-proxy"},
+    {SND_DEVICE_OUT_AFE_PROXY, "afe-proxy"},
+    {SND_DEVICE_OUT_USB_HEADSET, "usb-headphones"},
+    {SND_DEVICE_OUT_SPEAKER_AND_USB_HEADSET, "speaker-and-usb-headphones"},
+    {SND_DEVICE_IN_USB_HEADSET_MIC, "usb-headset-mic"},
+    {SND_DEVICE_IN_CAPTURE_FM, "capture-fm"},
+    {SND_DEVICE_OUT_TRANSMISSION_FM, "transmission-fm"},
+};
+
 static void set_platform_defaults()
 {
     int32_t dev;
-    for (dev = 0; dev < SND_DEVICE_MAX; dev++) {
-        backend_table[dev] = NULL;
-    }
     for (dev = 0; dev < SND_DEVICE_MAX; dev++) {
         backend_bit_width_table[dev] = 16;
     }
 
-    // TBD - do these go to the platform-info.xml file.
-    // will help in avoiding strdups here
-    backend_table[SND_DEVICE_IN_BT_SCO_MIC] = strdup("bt-sco");
-    backend_table[SND_DEVICE_IN_BT_SCO_MIC_WB] = strdup("bt-sco-wb");
-    backend_table[SND_DEVICE_IN_BT_SCO_MIC_NREC] = strdup("bt-sco");
-    backend_table[SND_DEVICE_IN_BT_SCO_MIC_WB_NREC] = strdup("bt-sco-wb");
-    backend_table[SND_DEVICE_OUT_BT_SCO] = strdup("bt-sco");
-    backend_table[SND_DEVICE_OUT_BT_SCO_WB] = strdup("bt-sco-wb");
-    backend_table[SND_DEVICE_OUT_HDMI] = strdup("hdmi");
-    backend_table[SND_DEVICE_OUT_SPEAKER_AND_HDMI] = strdup("speaker-and-hdmi");
-    backend_table[SND_DEVICE_OUT_VOICE_TX] = strdup("afe-proxy");
-    backend_table[SND_DEVICE_IN_VOICE_RX] = strdup("afe-proxy");
-
-    backend_table[SND_DEVICE_OUT_AFE_PROXY] = strdup("afe-proxy");
-    backend_table[SND_DEVICE_OUT_USB_HEADSET] = strdup("usb-headphones");
-    backend_table[SND_DEVICE_OUT_SPEAKER_AND_USB_HEADSET] =
-        strdup("speaker-and-usb-headphones");
-    backend_table[SND_DEVICE_IN_USB_HEADSET_MIC] = strdup("usb-headset-mic");
-    backend_table[SND_DEVICE_IN_CAPTURE_FM] = strdup("capture-fm");
-    backend_table[SND_DEVICE_OUT_TRANSMISSION_FM] = strdup("transmission-fm");
+    platform_backend_init(backend_defaults, ARRAY_SIZE(backend_defaults));
+}
+
+/*
+ * Output snd_device for a single device outside of calls. Depends only on its
+ * arguments so that it can be tabulated by init_out_snd_device_table(). Dock
+ * headsets and proxy reconfigure the AFE proxy and are resolved by the caller.
+ */
+static snd_device_t out_snd_device_rule(const struct platform_data *my_data,
+                                        audio_devices_t devices, uint32_t state)
+{
+    if (devices & AUDIO_DEVICE_OUT_WIRED_HEADPHONE ||
+        devices & AUDIO_DEVICE_OUT_WIRED_HEADSET) {
+        if (devices & AUDIO_DEVICE_OUT_WIRED_HEADSET
+            && (state & OUT_RULE_ANC)) {
+            if (state & OUT_RULE_FB_ANC)
+                return SND_DEVICE_OUT_ANC_FB_HEADSET;
+            else
+                return SND_DEVICE_OUT_ANC_HEADSET;
+        } else
+            return SND_DEVICE_OUT_HEADPHONES;
+    } else if (devices & AUDIO_DEVICE_OUT_SPEAKER) {
+        if (my_data->external_spk_1)
+            return SND_DEVICE_OUT_SPEAKER_EXTERNAL_1;
+        else if (my_data->external_spk_2)
+            return SND_DEVICE_OUT_SPEAKER_EXTERNAL_2;
+        else if (state & OUT_RULE_LR_SWAP)
+            return SND_DEVICE_OUT_SPEAKER_REVERSE;
+        else
+            return SND_DEVICE_OUT_SPEAKER;
+    } else if (devices & AUDIO_DEVICE_OUT_ALL_SCO) {
+        if (state & OUT_RULE_BT_WB)
+            return SND_DEVICE_OUT_BT_SCO_WB;
+        else
+            return SND_DEVICE_OUT_BT_SCO;
+    } else if (devices & AUDIO_DEVICE_OUT_AUX_DIGITAL) {
+        return SND_DEVICE_OUT_HDMI;
+    } else if (devices & AUDIO_DEVICE_OUT_FM_TX) {
+        return SND_DEVICE_OUT_TRANSMISSION_FM;
+    } else if (devices & AUDIO_DEVICE_OUT_EARPIECE) {
+        return SND_DEVICE_OUT_HANDSET;
+    }
+    return SND_DEVICE_NONE;
+}
+
+static void init_out_snd_device_table(struct platform_data *my_data)
+{
+    uint32_t bit, state;
+
+    for (bit = 0; bit < OUT_RULE_DEVICES; bit++) {
+        for (state = 0; state < OUT_RULE_STATES; state++)
+            my_data->out_snd_device_table[bit][state] =
+                out_snd_device_rule(my_data, 1u << bit, state);
+    }
 }
 
 void get_cvd_version(char *cvd_version, struct audio_device *adev)
@@ -1013,13 +1126,14 @@ void *platform_init(struct audio_device *adev)
         ALOGE("failed to allocate platform data");
         return NULL;
     }
+    pthread_mutex_init(&my_data->cal_cache.lock, (const pthread_mutexattr_t *) NULL);
 
     while (snd_card_num < MAX_SND_CARD) {
-        adev->mixer = mixer_open(snd_card_num);
+        adev->mixer = audio_extn_utils_mixer_acquire(snd_card_num);
 
         while (!adev->mixer && retry_num < RETRY_NUMBER) {
             usleep(RETRY_US);
-            adev->mixer = mixer_open(snd_card_num);
+            adev->mixer = audio_extn_utils_mixer_acquire(snd_card_num);
             retry_num++;
         }
 
@@ -1037,6 +1151,8 @@ void *platform_init(struct audio_device *adev)
         my_data->hw_info = hw_info_init(snd_card_name);
         if (!my_data->hw_info) {
             ALOGE("%s: Failed to init hardware info", __func__);
+            audio_extn_utils_mixer_release(adev->mixer);
+            adev->mixer = NULL;
         } else {
             if (platform_is_i2s_ext_modem(snd_card_name, my_data)) {
                 ALOGD("%s: Call MIXER_XML_PATH_I2S", __func__);
@@ -1190,6 +1306,7 @@ void *platform_init(struct audio_device *adev)
 acdb_init_fail:
 
     set_platform_defaults();
+    init_out_snd_device_table(my_data);
 
     /* Initialize ACDB ID's */
     if (my_data->is_i2s_ext_modem)
@@ -1243,14 +1360,9 @@ void platform_deinit(void *platform)
 
     hw_info_deinit(my_data->hw_info);
     close_csd_client(my_data->csd);
+    pthread_mutex_destroy(&my_data->cal_cache.lock);
 
-    int32_t dev;
-    for (dev = 0; dev < SND_DEVICE_MAX; dev++) {
-        if (backend_table[dev]) {
-            free(backend_table[dev]);
-            backend_table[dev]= NULL;
-        }
-    }
+    platform_backend_deinit();
 
     /* deinit audio device arbitration */
     audio_extn_dev_arbi_deinit();
@@ -1290,21 +1402,6 @@ int platform_get_snd_device_name_extn(void *platform, snd_device_t snd_device,
     return 0;
 }
 
-void platform_add_backend_name(char *mixer_path, snd_device_t snd_device)
-{
-    if ((snd_device < SND_DEVICE_MIN) || (snd_device >= SND_DEVICE_MAX)) {
-        ALOGE("%s: Invalid snd_device = %d", __func__, snd_device);
-        return;
-    }
-
-    const char * suffix = backend_table[snd_device];
-
-    if (suffix != NULL) {
-        strlcat(mixer_path, " ", MIXER_PATH_MAX_LENGTH);
-        strlcat(mixer_path, suffix, MIXER_PATH_MAX_LENGTH);
-    }
-}
-
 int platform_get_pcm_device_id(audio_usecase_t usecase, int device_type)
 {
     int device_id;
@@ -1477,11 +1574,24 @@ int platform_get_snd_device_bit_width(snd_device_t snd_device)
     return backend_bit_width_table[snd_device];
 }
 
+void platform_invalidate_calibration_cache(void *platform)
+{
+    struct platform_data *my_data = (struct platform_data *)platform;
+
+    pthread_mutex_lock(&my_data->cal_cache.lock);
+    memset(my_data->cal_cache.path, 0, sizeof(my_data->cal_cache.path));
+    my_data->cal_cache.invalidated++;
+    pthread_mutex_unlock(&my_data->cal_cache.lock);
+}
+
 int platform_send_audio_calibration(void *platform, snd_device_t snd_device,
                                     int app_type, int sample_rate)
 {
     struct platform_data *my_data = (struct platform_data *)platform;
-    int acdb_dev_id, acdb_dev_type;
+    struct cal_cache *cache = &my_data->cal_cache;
+    struct cal_cache_entry *entry;
+    int acdb_dev_id, acdb_dev_type, bit_width;
+    int64_t start_us;
 
     acdb_dev_id = acdb_device_table[audio_extn_get_spkr_prot_snd_device(snd_device)];
     if (acdb_dev_id < 0) {
@@ -1490,19 +1600,62 @@ int platform_send_audio_calibration(void *platform, snd_device_t snd_device,
         return -EINVAL;
     }
     if (my_data->acdb_send_audio_cal) {
-        ALOGV("%s: sending audio calibration for snd_device(%d) acdb_id(%d)",
-              __func__, snd_device, acdb_dev_id);
         if (snd_device >= SND_DEVICE_OUT_BEGIN &&
                 snd_device < SND_DEVICE_OUT_END)
             acdb_dev_type = ACDB_DEV_TYPE_OUT;
         else
             acdb_dev_type = ACDB_DEV_TYPE_IN;
+        bit_width = backend_bit_width_table[snd_device];
+
+        /* the dsp keeps the last calibration sent on each path */
+        pthread_mutex_lock(&cache->lock);
+        entry = &cache->path[acdb_dev_type];
+        if (entry->valid && entry->acdb_dev_id == acdb_dev_id &&
+            entry->app_type == app_type && entry->sample_rate == sample_rate &&
+            entry->bit_width == bit_width) {
+            cache->skipped++;
+            ALOGV("%s: calibration for snd_device(%d) acdb_id(%d) is live, "
+                  "skipped %u (~%lld us saved)", __func__, snd_device, acdb_dev_id,
+                  cache->skipped, cache->sent ?
+                  (long long)(cache->send_time_us / cache->sent) : 0LL);
+            pthread_mutex_unlock(&cache->lock);
+            return 0;
+        }
+
+        ALOGV("%s: sending audio calibration for snd_device(%d) acdb_id(%d)",
+              __func__, snd_device, acdb_dev_id);
+        start_us = audio_extn_utils_get_time_us();
         my_data->acdb_send_audio_cal(acdb_dev_id, acdb_dev_type, app_type,
                                      sample_rate);
+        cache->send_time_us += audio_extn_utils_get_time_us() - start_us;
+        cache->sent++;
+        ROUTING_STATS_INC(my_data->adev, calibration_sends);
+
+        entry->valid = true;
+        entry->acdb_dev_id = acdb_dev_id;
+        entry->app_type = app_type;
+        entry->sample_rate = sample_rate;
+        entry->bit_width = bit_width;
+        pthread_mutex_unlock(&cache->lock);
     }
     return 0;
 }
 
+void platform_dump(void *platform, int fd)
+{
+    struct platform_data *my_data = (struct platform_data *)platform;
+    struct cal_cache *cache = &my_data->cal_cache;
+    int64_t avg_us;
+
+    pthread_mutex_lock(&cache->lock);
+    avg_us = cache->sent ? cache->send_time_us / cache->sent : 0;
+    dprintf(fd, " Audio calibration: sent %u skipped %u invalidated %u "
+            "avg send %lld us, ~%lld us saved\n",
+            cache->sent, cache->skipped, cache->invalidated,
+            (long long)avg_us, (long long)(avg_us * cache->skipped));
+    pthread_mutex_unlock(&cache->lock);
+}
+
 int platform_switch_voice_call_device_pre(void *platform)
 {
     struct platform_data *my_data = (struct platform_data *)platform;
@@ -1570,9 +1723,10 @@ int platform_switch_voice_call_device_post(void *platform,
         acdb_rx_id = acdb_device_table[out_snd_device];
         acdb_tx_id = acdb_device_table[in_snd_device];
 
-        if (acdb_rx_id > 0 && acdb_tx_id > 0)
+        if (acdb_rx_id > 0 && acdb_tx_id > 0) {
             my_data->acdb_send_voice_cal(acdb_rx_id, acdb_tx_id);
-        else
+            ROUTING_STATS_INC(my_data->adev, calibration_sends);
+        } else
             ALOGE("%s: Incorrect ACDB IDs (rx: %d tx: %d)", __func__,
                   acdb_rx_id, acdb_tx_id);
     }
@@ -1766,6 +1920,7 @@ snd_device_t platform_get_output_snd_device(void *platform, audio_devices_t devi
     struct audio_device *adev = my_data->adev;
     audio_mode_t mode = adev->mode;
     snd_device_t snd_device = SND_DEVICE_NONE;
+    uint32_t rule_state;
 
     audio_channel_mask_t channel_mask = (adev->active_input == NULL) ?
                                 AUDIO_CHANNEL_IN_MONO : adev->active_input->channel_mask;
@@ -1885,41 +2040,26 @@ snd_device_t platform_get_output_snd_device(void *platform, audio_devices_t devi
         }
     }
 
-    if (devices & AUDIO_DEVICE_OUT_WIRED_HEADPHONE ||
-        devices & AUDIO_DEVICE_OUT_WIRED_HEADSET) {
-        if (devices & AUDIO_DEVICE_OUT_WIRED_HEADSET
-            && audio_extn_get_anc_enabled()) {
-            if (audio_extn_should_use_fb_anc())
-                snd_device = SND_DEVICE_OUT_ANC_FB_HEADSET;
-            else
-                snd_device = SND_DEVICE_OUT_ANC_HEADSET;
-        } else
-            snd_device = SND_DEVICE_OUT_HEADPHONES;
-    } else if (devices & AUDIO_DEVICE_OUT_SPEAKER) {
-        if (my_data->external_spk_1)
-            snd_device = SND_DEVICE_OUT_SPEAKER_EXTERNAL_1;
-        else if (my_data->external_spk_2)
-            snd_device = SND_DEVICE_OUT_SPEAKER_EXTERNAL_2;
-        else if (adev->speaker_lr_swap)
-            snd_device = SND_DEVICE_OUT_SPEAKER_REVERSE;
-        else
-            snd_device = SND_DEVICE_OUT_SPEAKER;
-    } else if (devices & AUDIO_DEVICE_OUT_ALL_SCO) {
-        if (adev->bt_wb_speech_enabled)
-            snd_device = SND_DEVICE_OUT_BT_SCO_WB;
-        else
-            snd_device = SND_DEVICE_OUT_BT_SCO;
-    } else if (devices & AUDIO_DEVICE_OUT_AUX_DIGITAL) {
-        snd_device = SND_DEVICE_OUT_HDMI ;
-    } else if (devices & AUDIO_DEVICE_OUT_ANLG_DOCK_HEADSET ||
-               devices & AUDIO_DEVICE_OUT_DGTL_DOCK_HEADSET) {
+    /* a single device is set at this point */
+    rule_state = 0;
+    if ((devices & AUDIO_DEVICE_OUT_WIRED_HEADSET) && audio_extn_get_anc_enabled()) {
+        rule_state |= OUT_RULE_ANC;
+        if (audio_extn_should_use_fb_anc())
+            rule_state |= OUT_RULE_FB_ANC;
+    }
+    if (adev->speaker_lr_swap)
+        rule_state |= OUT_RULE_LR_SWAP;
+    if (adev->bt_wb_speech_enabled)
+        rule_state |= OUT_RULE_BT_WB;
+    snd_device = my_data->out_snd_device_table[__builtin_ctz(devices)][rule_state];
+    if (snd_device != SND_DEVICE_NONE)
+        goto exit;
+
+    if (devices & AUDIO_DEVICE_OUT_ANLG_DOCK_HEADSET ||
+        devices & AUDIO_DEVICE_OUT_DGTL_DOCK_HEADSET) {
         ALOGD("%s: setting USB hadset channel capability(2) for Proxy", __func__);
         audio_extn_set_afe_proxy_channel_mixer(adev, 2);
         snd_device = SND_DEVICE_OUT_USB_HEADSET;
-    } else if (devices & AUDIO_DEVICE_OUT_FM_TX) {
-        snd_device = SND_DEVICE_OUT_TRANSMISSION_FM;
-    } else if (devices & AUDIO_DEVICE_OUT_EARPIECE) {
-        snd_device = SND_DEVICE_OUT_HANDSET;
     } else if (devices & AUDIO_DEVICE_OUT_PROXY) {
         channel_count = audio_extn_get_afe_proxy_channel_count();
         ALOGD("%s: setting sink capability(%d) for Proxy", __func__, channel_count);
@@ -2395,6 +2535,8 @@ static int update_external_device_status(struct platform_data *my_data,
         ALOGE("The audio event type is not found");
         return -EINVAL;
     }
+    /* speaker rules depend on the external speaker state */
+    init_out_snd_device_table(my_data);
 
     list_for_each(node, &my_data->adev->usecase_list) {
         usecase = node_to_item(node, struct audio_usecase, list);
@@ -2471,6 +2613,122 @@ static int parse_audiocal_cfg(struct str_parms *parms, acdb_audio_cal_cfg_t *cal
     return ret;
 }
 
+/* Only plain files under CAL_FILE_DIR can be used to exchange calibration */
+static bool is_valid_cal_file(const char *path)
+{
+    if (strncmp(path, CAL_FILE_DIR, strlen(CAL_FILE_DIR)) ||
+        strstr(path, "..") != NULL) {
+        ALOGE("[%s] calibration file %s is not under %s",
+              __func__, path, CAL_FILE_DIR);
+        return false;
+    }
+    return true;
+}
+
+/* Symlinks are refused by O_NOFOLLOW, fifos and devices by the fstat check */
+static int open_cal_file(const char *path, int flags, mode_t mode)
+{
+    struct stat st;
+    int fd;
+
+    fd = open(path, flags | O_NOFOLLOW | O_CLOEXEC, mode);
+    if (fd < 0) {
+        ALOGE("[%s] open %s failed: %s", __func__, path, strerror(errno));
+        return -errno;
+    }
+    if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode)) {
+        ALOGE("[%s] %s is not a regular file", __func__, path);
+        close(fd);
+        return -EINVAL;
+    }
+    return fd;
+}
+
+static int read_cal_file(const char *path, uint8_t **data, int32_t *len)
+{
+    struct stat st;
+    uint8_t *buf = NULL;
+    size_t offset = 0, chunk;
+    ssize_t bytes;
+    int fd, ret = 0;
+
+    if (!is_valid_cal_file(path))
+        return -EINVAL;
+
+    fd = open_cal_file(path, O_RDONLY, 0);
+    if (fd < 0)
+        return fd;
+    if (fstat(fd, &st) < 0 ||
+        st.st_size <= 0 || st.st_size > MAX_CAL_FILE_BYTE_SIZE) {
+        ALOGE("[%s] invalid calibration file %s", __func__, path);
+        ret = -EINVAL;
+        goto done;
+    }
+    buf = (uint8_t *)malloc(st.st_size);
+    if (buf == NULL) {
+        ret = -ENOMEM;
+        goto done;
+    }
+    while (offset < (size_t)st.st_size) {
+        chunk = (size_t)st.st_size - offset;
+        if (chunk > CAL_FILE_CHUNK_SIZE)
+            chunk = CAL_FILE_CHUNK_SIZE;
+        bytes = read(fd, buf + offset, chunk);
+        if (bytes <= 0) {
+            if (bytes < 0 && errno == EINTR)
+                continue;
+            ALOGE("[%s] short read on %s at %zu", __func__, path, offset);
+            ret = -EIO;
+            goto done;
+        }
+        offset += bytes;
+    }
+    *data = buf;
+    *len = (int32_t)offset;
+    buf = NULL;
+done:
+    free(buf);
+    close(fd);
+    return ret;
+}
+
+/*
+ * Writes to the fixed CAL_GET_FILE. The previous file is unlinked and a new
+ * one created exclusively, so a link planted under that name is never
+ * written through.
+ */
+static int write_cal_file(const uint8_t *data, uint32_t len)
+{
+    const char *path = CAL_GET_FILE;
+    size_t offset = 0, chunk;
+    ssize_t bytes;
+    int fd, ret = 0;
+
+    if (unlink(path) < 0 && errno != ENOENT) {
+        ALOGE("[%s] unlink %s failed: %s", __func__, path, strerror(errno));
+        return -errno;
+    }
+    fd = open_cal_file(path, O_WRONLY | O_CREAT | O_EXCL, 0660);
+    if (fd < 0)
+        return fd;
+    while (offset < len) {
+        chunk = len - offset;
+        if (chunk > CAL_FILE_CHUNK_SIZE)
+            chunk = CAL_FILE_CHUNK_SIZE;
+        bytes = write(fd, data + offset, chunk);
+        if (bytes <= 0) {
+            if (bytes < 0 && errno == EINTR)
+                continue;
+            ALOGE("[%s] short write on %s at %zu", __func__, path, offset);
+            ret = -EIO;
+            break;
+        }
+        offset += bytes;
+    }
+    close(fd);
+    return ret;
+}
+
 static void set_audiocal(void *platform, struct str_parms *parms, char *value, int len) {
     struct platform_data *my_data = (struct platform_data *)platform;
     acdb_audio_cal_cfg_t cal={0};
@@ -2504,25 +2762,36 @@ static void set_audiocal(void *platform, struct str_parms *parms, char *value, i
             ALOGE("[%s] data decoding failed %d", __func__, dlen);
             goto done_key_audcal;
         }
-
-        if(cal.dev_id) {
-          if(audio_is_input_device(cal.dev_id)) {
-              cal.snd_dev_id = platform_get_input_snd_device(platform, cal.dev_id);
-          } else {
-              cal.snd_dev_id = platform_get_output_snd_device(platform, cal.dev_id);
-          }
-        }
-        cal.acdb_dev_id = platform_get_snd_device_acdb_id(cal.snd_dev_id);
-        ALOGD("Setting audio calibration for snd_device(%d) acdb_id(%d)",
-                cal.snd_dev_id, cal.acdb_dev_id);
-        if(cal.acdb_dev_id == -EINVAL) {
-            ALOGE("[%s] Invalid acdb_device id %d for snd device id %d",
-                       __func__, cal.acdb_dev_id, cal.snd_dev_id);
+    } else {
+        /* binary channel: the blob is handed over in a file */
+        err = str_parms_get_str(parms, AUDIO_PARAMETER_KEY_AUD_CALFILE, value, len);
+        if (err < 0)
+            goto done_key_audcal;
+        str_parms_del(parms, AUDIO_PARAMETER_KEY_AUD_CALFILE);
+        if (read_cal_file(value, &dptr, &dlen) < 0)
             goto done_key_audcal;
-        }
-        if(my_data->acdb_set_audio_cal) {
-            ret = my_data->acdb_set_audio_cal((void *)&cal, (void*)dptr, dlen);
-        }
+    }
+
+    if(cal.dev_id) {
+      if(audio_is_input_device(cal.dev_id)) {
+          cal.snd_dev_id = platform_get_input_snd_device(platform, cal.dev_id);
+      } else {
+          cal.snd_dev_id = platform_get_output_snd_device(platform, cal.dev_id);
+      }
+    }
+    cal.acdb_dev_id = platform_get_snd_device_acdb_id(cal.snd_dev_id);
+    ALOGD("Setting audio calibration for snd_device(%d) acdb_id(%d)",
+            cal.snd_dev_id, cal.acdb_dev_id);
+    if(cal.acdb_dev_id == -EINVAL) {
+        ALOGE("[%s] Invalid acdb_device id %d for snd device id %d",
+                   __func__, cal.acdb_dev_id, cal.snd_dev_id);
+        goto done_key_audcal;
+    }
+    if(my_data->acdb_set_audio_cal) {
+        ret = my_data->acdb_set_audio_cal((void *)&cal, (void*)dptr, dlen);
+        /* new calibration data only reaches the dsp on the next send */
+        if (ret == 0)
+            platform_invalidate_calibration_cache(platform);
     }
 done_key_audcal:
     if(dptr != NULL)
@@ -2733,11 +3002,14 @@ static void get_audiocal(void *platform, void *keys, void *pReply) {
     struct str_parms *query = (struct str_parms *)keys;
     struct str_parms *reply=(struct str_parms *)pReply;
     acdb_audio_cal_cfg_t cal={0};
-    uint8_t *dptr = NULL;
+    uint8_t *dptr = NULL, *grown;
     char value[512] = {0};
+    bool to_file = false;
     char *rparms=NULL;
     int ret=0, err;
-    uint32_t param_len;
+    uint32_t param_len, buf_len = MAX_SET_CAL_BYTE_SIZE;
+    uint32_t max_len = MAX_SET_CAL_BYTE_SIZE;
+    uint32_t offset = 0;
 
     if(query==NULL || platform==NULL || reply==NULL) {
         ALOGE("[%s] received null pointer",__func__);
@@ -2753,6 +3025,12 @@ static void get_audiocal(void *platform, void *keys, void *pReply) {
     err = str_parms_get_str(query, AUDIO_PARAMETER_KEY_AUD_CALDATA, value, sizeof(value));
     if (err >= 0) {
         str_parms_del(query, AUDIO_PARAMETER_KEY_AUD_CALDATA);
+    } else if (str_parms_get_str(query, AUDIO_PARAMETER_KEY_AUD_CALFILE,
+                                 value, sizeof(value)) >= 0) {
+        /* the blob goes to CAL_GET_FILE, the requested name is not used */
+        str_parms_del(query, AUDIO_PARAMETER_KEY_AUD_CALFILE);
+        to_file = true;
+        max_len = MAX_CAL_FILE_BYTE_SIZE;
     } else {
         goto done;
     }
@@ -2772,21 +3050,43 @@ static void get_audiocal(void *platform, void *keys, void *pReply) {
     ALOGD("[%s] Getting audio calibration for snd_device(%d) acdb_id(%d)",
            __func__, cal.snd_dev_id, cal.acdb_dev_id);
 
-    param_len = MAX_SET_CAL_BYTE_SIZE;
-    dptr = (uint8_t*)calloc(param_len, sizeof(uint8_t));
-    if(dptr == NULL) {
-        ALOGE("[%s] Memory allocation failed for length %d",__func__,param_len);
-        ret = -ENOMEM;
-        goto done_key_audcal;
-    }
     if (my_data->acdb_get_audio_cal != NULL) {
-        ret = my_data->acdb_get_audio_cal((void*)&cal, (void*)dptr, &param_len);
+        /*
+         * Start from the str_parms sized buffer and only grow it, up to
+         * max_len, while the blob fills the whole buffer.
+         */
+        for (;;) {
+            grown = (uint8_t *)realloc(dptr, buf_len);
+            if (grown == NULL) {
+                ALOGE("[%s] Memory allocation failed for length %d",__func__,buf_len);
+                ret = -ENOMEM;
+                goto done_key_audcal;
+            }
+            dptr = grown;
+            param_len = buf_len;
+            ret = my_data->acdb_get_audio_cal((void*)&cal, (void*)dptr, &param_len);
+            if (ret != 0 || param_len < buf_len || buf_len == max_len)
+                break;
+            buf_len = (buf_len * 4 < max_len) ? buf_len * 4 : max_len;
+        }
         if (ret == 0) {
             int dlen;
-            if(param_len == 0 || param_len == MAX_SET_CAL_BYTE_SIZE) {
+            if(param_len == 0 || param_len == buf_len) {
                 ret = -EINVAL;
                 goto done_key_audcal;
             }
+            if(cal.persist==0 && cal.module_id && cal.param_id)
+                offset = 12;
+            if (to_file) {
+                ret = write_cal_file(dptr + offset, param_len - offset);
+                if (ret < 0)
+                    goto done_key_audcal;
+                str_parms_add_int(reply, AUDIO_PARAMETER_KEY_AUD_CALRESULT, ret);
+                str_parms_add_str(reply, AUDIO_PARAMETER_KEY_AUD_CALFILE, CAL_GET_FILE);
+                str_parms_add_int(reply, AUDIO_PARAMETER_KEY_AUD_CALSIZE,
+                                  param_len - offset);
+                goto done;
+            }
             /* Allocate memory for encoding */
             rparms = (char*)calloc((param_len*2), sizeof(char));
             if(rparms == NULL) {
@@ -2795,11 +3095,7 @@ static void get_audiocal(void *platform, void *keys, void *pReply) {
                 ret = -ENOMEM;
                 goto done_key_audcal;
             }
-            if(cal.persist==0 && cal.module_id && cal.param_id) {
-                err = b64encode(dptr+12, param_len-12, rparms);
-            } else {
-                err = b64encode(dptr, param_len, rparms);
-            }
+            err = b64encode(dptr + offset, param_len - offset, rparms);
             if(err < 0) {
                 ALOGE("[%s] failed to convert data to string", __func__);
                 ret = -EINVAL;
@@ -2879,6 +3175,69 @@ int64_t platform_render_latency(audio_usecase_t usecase)
     }
 }
 
+int platform_set_sink_latency_override(uint32_t sink_hash, int audio_latency)
+{
+    int i;
+
+    if (audio_latency < 0) {
+        ALOGE("%s: invalid latency %d for sink 0x%08x",
+              __func__, audio_latency, sink_hash);
+        return -EINVAL;
+    }
+
+    for (i = 0; i < num_sink_latency_overrides; i++) {
+        if (sink_latency_overrides[i].sink_hash == sink_hash)
+            break;
+    }
+
+    if (i == MAX_SINK_LATENCY_OVERRIDES) {
+        ALOGE("%s: override table full, sink 0x%08x ignored", __func__, sink_hash);
+        return -ENOSPC;
+    }
+
+    sink_latency_overrides[i].sink_hash = sink_hash;
+    sink_latency_overrides[i].audio_latency = audio_latency;
+    if (i == num_sink_latency_overrides)
+        num_sink_latency_overrides++;
+
+    return 0;
+}
+
+static int64_t sink_latency_from_edid(const edid_audio_info *info)
+{
+    int i;
+
+    for (i = 0; i < num_sink_latency_overrides; i++) {
+        if (sink_latency_overrides[i].sink_hash == info->sink_hash)
+            return sink_latency_overrides[i].audio_latency * 1000LL;
+    }
+
+    if (info->audio_latency == EDID_LATENCY_UNKNOWN)
+        return 0;
+
+    return info->audio_latency * 1000LL;
+}
+
+static void set_sink_latency(struct platform_data *my_data, int64_t latency_us)
+{
+    __atomic_store_n(&my_data->sink_latency_us, latency_us, __ATOMIC_RELAXED);
+}
+
+/*
+ * Delay added by the external sink in Us. Called from the stream position
+ * getters without adev->lock, so only the value computed when the EDID was
+ * cached is read here.
+ */
+int64_t platform_sink_render_latency(void *platform, audio_devices_t devices)
+{
+    struct platform_data *my_data = (struct platform_data *)platform;
+
+    if (my_data == NULL || !(devices & AUDIO_DEVICE_OUT_AUX_DIGITAL))
+        return 0;
+
+    return __atomic_load_n(&my_data->sink_latency_us, __ATOMIC_RELAXED);
+}
+
 int platform_update_usecase_from_source(int source, int usecase)
 {
     ALOGV("%s: input source :%d", __func__, source);
@@ -3180,25 +3539,6 @@ bool platform_check_and_set_codec_backend_cfg(struct audio_device* adev, struct
     return false;
 }
 
-int platform_set_snd_device_backend(snd_device_t device, const char *backend)
-{
-    int ret = 0;
-
-    if ((device < SND_DEVICE_MIN) || (device >= SND_DEVICE_MAX)) {
-        ALOGE("%s: Invalid snd_device = %d",
-            __func__, device);
-        ret = -EINVAL;
-        goto done;
-    }
-
-    if (backend_table[device]) {
-        free(backend_table[device]);
-    }
-    backend_table[device] = strdup(backend);
-done:
-    return ret;
-}
-
 int platform_set_usecase_pcm_id(audio_usecase_t usecase, int32_t type, int32_t pcm_id)
 {
     int ret = 0;
@@ -3316,6 +3656,60 @@ int platform_set_stream_channel_map(void *platform, audio_channel_mask_t channel
     return ret;
 }
 
+static int get_hdmi_fb_index()
+{
+    char path[MAX_FRAME_BUFFER_NAME_SIZE];
+    char fb_type[MAX_FRAME_BUFFER_NAME_SIZE];
+    int fd, ret, i;
+
+    for (i = 0; i < MAX_DISPLAY_DEVICES; i++) {
+        snprintf(path, sizeof(path), HDMI_FB_TYPE_PATH, i);
+        fd = open(path, O_RDONLY);
+        if (fd < 0)
+            continue;
+
+        memset(fb_type, 0, sizeof(fb_type));
+        ret = read(fd, fb_type, sizeof(fb_type) - 1);
+        close(fd);
+        if (ret > 0 && !strncmp(fb_type, HDMI_FB_TYPE_DTV,
+                                strlen(HDMI_FB_TYPE_DTV)))
+            return i;
+    }
+    return -ENODEV;
+}
+
+/*
+ * The HDMI EDID mixer control only carries the audio data block, so the
+ * latency fields of the vendor specific data block are taken from the raw
+ * EDID exported by the display driver.
+ */
+static void update_sink_latency(edid_audio_info *info)
+{
+    unsigned char raw_edid[MAX_RAW_EDID_SIZE];
+    char path[MAX_FRAME_BUFFER_NAME_SIZE];
+    int fb_index, fd, length = 0;
+
+    info->video_latency = EDID_LATENCY_UNKNOWN;
+    info->audio_latency = EDID_LATENCY_UNKNOWN;
+
+    fb_index = get_hdmi_fb_index();
+    if (fb_index < 0) {
+        ALOGV("%s: no HDMI frame buffer found", __func__);
+        return;
+    }
+
+    snprintf(path, sizeof(path), HDMI_RAW_EDID_PATH, fb_index);
+    fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        ALOGW("%s: cannot open %s", __func__, path);
+        return;
+    }
+    length = read(fd, raw_edid, sizeof(raw_edid));
+    close(fd);
+
+    edid_get_sink_latency(info, raw_edid, length);
+}
+
 int platform_get_edid_info(void *platform)
 {
     struct platform_data *my_data = (struct platform_data *)platform;
@@ -3369,9 +3763,12 @@ int platform_get_edid_info(void *platform)
         ALOGE("%s: Failed to get HDMI sink capabilities", __func__);
         goto fail;
     }
+    update_sink_latency(info);
+    set_sink_latency(my_data, sink_latency_from_edid(info));
     my_data->edid_valid = true;
     return 0;
 fail:
+    set_sink_latency(my_data, 0);
     if (my_data->edid_info) {
         free(my_data->edid_info);
         my_data->edid_info = NULL;
@@ -3497,6 +3894,7 @@ void platform_reset_edid_info(void *platform) {
 
     ALOGV("%s:", __func__);
     struct platform_data *my_data = (struct platform_data *)platform;
+    set_sink_latency(my_data, 0);
     if (my_data->edid_info) {
         ALOGV("%s :free edid", __func__);
         free(my_data->edid_info);
@@ -3586,6 +3984,7 @@ void platform_invalidate_edid(void * platform)
 {
     struct platform_data *my_data = (struct platform_data *)platform;
     my_data->edid_valid = false;
+    set_sink_latency(my_data, 0);
     if (my_data->edid_info) {
         memset(my_data->edid_info, 0, sizeof(struct edid_audio_info));
     }
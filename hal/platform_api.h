@@ -40,6 +40,8 @@ int platform_set_snd_device_bit_width(snd_device_t snd_device, unsigned int bit_
 int platform_get_snd_device_bit_width(snd_device_t snd_device);
 int platform_send_audio_calibration(void *platform, snd_device_t snd_device,
                                     int app_type, int sample_rate);
+/* forces the next platform_send_audio_calibration on every path to reach the dsp */
+void platform_invalidate_calibration_cache(void *platform);
 int platform_get_default_app_type(void *platform);
 int platform_switch_voice_call_device_pre(void *platform);
 int platform_switch_voice_call_enable_device_config(void *platform,
@@ -73,7 +75,11 @@ int platform_update_lch(void *platform, struct voice_session *session,
                         enum voice_lch_mode lch_mode);
 /* returns the latency for a usecase in Us */
 int64_t platform_render_latency(audio_usecase_t usecase);
+/* returns the latency added by the external sink on devices in Us */
+int64_t platform_sink_render_latency(void *platform, audio_devices_t devices);
+int platform_set_sink_latency_override(uint32_t sink_hash, int audio_latency);
 int platform_update_usecase_from_source(int source, audio_usecase_t usecase);
+void platform_dump(void *platform, int fd);
 
 bool platform_listen_device_needs_event(snd_device_t snd_device);
 bool platform_listen_usecase_needs_event(audio_usecase_t uc_id);
@@ -110,4 +116,15 @@ void platform_cache_edid(void * platform);
 void platform_invalidate_edid(void * platform);
 int platform_set_hdmi_config(struct stream_out *out);
 int platform_set_device_params(struct stream_out *out, int param, int value);
+
+/* default backend name of a snd_device, see platform_backend_init() */
+struct platform_backend_default {
+    snd_device_t snd_device;
+    const char *backend;
+};
+
+/* platform_backend.c: backend names shared by all platforms */
+void platform_backend_init(const struct platform_backend_default *defaults,
+                           size_t count);
+void platform_backend_deinit();
 #endif // AUDIO_PLATFORM_API_H
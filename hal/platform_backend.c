@@ -0,0 +1,109 @@
+/*
+ * Copyright (c) 2014, The Linux Foundation. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *     * Neither the name of The Linux Foundation nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED "AS IS" AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#define LOG_TAG "platform_backend"
+/*#define LOG_NDEBUG 0*/
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <cutils/log.h>
+#include <audio_hw.h>
+#include "platform_api.h"
+#include <platform.h>
+
+/*
+ * Backend names appended to the mixer paths of a snd_device, shared by all
+ * platforms. Each platform provides its defaults as a table at init, which
+ * platform_info.xml can then override per device. Entries hold the mixer
+ * path suffix with its separator so that lookups are a single concatenation.
+ */
+static char *backend_suffix[SND_DEVICE_MAX];
+
+static int set_backend_suffix(snd_device_t snd_device, const char *backend)
+{
+    char *suffix = NULL;
+
+    if (backend != NULL && asprintf(&suffix, " %s", backend) < 0)
+        return -ENOMEM;
+
+    free(backend_suffix[snd_device]);
+    backend_suffix[snd_device] = suffix;
+    return 0;
+}
+
+void platform_backend_init(const struct platform_backend_default *defaults,
+                           size_t count)
+{
+    size_t i;
+
+    platform_backend_deinit();
+    for (i = 0; i < count; i++) {
+        if ((defaults[i].snd_device < SND_DEVICE_MIN) ||
+            (defaults[i].snd_device >= SND_DEVICE_MAX)) {
+            ALOGE("%s: Invalid snd_device = %d", __func__, defaults[i].snd_device);
+            continue;
+        }
+        if (set_backend_suffix(defaults[i].snd_device, defaults[i].backend) < 0)
+            ALOGE("%s: no memory for backend %s", __func__, defaults[i].backend);
+    }
+}
+
+void platform_backend_deinit()
+{
+    int32_t dev;
+
+    for (dev = 0; dev < SND_DEVICE_MAX; dev++) {
+        free(backend_suffix[dev]);
+        backend_suffix[dev] = NULL;
+    }
+}
+
+void platform_add_backend_name(char *mixer_path, snd_device_t snd_device)
+{
+    if ((snd_device < SND_DEVICE_MIN) || (snd_device >= SND_DEVICE_MAX)) {
+        ALOGE("%s: Invalid snd_device = %d", __func__, snd_device);
+        return;
+    }
+
+    if (backend_suffix[snd_device] != NULL)
+        strlcat(mixer_path, backend_suffix[snd_device], MIXER_PATH_MAX_LENGTH);
+}
+
+int platform_set_snd_device_backend(snd_device_t device, const char *backend)
+{
+    if ((device < SND_DEVICE_MIN) || (device >= SND_DEVICE_MAX)) {
+        ALOGE("%s: Invalid snd_device = %d",
+            __func__, device);
+        return -EINVAL;
+    }
+
+    return set_backend_suffix(device, backend);
+}
@@ -32,6 +32,7 @@
 
 #include <errno.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <expat.h>
 #include <cutils/log.h>
 #include <audio_hw.h>
@@ -46,6 +47,7 @@ typedef enum {
     BITWIDTH,
     PCM_ID,
     BACKEND_NAME,
+    SINK_LATENCY,
 } section_t;
 
 typedef void (* section_process_fn)(const XML_Char **attr);
@@ -54,6 +56,7 @@ static void process_acdb_id(const XML_Char **attr);
 static void process_bit_width(const XML_Char **attr);
 static void process_pcm_id(const XML_Char **attr);
 static void process_backend_name(const XML_Char **attr);
+static void process_sink_latency(const XML_Char **attr);
 static void process_root(const XML_Char **attr);
 
 static section_process_fn section_table[] = {
@@ -62,6 +65,7 @@ static section_process_fn section_table[] = {
     [BITWIDTH] = process_bit_width,
     [PCM_ID] = process_pcm_id,
     [BACKEND_NAME] = process_backend_name,
+    [SINK_LATENCY] = process_sink_latency,
 };
 
 static section_t section;
@@ -83,6 +87,11 @@ static section_t section;
  * ...
  * ...
  * </pcm_ids>
+ * <sink_latencies>
+ * <sink hash="???" audio_latency="???"/>
+ * ...
+ * ...
+ * </sink_latencies>
  * </audio_platform_info>
  */
 
@@ -173,6 +182,34 @@ done:
     return;
 }
 
+/* audio latency in ms to use instead of the EDID value of a sink */
+static void process_sink_latency(const XML_Char **attr)
+{
+    uint32_t sink_hash;
+
+    if (strcmp(attr[0], "hash") != 0) {
+        ALOGE("%s: 'hash' not found, no sink latency set!", __func__);
+        goto done;
+    }
+
+    sink_hash = (uint32_t)strtoul((char *)attr[1], NULL, 0);
+
+    if (strcmp(attr[2], "audio_latency") != 0) {
+        ALOGE("%s: Sink %s has no audio_latency set!",
+              __func__, attr[1]);
+        goto done;
+    }
+
+    if (platform_set_sink_latency_override(sink_hash, atoi((char *)attr[3])) < 0) {
+        ALOGE("%s: Sink %s latency %s was not set!",
+              __func__, attr[1], attr[3]);
+        goto done;
+    }
+
+done:
+    return;
+}
+
 static void process_acdb_id(const XML_Char **attr)
 {
     int index;
@@ -252,6 +289,8 @@ static void start_tag(void *userdata __unused, const XML_Char *tag_name,
         section = PCM_ID;
     } else if (strcmp(tag_name, "backend_names") == 0) {
         section = BACKEND_NAME;
+    } else if (strcmp(tag_name, "sink_latencies") == 0) {
+        section = SINK_LATENCY;
     } else if (strcmp(tag_name, "device") == 0) {
         if ((section != ACDB) && (section != BACKEND_NAME) && (section != BITWIDTH)) {
             ALOGE("device tag only supported for acdb/backend names");
@@ -269,6 +308,14 @@ static void start_tag(void *userdata __unused, const XML_Char *tag_name,
 
         section_process_fn fn = section_table[PCM_ID];
         fn(attr);
+    } else if (strcmp(tag_name, "sink") == 0) {
+        if (section != SINK_LATENCY) {
+            ALOGE("sink tag only supported with SINK_LATENCY section");
+            return;
+        }
+
+        section_process_fn fn = section_table[SINK_LATENCY];
+        fn(attr);
     }
 
     return;
@@ -284,6 +331,8 @@ static void end_tag(void *userdata __unused, const XML_Char *tag_name)
         section = ROOT;
     } else if (strcmp(tag_name, "backend_names") == 0) {
         section = ROOT;
+    } else if (strcmp(tag_name, "sink_latencies") == 0) {
+        section = ROOT;
     }
 }
 
@@ -164,7 +164,14 @@ int voice_stop_usecase(struct audio_device *adev, audio_usecase_t usecase_id)
     return ret;
 }
 
-int voice_start_usecase(struct audio_device *adev, audio_usecase_t usecase_id)
+/*
+ * Starts one voice usecase. With no lead, the usecase is routed through
+ * select_devices(). Otherwise it joins the sound devices of lead, a voice
+ * usecase routed for the same call output, and only applies its own mixer
+ * path.
+ */
+static int start_usecase(struct audio_device *adev, audio_usecase_t usecase_id,
+                         struct audio_usecase *lead)
 {
     int i, ret = 0;
     struct audio_usecase *uc_info;
@@ -196,7 +203,15 @@ int voice_start_usecase(struct audio_device *adev, audio_usecase_t usecase_id)
 
     list_add_tail(&adev->usecase_list, &uc_info->list);
 
-    select_devices(adev, usecase_id);
+    if (lead) {
+        uc_info->out_snd_device = lead->out_snd_device;
+        uc_info->in_snd_device = lead->in_snd_device;
+        enable_snd_device(adev, uc_info->out_snd_device);
+        enable_snd_device(adev, uc_info->in_snd_device);
+        enable_audio_route(adev, uc_info);
+    } else {
+        select_devices(adev, usecase_id);
+    }
 
     pcm_dev_rx_id = platform_get_pcm_device_id(uc_info->id, PCM_PLAYBACK);
     pcm_dev_tx_id = platform_get_pcm_device_id(uc_info->id, PCM_CAPTURE);
@@ -217,6 +232,7 @@ int voice_start_usecase(struct audio_device *adev, audio_usecase_t usecase_id)
 
     ALOGV("%s: Opening PCM capture device card_id(%d) device_id(%d)",
           __func__, adev->snd_card, pcm_dev_tx_id);
+    ROUTING_STATS_INC(adev, pcm_opens);
     session->pcm_tx = pcm_open(adev->snd_card,
                                pcm_dev_tx_id,
                                PCM_IN, &voice_config);
@@ -228,6 +244,7 @@ int voice_start_usecase(struct audio_device *adev, audio_usecase_t usecase_id)
 
     ALOGV("%s: Opening PCM playback device card_id(%d) device_id(%d)",
           __func__, adev->snd_card, pcm_dev_rx_id);
+    ROUTING_STATS_INC(adev, pcm_opens);
     session->pcm_rx = pcm_open(adev->snd_card,
                                pcm_dev_rx_id,
                                PCM_OUT, &voice_config);
@@ -263,6 +280,41 @@ done:
     return ret;
 }
 
+int voice_start_usecase(struct audio_device *adev, audio_usecase_t usecase_id)
+{
+    return start_usecase(adev, usecase_id, NULL);
+}
+
+/*
+ * Starts several voice usecases with a single routing pass: the first one
+ * that starts is routed with select_devices(), the others join its sound
+ * devices. status[i] gets the result for usecase_ids[i]; the first error
+ * is returned.
+ */
+int voice_start_usecases(struct audio_device *adev,
+                         const audio_usecase_t *usecase_ids, int *status,
+                         int count)
+{
+    struct audio_usecase *lead = NULL;
+    int i, ret = 0;
+
+    for (i = 0; i < count; i++) {
+        status[i] = start_usecase(adev, usecase_ids[i], lead);
+        if (status[i] < 0) {
+            if (ret == 0)
+                ret = status[i];
+            continue;
+        }
+        if (lead == NULL) {
+            lead = get_usecase_from_list(adev, usecase_ids[i]);
+            if (lead && (lead->out_snd_device == SND_DEVICE_NONE ||
+                         lead->in_snd_device == SND_DEVICE_NONE))
+                lead = NULL;
+        }
+    }
+    return ret;
+}
+
 bool voice_is_call_state_active(struct audio_device *adev)
 {
     bool call_state = false;
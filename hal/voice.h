@@ -75,6 +75,9 @@ enum {
 
 int voice_start_usecase(struct audio_device *adev, audio_usecase_t usecase_id);
 int voice_stop_usecase(struct audio_device *adev, audio_usecase_t usecase_id);
+int voice_start_usecases(struct audio_device *adev,
+                         const audio_usecase_t *usecase_ids, int *status,
+                         int count);
 
 int voice_start_call(struct audio_device *adev);
 int voice_stop_call(struct audio_device *adev);
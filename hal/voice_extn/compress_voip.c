@@ -25,6 +25,8 @@
 #include <pthread.h>
 #include <stdint.h>
 #include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
 #include <stdlib.h>
 #include <math.h>
 #include <cutils/log.h>
@@ -34,10 +36,12 @@
 #include "audio_hw.h"
 #include "platform_api.h"
 #include "platform.h"
+#include "audio_extn.h"
 #include "voice_extn.h"
 
 #define COMPRESS_VOIP_IO_BUF_SIZE_NB 320
 #define COMPRESS_VOIP_IO_BUF_SIZE_WB 640
+#define COMPRESS_VOIP_TX_PERIOD_COUNT 4
 
 struct pcm_config pcm_config_voip_nb = {
     .channels = 1,
@@ -55,6 +59,49 @@ struct pcm_config pcm_config_voip_wb = {
     .format = PCM_FORMAT_S16_LE,
 };
 
+/*
+ * Optional RX jitter buffer. Frames written by the client are queued with
+ * their arrival time and played out by a dedicated thread at the pcm
+ * period rate; the playout delay follows the measured arrival jitter.
+ */
+#define VOIP_JB_FRAME_DURATION_US   20000
+#define VOIP_JB_MAX_FRAMES          25    /* 500 ms */
+#define VOIP_JB_MIN_DELAY_FRAMES    1
+#define VOIP_JB_MAX_DELAY_FRAMES    10
+#define VOIP_JB_HEADROOM_FRAMES     2
+#define VOIP_JB_MAX_CONCEALED       3     /* then rebuffer */
+#define VOIP_JB_RX_PERIOD_COUNT     2
+
+struct voip_jitter_buffer {
+    bool enabled;
+    bool thread_running;
+    bool exit;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    struct pcm *pcm;
+
+    uint8_t *frames;        /* VOIP_JB_MAX_FRAMES * frame_size */
+    uint8_t *out_frame;
+    int64_t arrival_us[VOIP_JB_MAX_FRAMES];
+    size_t frame_size;
+    unsigned int head;
+    unsigned int count;
+
+    bool playing;
+    unsigned int target_delay;
+    unsigned int concealed_in_row;
+    int64_t last_arrival_us;
+    int64_t jitter_us;
+
+    /* statistics */
+    uint64_t frames_received;
+    uint64_t frames_played;
+    uint64_t frames_concealed;
+    uint64_t frames_dropped;
+    int64_t delay_sum_us;
+};
+
 struct voip_data {
     struct pcm *pcm_rx;
     struct pcm *pcm_tx;
@@ -62,6 +109,7 @@ struct voip_data {
     uint32_t out_stream_count;
     uint32_t in_stream_count;
     uint32_t sample_rate;
+    struct voip_jitter_buffer jb;
 };
 
 #define MODE_PCM                0xC
@@ -72,6 +120,12 @@ struct voip_data {
 #define AUDIO_PARAMETER_KEY_VOIP_CHECK              "voip_flag"
 #define AUDIO_PARAMETER_KEY_VOIP_OUT_STREAM_COUNT   "voip_out_stream_count"
 #define AUDIO_PARAMETER_KEY_VOIP_SAMPLE_RATE        "voip_sample_rate"
+#define AUDIO_PARAMETER_KEY_VOIP_JB_STATS           "voip_jb_stats"
+#define AUDIO_PARAMETER_KEY_VOIP_JB_DELAY           "voip_jb_delay_ms"
+#define AUDIO_PARAMETER_KEY_VOIP_JB_TARGET_DELAY    "voip_jb_target_delay_ms"
+#define AUDIO_PARAMETER_KEY_VOIP_JB_JITTER          "voip_jb_jitter_ms"
+#define AUDIO_PARAMETER_KEY_VOIP_JB_LOSS            "voip_jb_drop_permille"
+#define AUDIO_PARAMETER_KEY_VOIP_JB_CONCEALMENT     "voip_jb_conceal_permille"
 
 static struct voip_data voip_data = {
   .pcm_rx = NULL,
@@ -101,6 +155,249 @@ static int audio_format_to_voip_mode(int format)
     return mode;
 }
 
+typedef void (*voip_jb_conceal_t)(struct voip_jitter_buffer *jb, uint8_t *frame,
+                                  unsigned int concealed_in_row);
+
+/* Repeats the last played frame at -6dB per lost frame */
+static void voip_jb_conceal_repeat(struct voip_jitter_buffer *jb, uint8_t *frame,
+                                   unsigned int concealed_in_row)
+{
+    int16_t *samples = (int16_t *)frame;
+    size_t i;
+
+    for (i = 0; i < jb->frame_size / sizeof(int16_t); i++)
+        samples[i] = concealed_in_row < 16 ? samples[i] >> 1 : 0;
+}
+
+static voip_jb_conceal_t voip_jb_conceal = voip_jb_conceal_repeat;
+
+static bool voip_jb_prop_check()
+{
+    char prop_value[PROPERTY_VALUE_MAX] = {0};
+
+    property_get("use.voip.jitter.buffer", prop_value, "0");
+    return !strncmp("true", prop_value, sizeof("true"));
+}
+
+/* jb->lock held */
+static void voip_jb_update_jitter(struct voip_jitter_buffer *jb, int64_t now_us)
+{
+    int64_t deviation;
+    unsigned int target;
+
+    if (jb->last_arrival_us) {
+        deviation = now_us - jb->last_arrival_us - VOIP_JB_FRAME_DURATION_US;
+        if (deviation < 0)
+            deviation = -deviation;
+        /* RFC 3550 interarrival jitter estimate */
+        jb->jitter_us += (deviation - jb->jitter_us) / 16;
+    }
+    jb->last_arrival_us = now_us;
+
+    target = 1 + (unsigned int)((2 * jb->jitter_us + VOIP_JB_FRAME_DURATION_US - 1) /
+                                VOIP_JB_FRAME_DURATION_US);
+    if (target < VOIP_JB_MIN_DELAY_FRAMES)
+        target = VOIP_JB_MIN_DELAY_FRAMES;
+    else if (target > VOIP_JB_MAX_DELAY_FRAMES)
+        target = VOIP_JB_MAX_DELAY_FRAMES;
+    jb->target_delay = target;
+}
+
+/* jb->lock held */
+static void voip_jb_drop_oldest(struct voip_jitter_buffer *jb)
+{
+    jb->head = (jb->head + 1) % VOIP_JB_MAX_FRAMES;
+    jb->count--;
+    jb->frames_dropped++;
+}
+
+static void *voip_jb_thread_loop(void *context)
+{
+    struct voip_jitter_buffer *jb = (struct voip_jitter_buffer *)context;
+    int64_t now_us;
+
+    ALOGD("%s: enter", __func__);
+    pthread_mutex_lock(&jb->lock);
+    while (!jb->exit) {
+        if (!jb->playing && jb->count >= jb->target_delay)
+            jb->playing = true;
+
+        if (jb->playing && jb->count > 0) {
+            now_us = audio_extn_utils_get_time_us();
+            memcpy(jb->out_frame, jb->frames + jb->head * jb->frame_size,
+                   jb->frame_size);
+            jb->delay_sum_us += now_us - jb->arrival_us[jb->head];
+            jb->head = (jb->head + 1) % VOIP_JB_MAX_FRAMES;
+            jb->count--;
+            jb->frames_played++;
+            jb->concealed_in_row = 0;
+            /* shrink the queue back to target after a burst */
+            if (jb->count > jb->target_delay + VOIP_JB_HEADROOM_FRAMES)
+                voip_jb_drop_oldest(jb);
+        } else if (jb->playing) {
+            voip_jb_conceal(jb, jb->out_frame, jb->concealed_in_row++);
+            jb->frames_concealed++;
+            if (jb->concealed_in_row > VOIP_JB_MAX_CONCEALED)
+                jb->playing = false;
+        } else {
+            memset(jb->out_frame, 0, jb->frame_size);
+        }
+        pthread_cond_broadcast(&jb->cond);
+        pthread_mutex_unlock(&jb->lock);
+
+        /* blocks for one pcm period, which paces the playout */
+        if (pcm_write(jb->pcm, jb->out_frame, jb->frame_size) < 0) {
+            ALOGE("%s: pcm_write failed: %s", __func__, pcm_get_error(jb->pcm));
+            usleep(VOIP_JB_FRAME_DURATION_US);
+        }
+
+        pthread_mutex_lock(&jb->lock);
+    }
+    pthread_mutex_unlock(&jb->lock);
+    ALOGD("%s: exit", __func__);
+    return NULL;
+}
+
+static int voip_jb_start(struct voip_jitter_buffer *jb, struct pcm *pcm,
+                         size_t frame_size)
+{
+    jb->frames = calloc(VOIP_JB_MAX_FRAMES, frame_size);
+    jb->out_frame = calloc(1, frame_size);
+    if (!jb->frames || !jb->out_frame) {
+        ALOGE("%s: failed to allocate jitter buffer", __func__);
+        goto error;
+    }
+
+    jb->pcm = pcm;
+    jb->frame_size = frame_size;
+    jb->head = 0;
+    jb->count = 0;
+    jb->playing = false;
+    jb->target_delay = VOIP_JB_MIN_DELAY_FRAMES;
+    jb->concealed_in_row = 0;
+    jb->last_arrival_us = 0;
+    jb->jitter_us = 0;
+    jb->frames_received = 0;
+    jb->frames_played = 0;
+    jb->frames_concealed = 0;
+    jb->frames_dropped = 0;
+    jb->delay_sum_us = 0;
+    jb->exit = false;
+
+    pthread_mutex_init(&jb->lock, (const pthread_mutexattr_t *) NULL);
+    pthread_cond_init(&jb->cond, (const pthread_condattr_t *) NULL);
+    if (pthread_create(&jb->thread, (const pthread_attr_t *) NULL,
+                       voip_jb_thread_loop, jb) != 0) {
+        ALOGE("%s: failed to create playout thread", __func__);
+        pthread_cond_destroy(&jb->cond);
+        pthread_mutex_destroy(&jb->lock);
+        goto error;
+    }
+    jb->thread_running = true;
+    return 0;
+
+error:
+    free(jb->frames);
+    free(jb->out_frame);
+    jb->frames = NULL;
+    jb->out_frame = NULL;
+    return -ENOMEM;
+}
+
+static void voip_jb_stop(struct voip_jitter_buffer *jb)
+{
+    if (!jb->thread_running)
+        return;
+
+    pthread_mutex_lock(&jb->lock);
+    jb->exit = true;
+    pthread_cond_broadcast(&jb->cond);
+    pthread_mutex_unlock(&jb->lock);
+    pthread_join(jb->thread, (void **) NULL);
+    jb->thread_running = false;
+
+    ALOGD("%s: received %llu played %llu concealed %llu dropped %llu",
+          __func__, (unsigned long long)jb->frames_received,
+          (unsigned long long)jb->frames_played,
+          (unsigned long long)jb->frames_concealed,
+          (unsigned long long)jb->frames_dropped);
+
+    pthread_cond_destroy(&jb->cond);
+    pthread_mutex_destroy(&jb->lock);
+    free(jb->frames);
+    free(jb->out_frame);
+    jb->frames = NULL;
+    jb->out_frame = NULL;
+    jb->pcm = NULL;
+}
+
+/* Queues whole frames, waiting at most one frame time for room */
+static void voip_jb_write(struct voip_jitter_buffer *jb, const uint8_t *buffer,
+                          size_t bytes)
+{
+    struct timespec ts;
+    size_t copied;
+    unsigned int tail;
+    int64_t now_us;
+
+    pthread_mutex_lock(&jb->lock);
+    while (bytes > 0 && !jb->exit) {
+        if (jb->count >= jb->target_delay + VOIP_JB_HEADROOM_FRAMES) {
+            clock_gettime(CLOCK_REALTIME, &ts);
+            ts.tv_nsec += VOIP_JB_FRAME_DURATION_US * 1000;
+            if (ts.tv_nsec >= 1000000000) {
+                ts.tv_nsec -= 1000000000;
+                ts.tv_sec++;
+            }
+            pthread_cond_timedwait(&jb->cond, &jb->lock, &ts);
+        }
+        /* late frame policy: the oldest queued frame gives way */
+        if (jb->count == VOIP_JB_MAX_FRAMES)
+            voip_jb_drop_oldest(jb);
+
+        now_us = audio_extn_utils_get_time_us();
+        voip_jb_update_jitter(jb, now_us);
+
+        tail = (jb->head + jb->count) % VOIP_JB_MAX_FRAMES;
+        copied = bytes < jb->frame_size ? bytes : jb->frame_size;
+        memcpy(jb->frames + tail * jb->frame_size, buffer, copied);
+        if (copied < jb->frame_size)
+            memset(jb->frames + tail * jb->frame_size + copied, 0,
+                   jb->frame_size - copied);
+        jb->arrival_us[tail] = now_us;
+        jb->count++;
+        jb->frames_received++;
+
+        buffer += copied;
+        bytes -= copied;
+    }
+    pthread_mutex_unlock(&jb->lock);
+}
+
+static void voip_jb_get_stats(struct voip_jitter_buffer *jb, struct str_parms *reply)
+{
+    uint64_t total;
+
+    if (!jb->thread_running)
+        return;
+
+    pthread_mutex_lock(&jb->lock);
+    total = jb->frames_played + jb->frames_concealed;
+    str_parms_add_int(reply, AUDIO_PARAMETER_KEY_VOIP_JB_DELAY,
+                      jb->frames_played ?
+                      (int)(jb->delay_sum_us / (int64_t)jb->frames_played / 1000) : 0);
+    str_parms_add_int(reply, AUDIO_PARAMETER_KEY_VOIP_JB_TARGET_DELAY,
+                      jb->target_delay * VOIP_JB_FRAME_DURATION_US / 1000);
+    str_parms_add_int(reply, AUDIO_PARAMETER_KEY_VOIP_JB_JITTER,
+                      (int)(jb->jitter_us / 1000));
+    str_parms_add_int(reply, AUDIO_PARAMETER_KEY_VOIP_JB_LOSS,
+                      jb->frames_received ?
+                      (int)(jb->frames_dropped * 1000 / jb->frames_received) : 0);
+    str_parms_add_int(reply, AUDIO_PARAMETER_KEY_VOIP_JB_CONCEALMENT,
+                      total ? (int)(jb->frames_concealed * 1000 / total) : 0);
+    pthread_mutex_unlock(&jb->lock);
+}
+
 static int voip_set_volume(struct audio_device *adev, int volume)
 {
     struct mixer_ctl *ctl;
@@ -240,7 +537,8 @@ static int voip_stop_call(struct audio_device *adev)
         }
         voice_set_sidetone(adev, uc_info->out_snd_device, false);
 
-        /* 1. Close the PCM devices */
+        /* 1. Stop the rx playout thread and close the PCM devices */
+        voip_jb_stop(&voip_data.jb);
         if (voip_data.pcm_rx) {
             pcm_close(voip_data.pcm_rx);
             voip_data.pcm_rx = NULL;
@@ -274,6 +572,8 @@ static int voip_start_call(struct audio_device *adev,
     struct audio_usecase *uc_info;
     int pcm_dev_rx_id, pcm_dev_tx_id;
     unsigned int flags = PCM_OUT | PCM_MONOTONIC;
+    struct pcm_config rx_config = *voip_config;
+    struct pcm_config tx_config = *voip_config;
 
     ALOGD("%s: enter", __func__);
 
@@ -300,6 +600,16 @@ static int voip_start_call(struct audio_device *adev,
 
         select_devices(adev, USECASE_COMPRESS_VOIP_CALL);
 
+        /*
+         * With the HAL jitter buffer the queueing happens in the HAL, so keep
+         * the kernel rx buffer to a couple of periods and pace tx tightly.
+         */
+        voip_data.jb.enabled = voip_jb_prop_check();
+        if (voip_data.jb.enabled) {
+            rx_config.period_count = VOIP_JB_RX_PERIOD_COUNT;
+            tx_config.period_count = COMPRESS_VOIP_TX_PERIOD_COUNT;
+        }
+
         pcm_dev_rx_id = platform_get_pcm_device_id(uc_info->id, PCM_PLAYBACK);
         pcm_dev_tx_id = platform_get_pcm_device_id(uc_info->id, PCM_CAPTURE);
 
@@ -312,9 +622,10 @@ static int voip_start_call(struct audio_device *adev,
 
         ALOGD("%s: Opening PCM capture device card_id(%d) device_id(%d)",
               __func__, adev->snd_card, pcm_dev_tx_id);
+        ROUTING_STATS_INC(adev, pcm_opens);
         voip_data.pcm_tx = pcm_open(adev->snd_card,
                                     pcm_dev_tx_id,
-                                    PCM_IN, voip_config);
+                                    PCM_IN, &tx_config);
         if (voip_data.pcm_tx && !pcm_is_ready(voip_data.pcm_tx)) {
             ALOGE("%s: %s", __func__, pcm_get_error(voip_data.pcm_tx));
             pcm_close(voip_data.pcm_tx);
@@ -325,9 +636,10 @@ static int voip_start_call(struct audio_device *adev,
 
         ALOGD("%s: Opening PCM playback device card_id(%d) device_id(%d)",
               __func__, adev->snd_card, pcm_dev_rx_id);
+        ROUTING_STATS_INC(adev, pcm_opens);
         voip_data.pcm_rx = pcm_open(adev->snd_card,
                                     pcm_dev_rx_id,
-                                    flags, voip_config);
+                                    flags, &rx_config);
         if (voip_data.pcm_rx && !pcm_is_ready(voip_data.pcm_rx)) {
             ALOGE("%s: %s", __func__, pcm_get_error(voip_data.pcm_rx));
             pcm_close(voip_data.pcm_rx);
@@ -343,6 +655,14 @@ static int voip_start_call(struct audio_device *adev,
         pcm_start(voip_data.pcm_tx);
         pcm_start(voip_data.pcm_rx);
 
+        if (voip_data.jb.enabled &&
+            voip_jb_start(&voip_data.jb, voip_data.pcm_rx,
+                          rx_config.period_size * rx_config.channels *
+                          sizeof(int16_t)) < 0) {
+            ALOGW("%s: jitter buffer unavailable, writing rx directly", __func__);
+            voip_data.jb.enabled = false;
+        }
+
         voice_set_sidetone(adev, uc_info->out_snd_device, true);
         voice_extn_compress_voip_set_volume(adev, adev->voice.volume);
     } else {
@@ -398,6 +718,14 @@ done:
     return ret;
 }
 
+int voice_extn_compress_voip_get_state(uint32_t *out_stream_count,
+                                       uint32_t *sample_rate)
+{
+    *out_stream_count = voip_data.out_stream_count;
+    *sample_rate = voip_data.sample_rate;
+    return 0;
+}
+
 void voice_extn_compress_voip_get_parameters(struct str_parms *query,
                                              struct str_parms *reply)
 {
@@ -438,6 +766,10 @@ void voice_extn_compress_voip_out_get_parameters(struct stream_out *out,
             str_parms_add_int(reply, AUDIO_PARAMETER_KEY_VOIP_CHECK, false);
     }
 
+    ret = str_parms_get_str(query, AUDIO_PARAMETER_KEY_VOIP_JB_STATS, value, sizeof(value));
+    if (ret >= 0 && out->usecase == USECASE_COMPRESS_VOIP_CALL)
+        voip_jb_get_stats(&voip_data.jb, reply);
+
     ALOGV("%s: exit", __func__);
 }
 
@@ -465,6 +797,38 @@ void voice_extn_compress_voip_in_get_parameters(struct stream_in *in,
     free(kv_pairs);
 }
 
+int voice_extn_compress_voip_out_write(struct stream_out *out, const void *buffer,
+                                       size_t bytes)
+{
+    if (voip_data.jb.thread_running && out->pcm == voip_data.pcm_rx) {
+        voip_jb_write(&voip_data.jb, (const uint8_t *)buffer, bytes);
+        return 0;
+    }
+
+    return pcm_write(out->pcm, (void *)buffer, bytes);
+}
+
+/*
+ * Frames accepted by voice_extn_compress_voip_out_write() that the playout
+ * thread has not written to the pcm yet. Called with out->lock held, which
+ * keeps the rx pcm and the jitter buffer alive.
+ */
+uint32_t voice_extn_compress_voip_out_get_queued_frames(struct stream_out *out)
+{
+    struct voip_jitter_buffer *jb = &voip_data.jb;
+    size_t frame_bytes = audio_stream_out_frame_size(&out->stream);
+    size_t queued_bytes;
+
+    if (!jb->thread_running || out->pcm != voip_data.pcm_rx || frame_bytes == 0)
+        return 0;
+
+    pthread_mutex_lock(&jb->lock);
+    queued_bytes = jb->count * jb->frame_size;
+    pthread_mutex_unlock(&jb->lock);
+
+    return queued_bytes / frame_bytes;
+}
+
 int voice_extn_compress_voip_out_get_buffer_size(struct stream_out *out)
 {
     if (out->config.rate == 16000)
@@ -22,6 +22,7 @@
 #define LOG_NDDEBUG 0
 
 #include <errno.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <math.h>
 #include <cutils/log.h>
@@ -33,6 +34,7 @@
 #include "voice.h"
 #include "platform.h"
 #include "platform_api.h"
+#include "audio_extn.h"
 #include "voice_extn.h"
 
 #define AUDIO_PARAMETER_KEY_VSID                "vsid"
@@ -144,139 +146,236 @@ static uint32_t get_session_id_with_state(struct audio_device *adev,
     return session_id;
 }
 
+enum call_action {
+    CALL_ACTION_INVALID = 0,
+    CALL_ACTION_NONE,       /* state bookkeeping only */
+    CALL_ACTION_STOP,
+    CALL_ACTION_LCH_START,
+    CALL_ACTION_LCH_STOP,
+    CALL_ACTION_START,
+};
+
+#define NUM_CALL_STATES (CALL_LOCAL_HOLD - BASE_CALL_STATE + 1)
+#define CALL_STATE_IDX(state) ((state) - BASE_CALL_STATE)
+
+/* action for [current][new] call state, CALL_ACTION_INVALID if not allowed */
+static const enum call_action call_transitions[NUM_CALL_STATES][NUM_CALL_STATES] = {
+    [CALL_STATE_IDX(CALL_INACTIVE)] = {
+        [CALL_STATE_IDX(CALL_ACTIVE)]     = CALL_ACTION_START,
+    },
+    [CALL_STATE_IDX(CALL_ACTIVE)] = {
+        [CALL_STATE_IDX(CALL_INACTIVE)]   = CALL_ACTION_STOP,
+        [CALL_STATE_IDX(CALL_HOLD)]       = CALL_ACTION_NONE,
+        [CALL_STATE_IDX(CALL_LOCAL_HOLD)] = CALL_ACTION_LCH_START,
+    },
+    [CALL_STATE_IDX(CALL_HOLD)] = {
+        [CALL_STATE_IDX(CALL_INACTIVE)]   = CALL_ACTION_STOP,
+        [CALL_STATE_IDX(CALL_ACTIVE)]     = CALL_ACTION_NONE,
+        [CALL_STATE_IDX(CALL_LOCAL_HOLD)] = CALL_ACTION_LCH_START,
+    },
+    [CALL_STATE_IDX(CALL_LOCAL_HOLD)] = {
+        [CALL_STATE_IDX(CALL_INACTIVE)]   = CALL_ACTION_STOP,
+        [CALL_STATE_IDX(CALL_ACTIVE)]     = CALL_ACTION_LCH_STOP,
+        [CALL_STATE_IDX(CALL_HOLD)]       = CALL_ACTION_LCH_STOP,
+    },
+};
+
+struct call_plan_entry {
+    int session_idx;
+    enum call_action action;
+};
+
+/* Last transitions executed, for dumpsys */
+#define MAX_CALL_TRANSITION_RECORDS 16
+struct call_transition_record {
+    uint32_t vsid;
+    int from;
+    int to;
+    int ret;
+    int64_t duration_us;
+};
+
+static struct call_transition_record call_transition_records[MAX_CALL_TRANSITION_RECORDS];
+static unsigned int call_transition_count;
+
+static enum call_action get_call_action(int current, int new)
+{
+    if (!is_valid_call_state(current) || !is_valid_call_state(new))
+        return CALL_ACTION_INVALID;
+    return call_transitions[CALL_STATE_IDX(current)][CALL_STATE_IDX(new)];
+}
+
+/*
+ * Computes the transitions of all sessions for one update, ordered so
+ * that sessions going down release their devices before others come up,
+ * and a local hold is applied before the held session is resumed on a
+ * swap between subscriptions.
+ */
+static int plan_calls(struct audio_device *adev, struct call_plan_entry *plan)
+{
+    struct voice_session *session;
+    enum call_action action;
+    int count = 0;
+    int i;
+
+    for (action = CALL_ACTION_NONE; action <= CALL_ACTION_START; action++) {
+        for (i = 0; i < MAX_VOICE_SESSIONS; i++) {
+            session = &adev->voice.session[i];
+            if (session->state.current == session->state.new)
+                continue;
+            if (get_call_action(session->state.current,
+                                session->state.new) != action)
+                continue;
+            plan[count].session_idx = i;
+            plan[count].action = action;
+            count++;
+        }
+    }
+    return count;
+}
+
+static int execute_call_action(struct audio_device *adev, int session_idx,
+                               enum call_action action)
+{
+    struct voice_session *session = &adev->voice.session[session_idx];
+    audio_usecase_t usecase_id = voice_extn_get_usecase_for_session_idx(session_idx);
+    int ret = 0;
+
+    switch (action) {
+    case CALL_ACTION_STOP:
+        ret = voice_stop_usecase(adev, usecase_id);
+        if (ret < 0)
+            ALOGE("%s: voice_stop_usecase() failed for usecase: %d\n",
+                  __func__, usecase_id);
+        break;
+
+    case CALL_ACTION_LCH_START:
+    case CALL_ACTION_LCH_STOP:
+        ret = platform_update_lch(adev->platform, session,
+                                  action == CALL_ACTION_LCH_START ?
+                                  VOICE_LCH_START : VOICE_LCH_STOP);
+        if (ret < 0)
+            ALOGE("%s: lch mode update failed, ret = %d", __func__, ret);
+        break;
+
+    default:
+        break;
+    }
+    return ret;
+}
+
+/* Starts the sessions of plan[0..count) with one routing pass */
+static void start_calls(struct audio_device *adev,
+                        const struct call_plan_entry *plan, int *status,
+                        int count)
+{
+    audio_usecase_t usecase_ids[MAX_VOICE_SESSIONS];
+    int i;
+
+    for (i = 0; i < count; i++)
+        usecase_ids[i] = voice_extn_get_usecase_for_session_idx(plan[i].session_idx);
+
+    if (voice_start_usecases(adev, usecase_ids, status, count) < 0) {
+        for (i = 0; i < count; i++)
+            if (status[i] < 0)
+                ALOGE("%s: voice_start_usecase() failed for usecase: %d\n",
+                      __func__, usecase_ids[i]);
+    }
+}
+
+static void record_call_transition(const struct voice_session *session,
+                                   int from, int ret, int64_t duration_us)
+{
+    struct call_transition_record *record;
+
+    record = &call_transition_records[call_transition_count++ %
+                                      MAX_CALL_TRANSITION_RECORDS];
+    record->vsid = session->vsid;
+    record->from = from;
+    record->to = session->state.new;
+    record->duration_us = duration_us;
+    record->ret = ret;
+
+    ALOGD("%s: %d -> %d vsid:%x took %lld us, ret %d", __func__,
+          record->from, record->to, record->vsid,
+          (long long)record->duration_us, ret);
+}
+
 static int update_calls(struct audio_device *adev)
 {
-    int i = 0;
-    audio_usecase_t usecase_id = 0;
-    enum voice_lch_mode lch_mode;
+    struct call_plan_entry plan[MAX_VOICE_SESSIONS];
+    int from[MAX_VOICE_SESSIONS];
+    int status[MAX_VOICE_SESSIONS];
     struct voice_session *session = NULL;
-    int fd = 0;
+    int64_t start_us, duration_us;
+    int count, first_start, i;
     int ret = 0;
 
     ALOGD("%s: enter:", __func__);
 
     for (i = 0; i < MAX_VOICE_SESSIONS; i++) {
-        usecase_id = voice_extn_get_usecase_for_session_idx(i);
         session = &adev->voice.session[i];
         ALOGD("%s: cur_state=%d new_state=%d vsid=%x",
               __func__, session->state.current, session->state.new, session->vsid);
+        if (session->state.current != session->state.new &&
+            get_call_action(session->state.current, session->state.new) ==
+            CALL_ACTION_INVALID)
+            ALOGV("%s: state %d cannot be handled in state=%d vsid:%x",
+                  __func__, session->state.new, session->state.current,
+                  session->vsid);
+    }
 
-        switch(session->state.new)
-        {
-        case CALL_ACTIVE:
-            switch(session->state.current)
-            {
-            case CALL_INACTIVE:
-                ALOGD("%s: INACTIVE -> ACTIVE vsid:%x", __func__, session->vsid);
-                ret = voice_start_usecase(adev, usecase_id);
-                if(ret < 0) {
-                    ALOGE("%s: voice_start_usecase() failed for usecase: %d\n",
-                          __func__, usecase_id);
-                } else {
-                    session->state.current = session->state.new;
-                }
-                break;
-
-            case CALL_HOLD:
-                ALOGD("%s: HOLD -> ACTIVE vsid:%x", __func__, session->vsid);
-                session->state.current = session->state.new;
-                break;
-
-            case CALL_LOCAL_HOLD:
-                ALOGD("%s: LOCAL_HOLD -> ACTIVE vsid:%x", __func__, session->vsid);
-                lch_mode = VOICE_LCH_STOP;
-                ret = platform_update_lch(adev->platform, session, lch_mode);
-                if (ret < 0)
-                    ALOGE("%s: lch mode update failed, ret = %d", __func__, ret);
-                else
-                    session->state.current = session->state.new;
-                break;
-
-            default:
-                ALOGV("%s: CALL_ACTIVE cannot be handled in state=%d vsid:%x",
-                      __func__, session->state.current, session->vsid);
-                break;
-            }
-            break;
-
-        case CALL_INACTIVE:
-            switch(session->state.current)
-            {
-            case CALL_ACTIVE:
-            case CALL_HOLD:
-            case CALL_LOCAL_HOLD:
-                ALOGD("%s: ACTIVE/HOLD/LOCAL_HOLD -> INACTIVE vsid:%x", __func__, session->vsid);
-                ret = voice_stop_usecase(adev, usecase_id);
-                if(ret < 0) {
-                    ALOGE("%s: voice_stop_usecase() failed for usecase: %d\n",
-                          __func__, usecase_id);
-                } else {
-                    session->state.current = session->state.new;
-                }
-                break;
-
-            default:
-                ALOGV("%s: CALL_INACTIVE cannot be handled in state=%d vsid:%x",
-                      __func__, session->state.current, session->vsid);
-                break;
-            }
-            break;
+    count = plan_calls(adev, plan);
+
+    /* stops, then the LCH updates, one session at a time */
+    for (i = 0; i < count && plan[i].action != CALL_ACTION_START; i++) {
+        session = &adev->voice.session[plan[i].session_idx];
+        from[i] = session->state.current;
+        start_us = audio_extn_utils_get_time_us();
+        ret = execute_call_action(adev, plan[i].session_idx, plan[i].action);
+        record_call_transition(session, from[i], ret,
+                               audio_extn_utils_get_time_us() - start_us);
+        if (ret >= 0)
+            session->state.current = session->state.new;
+    }
 
-        case CALL_HOLD:
-            switch(session->state.current)
-            {
-            case CALL_ACTIVE:
-                ALOGD("%s: CALL_ACTIVE -> HOLD vsid:%x", __func__, session->vsid);
+    /* starts are planned last, bring them all up in one routing pass */
+    first_start = i;
+    if (first_start < count) {
+        for (i = first_start; i < count; i++)
+            from[i] = adev->voice.session[plan[i].session_idx].state.current;
+        start_us = audio_extn_utils_get_time_us();
+        start_calls(adev, &plan[first_start], &status[first_start],
+                    count - first_start);
+        duration_us = audio_extn_utils_get_time_us() - start_us;
+        for (i = first_start; i < count; i++) {
+            session = &adev->voice.session[plan[i].session_idx];
+            ret = status[i];
+            record_call_transition(session, from[i], ret, duration_us);
+            if (ret >= 0)
                 session->state.current = session->state.new;
-                break;
-
-            case CALL_LOCAL_HOLD:
-                ALOGD("%s: CALL_LOCAL_HOLD -> HOLD vsid:%x", __func__, session->vsid);
-                lch_mode = VOICE_LCH_STOP;
-                ret = platform_update_lch(adev->platform, session, lch_mode);
-                if (ret < 0)
-                    ALOGE("%s: lch mode update failed, ret = %d", __func__, ret);
-                else
-                    session->state.current = session->state.new;
-                break;
-
-            default:
-                ALOGV("%s: CALL_HOLD cannot be handled in state=%d vsid:%x",
-                      __func__, session->state.current, session->vsid);
-                break;
-            }
-            break;
-
-        case CALL_LOCAL_HOLD:
-            switch(session->state.current)
-            {
-            case CALL_ACTIVE:
-            case CALL_HOLD:
-                ALOGD("%s: ACTIVE/CALL_HOLD -> LOCAL_HOLD vsid:%x", __func__,
-                      session->vsid);
-                lch_mode = VOICE_LCH_START;
-                ret = platform_update_lch(adev->platform, session, lch_mode);
-                if (ret < 0)
-                    ALOGE("%s: lch mode update failed, ret = %d", __func__, ret);
-                else
-                    session->state.current = session->state.new;
-                break;
-
-            default:
-                ALOGV("%s: CALL_LOCAL_HOLD cannot be handled in state=%d vsid:%x",
-                      __func__, session->state.current, session->vsid);
-                break;
-            }
-            break;
-
-        default:
-            break;
-        } //end out switch loop
-    } //end for loop
+        }
+    }
 
     return ret;
 }
 
+void voice_extn_dump(const struct audio_device *adev __unused, int fd)
+{
+    struct call_transition_record *record;
+    unsigned int first, i;
+
+    dprintf(fd, "  Voice call transitions (last %d):\n", MAX_CALL_TRANSITION_RECORDS);
+    first = call_transition_count > MAX_CALL_TRANSITION_RECORDS ?
+            call_transition_count - MAX_CALL_TRANSITION_RECORDS : 0;
+    for (i = first; i < call_transition_count; i++) {
+        record = &call_transition_records[i % MAX_CALL_TRANSITION_RECORDS];
+        dprintf(fd, "    vsid 0x%x: %d -> %d, %lld us, ret %d\n",
+                record->vsid, record->from, record->to,
+                (long long)record->duration_us, record->ret);
+    }
+}
+
 static int update_call_states(struct audio_device *adev,
                                     const uint32_t vsid, const int call_state)
 {
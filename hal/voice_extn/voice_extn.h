@@ -42,6 +42,7 @@ void voice_extn_in_get_parameters(struct stream_in *in,
 void voice_extn_out_get_parameters(struct stream_out *out,
                                    struct str_parms *query,
                                    struct str_parms *reply);
+void voice_extn_dump(const struct audio_device *adev, int fd);
 #else
 static int voice_extn_start_call(struct audio_device *adev __unused)
 {
@@ -99,6 +100,11 @@ static void voice_extn_out_get_parameters(struct stream_out *out __unused,
                                           struct str_parms *reply __unused)
 {
 }
+
+static void voice_extn_dump(const struct audio_device *adev __unused,
+                            int fd __unused)
+{
+}
 #endif
 
 #ifdef INCALL_MUSIC_ENABLED
@@ -119,7 +125,10 @@ int voice_extn_compress_voip_open_output_stream(struct stream_out *out);
 int voice_extn_compress_voip_close_input_stream(struct audio_stream *stream);
 int voice_extn_compress_voip_open_input_stream(struct stream_in *in);
 
+int voice_extn_compress_voip_out_write(struct stream_out *out, const void *buffer,
+                                       size_t bytes);
 int voice_extn_compress_voip_out_get_buffer_size(struct stream_out *out);
+uint32_t voice_extn_compress_voip_out_get_queued_frames(struct stream_out *out);
 int voice_extn_compress_voip_in_get_buffer_size(struct stream_in *in);
 
 int voice_extn_compress_voip_start_input_stream(struct stream_in *in);
@@ -147,6 +156,8 @@ bool voice_extn_compress_voip_is_active(struct audio_device *adev);
 bool voice_extn_compress_voip_is_format_supported(audio_format_t format);
 bool voice_extn_compress_voip_is_config_supported(struct audio_config *config);
 bool voice_extn_compress_voip_is_started(struct audio_device *adev);
+int voice_extn_compress_voip_get_state(uint32_t *out_stream_count,
+                                       uint32_t *sample_rate);
 #else
 static int voice_extn_compress_voip_close_output_stream(struct audio_stream *stream __unused)
 {
@@ -172,6 +183,17 @@ static int voice_extn_compress_voip_open_input_stream(struct stream_in *in __unu
     return -ENOSYS;
 }
 
+static int voice_extn_compress_voip_out_write(struct stream_out *out,
+                                              const void *buffer, size_t bytes)
+{
+    return pcm_write(out->pcm, (void *)buffer, bytes);
+}
+
+static uint32_t voice_extn_compress_voip_out_get_queued_frames(struct stream_out *out __unused)
+{
+    return 0;
+}
+
 static int voice_extn_compress_voip_out_get_buffer_size(struct stream_out *stream __unused)
 {
     ALOGE("%s: COMPRESS_VOIP_ENABLED is not defined", __func__);
@@ -278,6 +300,12 @@ static bool voice_extn_compress_voip_is_started(struct audio_device *adev __unus
     ALOGE("%s: COMPRESS_VOIP_ENABLED is not defined", __func__);
     return false;
 }
+
+static int voice_extn_compress_voip_get_state(uint32_t *out_stream_count __unused,
+                                              uint32_t *sample_rate __unused)
+{
+    return -ENOSYS;
+}
 #endif
 
 #endif //VOICE_EXTN_H
@@ -59,6 +59,10 @@ ifeq ($(strip $(AUDIO_FEATURE_ENABLED_FM_POWER_OPT)),true)
 LOCAL_CFLAGS += -DFM_POWER_OPT
 endif
 
+ifneq ($(TARGET_BUILD_VARIANT),user)
+LOCAL_CFLAGS += -DAUDIO_POLICY_INDEX_CHECK
+endif
+
 LOCAL_MODULE := libaudiopolicymanager
 
 include $(BUILD_SHARED_LIBRARY)
@@ -37,8 +37,11 @@
 
 #include <inttypes.h>
 #include <math.h>
+#include <stdio.h>
+#include <unistd.h>
 
 #include <cutils/properties.h>
+#include <sys/system_properties.h>
 #include <utils/Log.h>
 #include <hardware/audio.h>
 #include <hardware/audio_effect.h>
@@ -76,6 +79,78 @@ audio_output_flags_t AudioPolicyManagerCustom::getFallBackPath()
     return flag;
 }
 #endif /*VOICE_CONCURRENCY*/
+
+static bool property_enabled(const char *name)
+{
+    char propValue[PROPERTY_VALUE_MAX];
+
+    if (!property_get(name, propValue, NULL))
+        return false;
+    return atoi(propValue) || !strncmp("true", propValue, 4);
+}
+
+const AudioPolicyManagerCustom::PolicyConfig& AudioPolicyManagerCustom::policyConfig()
+{
+    // the property area serial is bumped on every property change, so a matching serial
+    // means none of the watched properties can have changed since the last load
+    uint32_t serial = __system_property_area_serial();
+    char propValue[PROPERTY_VALUE_MAX];
+
+    if (mPolicyConfigValid && (serial == mPolicyConfigSerial))
+        return mPolicyConfig;
+
+    mPolicyConfig.voicePlaybackConcDisabled = property_enabled("voice.playback.conc.disabled");
+    mPolicyConfig.voiceRecordConcDisabled = property_enabled("voice.record.conc.disabled");
+    mPolicyConfig.voiceVoipConcDisabled = property_enabled("voice.voip.conc.disabled");
+    mPolicyConfig.recPlaybackConcDisabled = property_enabled("rec.playback.conc.disabled");
+    mPolicyConfig.pcm16BitOffloadEnabled = property_enabled("audio.offload.pcm.16bit.enable");
+    mPolicyConfig.pcm24BitOffloadEnabled = property_enabled("audio.offload.pcm.24bit.enable");
+
+    property_get("audio.offload.disable", propValue, "0");
+    mPolicyConfig.offloadDisabled = (atoi(propValue) != 0);
+
+    mPolicyConfig.offloadWithVideo =
+            property_get_bool("audio.offload.video", false /* default_value */);
+    mPolicyConfig.streamingOffloadWithVideo =
+            property_get_bool("av.streaming.offload.enable", false /* default_value */);
+    mPolicyConfig.pcmOffloadTrack =
+            property_get_bool("audio.offload.track.enable", false /* default_value */);
+    mPolicyConfig.deepBufferMedia =
+            property_get_bool("audio.deep_buffer.media", false /* default_value */);
+
+    property_get("use.voice.path.for.pcm.voip", propValue, "0");
+    mPolicyConfig.voipPcmUseVoicePath = !strncmp("true", propValue, sizeof("true"));
+
+    if (property_get("audio.offload.min.duration.secs", propValue, NULL))
+        mPolicyConfig.offloadMinDurationSecs = atoi(propValue);
+    else
+        mPolicyConfig.offloadMinDurationSecs = -1;
+
+    ALOGV("policyConfig() reloaded, property serial %u -> %u", mPolicyConfigSerial, serial);
+    mPolicyConfigSerial = serial;
+    mPolicyConfigValid = true;
+    invalidateOutputDecisions();
+    return mPolicyConfig;
+}
+
+AudioPolicyManagerCustom::OutputDecisionKey::OutputDecisionKey(audio_devices_t device,
+        audio_stream_type_t stream, uint32_t samplingRate, audio_format_t format,
+        audio_channel_mask_t channelMask, audio_output_flags_t flags,
+        const audio_offload_info_t *offloadInfo, bool recPlayActive)
+    : device(device), stream(stream), samplingRate(samplingRate), format(format),
+      channelMask(channelMask), flags(flags),
+      offloadUsage(offloadInfo != NULL ? (uint32_t)offloadInfo->usage + 1 : 0),
+      recPlayActive(recPlayActive)
+{
+}
+
+void AudioPolicyManagerCustom::invalidateOutputDecisions()
+{
+    if (mOutputDecisions.isEmpty())
+        return;
+    mOutputDecisions.clear();
+    mOutputDecisionInvalidations++;
+}
 // ----------------------------------------------------------------------------
 // AudioPolicyInterface implementation
 // ----------------------------------------------------------------------------
@@ -98,6 +173,8 @@ status_t AudioPolicyManagerCustom::setDeviceConnectionStateInt(audio_devices_t d
     ALOGV("setDeviceConnectionStateInt() device: 0x%X, state %d, address %s name %s",
             device, state, device_address, device_name);
 
+    invalidateOutputDecisions();
+
     // connect/disconnect only 1 device at a time
     if (!audio_is_output_device(device) && !audio_is_input_device(device)) return BAD_VALUE;
 
@@ -162,9 +239,11 @@ status_t AudioPolicyManagerCustom::setDeviceConnectionStateInt(audio_devices_t d
             }
 
             if (checkOutputsForDevice(devDesc, state, outputs, devDesc->mAddress) != NO_ERROR) {
+                invalidateOutputIndex();
                 mAvailableOutputDevices.remove(devDesc);
                 return INVALID_OPERATION;
             }
+            invalidateOutputIndex();
             // Propagate device availability to Engine
             mEngine->setDeviceConnectionState(devDesc, state);
 
@@ -215,6 +294,7 @@ status_t AudioPolicyManagerCustom::setDeviceConnectionStateInt(audio_devices_t d
             }
 #endif
             checkOutputsForDevice(devDesc, state, outputs, devDesc->mAddress);
+            invalidateOutputIndex();
 
             // Propagate device availability to Engine
             mEngine->setDeviceConnectionState(devDesc, state);
@@ -239,6 +319,7 @@ status_t AudioPolicyManagerCustom::setDeviceConnectionStateInt(audio_devices_t d
                         (((desc->mFlags & AUDIO_OUTPUT_FLAG_DIRECT) != 0) &&
                          (desc->mDirectOpenCount == 0))) {
                     closeOutput(outputs[i]);
+                    invalidateOutputIndex();
                 }
             }
             // check again after closing A2DP output to reset mA2dpSuspended if needed
@@ -376,28 +457,18 @@ bool AudioPolicyManagerCustom::isOffloadSupported(const audio_offload_info_t& of
      offloadInfo.format,
      offloadInfo.stream_type, offloadInfo.bit_rate, offloadInfo.duration_us,
      offloadInfo.has_video);
+    const PolicyConfig& config = policyConfig();
 #ifdef VOICE_CONCURRENCY
-    char concpropValue[PROPERTY_VALUE_MAX];
-    if (property_get("voice.playback.conc.disabled", concpropValue, NULL)) {
-         bool propenabled = atoi(concpropValue) || !strncmp("true", concpropValue, 4);
-         if (propenabled) {
-            if (isInCall())
-            {
-                ALOGD("\n copl: blocking  compress offload on call mode\n");
-                return false;
-            }
-         }
+    if (config.voicePlaybackConcDisabled) {
+        if (isInCall())
+        {
+            ALOGD("\n copl: blocking  compress offload on call mode\n");
+            return false;
+        }
     }
 #endif
 #ifdef RECORD_PLAY_CONCURRENCY
-    char recConcPropValue[PROPERTY_VALUE_MAX];
-    bool prop_rec_play_enabled = false;
-
-    if (property_get("rec.playback.conc.disabled", recConcPropValue, NULL)) {
-        prop_rec_play_enabled = atoi(recConcPropValue) || !strncmp("true", recConcPropValue, 4);
-    }
-
-    if ((prop_rec_play_enabled) &&
+    if ((config.recPlaybackConcDisabled) &&
          ((true == mIsInputRequestOnProgress) || (mInputs.activeInputsCount() > 0))) {
         ALOGD("copl: blocking  compress offload for record concurrency");
         return false;
@@ -410,20 +481,17 @@ bool AudioPolicyManagerCustom::isOffloadSupported(const audio_offload_info_t& of
         return false;
     }
 
-    char propValue[PROPERTY_VALUE_MAX];
     bool pcmOffload = false;
 #ifdef PCM_OFFLOAD_ENABLED
     if ((offloadInfo.format & AUDIO_FORMAT_MAIN_MASK) == AUDIO_FORMAT_PCM_OFFLOAD) {
         bool prop_enabled = false;
-        if ((AUDIO_FORMAT_PCM_16_BIT_OFFLOAD == offloadInfo.format) &&
-               property_get("audio.offload.pcm.16bit.enable", propValue, NULL)) {
-            prop_enabled = atoi(propValue) || !strncmp("true", propValue, 4);
+        if (AUDIO_FORMAT_PCM_16_BIT_OFFLOAD == offloadInfo.format) {
+            prop_enabled = config.pcm16BitOffloadEnabled;
         }
 
 #ifdef PCM_OFFLOAD_ENABLED_24
-        if ((AUDIO_FORMAT_PCM_24_BIT_OFFLOAD == offloadInfo.format) &&
-               property_get("audio.offload.pcm.24bit.enable", propValue, NULL)) {
-            prop_enabled = atoi(propValue) || !strncmp("true", propValue, 4);
+        if (AUDIO_FORMAT_PCM_24_BIT_OFFLOAD == offloadInfo.format) {
+            prop_enabled = config.pcm24BitOffloadEnabled;
         }
 #endif
 
@@ -440,11 +508,9 @@ bool AudioPolicyManagerCustom::isOffloadSupported(const audio_offload_info_t& of
 #endif
     if (!pcmOffload) {
         // Check if offload has been disabled
-        if (property_get("audio.offload.disable", propValue, "0")) {
-            if (atoi(propValue) != 0) {
-                ALOGV("offload disabled by audio.offload.disable=%s", propValue );
-                return false;
-            }
+        if (config.offloadDisabled) {
+            ALOGV("offload disabled by audio.offload.disable");
+            return false;
         }
         //check if it's multi-channel AAC (includes sub formats) and FLAC format
         if ((popcount(offloadInfo.channel_mask) > 2) &&
@@ -466,26 +532,23 @@ bool AudioPolicyManagerCustom::isOffloadSupported(const audio_offload_info_t& of
         }
 #endif
         //TODO: enable audio offloading with video when ready
-        const bool allowOffloadWithVideo =
-                property_get_bool("audio.offload.video", false /* default_value */);
-        if (offloadInfo.has_video && !allowOffloadWithVideo) {
+        if (offloadInfo.has_video && !config.offloadWithVideo) {
             ALOGV("isOffloadSupported: has_video == true, returning false");
             return false;
         }
 
-        const bool allowOffloadStreamingWithVideo = property_get_bool("av.streaming.offload.enable",
-                                                                   false /*default value*/);
-        if(offloadInfo.has_video && offloadInfo.is_streaming && !allowOffloadStreamingWithVideo) {
-            ALOGW("offload disabled by av.streaming.offload.enable = %s ", propValue );
+        if(offloadInfo.has_video && offloadInfo.is_streaming && !config.streamingOffloadWithVideo) {
+            ALOGW("offload disabled by av.streaming.offload.enable");
             return false;
         }
 
     }
 
     //If duration is less than minimum value defined in property, return false
-    if (property_get("audio.offload.min.duration.secs", propValue, NULL)) {
-        if (offloadInfo.duration_us < (atoi(propValue) * 1000000 )) {
-            ALOGV("Offload denied by duration < audio.offload.min.duration.secs(=%s)", propValue);
+    if (config.offloadMinDurationSecs >= 0) {
+        if (offloadInfo.duration_us < (config.offloadMinDurationSecs * 1000000 )) {
+            ALOGV("Offload denied by duration < audio.offload.min.duration.secs(=%d)",
+                  config.offloadMinDurationSecs);
             return false;
         }
     } else if (offloadInfo.duration_us < OFFLOAD_DEFAULT_MIN_DURATION_SECS * 1000000) {
@@ -536,6 +599,30 @@ bool AudioPolicyManagerCustom::isOffloadSupported(const audio_offload_info_t& of
     ALOGV("isOffloadSupported() profile %sfound", profile != 0 ? "" : "NOT ");
     return (profile != 0);
 }
+void AudioPolicyManagerCustom::setForceUse(audio_policy_force_use_t usage,
+                                           audio_policy_forced_cfg_t config)
+{
+    AudioPolicyManager::setForceUse(usage, config);
+    invalidateOutputDecisions();
+}
+
+status_t AudioPolicyManagerCustom::dump(int fd)
+{
+    const size_t SIZE = 256;
+    char buffer[SIZE];
+    uint32_t lookups = mOutputDecisionHits + mOutputDecisionMisses;
+
+    AudioPolicyManager::dump(fd);
+
+    snprintf(buffer, SIZE, "\nOutput decision cache:\n"
+             " Entries: %zu\n Hits: %u\n Misses: %u\n Hit rate: %u%%\n Invalidations: %u\n",
+             mOutputDecisions.size(), mOutputDecisionHits, mOutputDecisionMisses,
+             lookups ? (uint32_t)(((uint64_t)mOutputDecisionHits * 100) / lookups) : 0,
+             mOutputDecisionInvalidations);
+    write(fd, buffer, strlen(buffer));
+    return NO_ERROR;
+}
+
 audio_devices_t AudioPolicyManagerCustom::getNewOutputDevice(const sp<AudioOutputDescriptor>& outputDesc,
                                                        bool fromCache)
 {
@@ -646,20 +733,10 @@ void AudioPolicyManagerCustom::setPhoneState(audio_mode_t state)
     sp<SwAudioOutputDescriptor> hwOutputDesc = mPrimaryOutput;
 #ifdef VOICE_CONCURRENCY
     int voice_call_state = 0;
-    char propValue[PROPERTY_VALUE_MAX];
-    bool prop_playback_enabled = false, prop_rec_enabled=false, prop_voip_enabled = false;
-
-    if(property_get("voice.playback.conc.disabled", propValue, NULL)) {
-        prop_playback_enabled = atoi(propValue) || !strncmp("true", propValue, 4);
-    }
-
-    if(property_get("voice.record.conc.disabled", propValue, NULL)) {
-        prop_rec_enabled = atoi(propValue) || !strncmp("true", propValue, 4);
-    }
-
-    if(property_get("voice.voip.conc.disabled", propValue, NULL)) {
-        prop_voip_enabled = atoi(propValue) || !strncmp("true", propValue, 4);
-    }
+    const PolicyConfig& config = policyConfig();
+    bool prop_playback_enabled = config.voicePlaybackConcDisabled;
+    bool prop_rec_enabled = config.voiceRecordConcDisabled;
+    bool prop_voip_enabled = config.voiceVoipConcDisabled;
 
     bool mode_in_call = (AUDIO_MODE_IN_CALL != oldState) && (AUDIO_MODE_IN_CALL == state);
     //query if it is a actual voice call initiated by telephony
@@ -733,36 +810,44 @@ void AudioPolicyManagerCustom::setPhoneState(audio_mode_t state)
             }
         }
 
-        for (size_t i = 0; i < mOutputs.size(); i++) {
-            sp<SwAudioOutputDescriptor> outputDesc = mOutputs.valueAt(i);
-            if ( (outputDesc == NULL) || (outputDesc->mProfile == NULL)) {
-               ALOGD("voice_conc:ouput desc / profile is NULL");
-               continue;
-            }
-
-            if (AUDIO_OUTPUT_FLAG_FAST == mFallBackflag) {
-                if (((!outputDesc->isDuplicated() &&outputDesc->mProfile->mFlags & AUDIO_OUTPUT_FLAG_PRIMARY))
-                            && prop_playback_enabled) {
+        // handles are collected from the output index first as closeOutput() modifies mOutputs
+        if (AUDIO_OUTPUT_FLAG_FAST == mFallBackflag) {
+            Vector<audio_io_handle_t> outputs;
+            if (prop_playback_enabled) {
+                outputs = getOutputsWithProfileFlag(AUDIO_OUTPUT_FLAG_PRIMARY);
+                for (size_t i = 0; i < outputs.size(); i++) {
                     ALOGD("voice_conc:calling suspendOutput on call mode for primary output");
-                    mpClientInterface->suspendOutput(mOutputs.keyAt(i));
-                } //Close compress all sessions
-                else if ((outputDesc->mProfile->mFlags & AUDIO_OUTPUT_FLAG_COMPRESS_OFFLOAD)
-                                &&  prop_playback_enabled) {
+                    mpClientInterface->suspendOutput(outputs[i]);
+                }
+                //Close compress all sessions
+                outputs = getOutputsWithProfileFlag(AUDIO_OUTPUT_FLAG_COMPRESS_OFFLOAD,
+                                                    AUDIO_OUTPUT_FLAG_PRIMARY);
+                for (size_t i = 0; i < outputs.size(); i++) {
                     ALOGD("voice_conc:calling closeOutput on call mode for COMPRESS output");
-                    closeOutput(mOutputs.keyAt(i));
+                    closeOutput(outputs[i]);
+                    invalidateOutputIndex();
                 }
-                else if ((outputDesc->mProfile->mFlags & AUDIO_OUTPUT_FLAG_VOIP_RX)
-                                && prop_voip_enabled) {
+            }
+            if (prop_voip_enabled) {
+                outputs = getOutputsWithProfileFlag(AUDIO_OUTPUT_FLAG_VOIP_RX,
+                                                    (audio_output_flags_t)
+                                                    (prop_playback_enabled ?
+                                                     AUDIO_OUTPUT_FLAG_PRIMARY |
+                                                     AUDIO_OUTPUT_FLAG_COMPRESS_OFFLOAD : 0));
+                for (size_t i = 0; i < outputs.size(); i++) {
                     ALOGD("voice_conc:calling closeOutput on call mode for DIRECT  output");
-                    closeOutput(mOutputs.keyAt(i));
-                }
-            } else if (AUDIO_OUTPUT_FLAG_DEEP_BUFFER == mFallBackflag) {
-                if ((outputDesc->mProfile->mFlags & AUDIO_OUTPUT_FLAG_DIRECT)
-                                &&  prop_playback_enabled) {
-                    ALOGD("voice_conc:calling closeOutput on call mode for COMPRESS output");
-                    closeOutput(mOutputs.keyAt(i));
+                    closeOutput(outputs[i]);
+                    invalidateOutputIndex();
                 }
             }
+        } else if ((AUDIO_OUTPUT_FLAG_DEEP_BUFFER == mFallBackflag) && prop_playback_enabled) {
+            Vector<audio_io_handle_t> outputs =
+                    getOutputsWithProfileFlag(AUDIO_OUTPUT_FLAG_DIRECT);
+            for (size_t i = 0; i < outputs.size(); i++) {
+                ALOGD("voice_conc:calling closeOutput on call mode for COMPRESS output");
+                closeOutput(outputs[i]);
+                invalidateOutputIndex();
+            }
         }
     }
 
@@ -772,17 +857,12 @@ void AudioPolicyManagerCustom::setPhoneState(audio_mode_t state)
         mvoice_call_state = 0;
         if (AUDIO_OUTPUT_FLAG_FAST == mFallBackflag) {
             //restore PCM (deep-buffer) output after call termination
-            for (size_t i = 0; i < mOutputs.size(); i++) {
-                sp<SwAudioOutputDescriptor> outputDesc = mOutputs.valueAt(i);
-                if ( (outputDesc == NULL) || (outputDesc->mProfile == NULL)) {
-                   ALOGD("voice_conc:ouput desc / profile is NULL");
-                   continue;
-                }
-                if (!outputDesc->isDuplicated() && outputDesc->mProfile->mFlags & AUDIO_OUTPUT_FLAG_PRIMARY) {
-                    ALOGD("voice_conc:calling restoreOutput after call mode for primary output");
-                    mpClientInterface->restoreOutput(mOutputs.keyAt(i));
-                }
-           }
+            Vector<audio_io_handle_t> outputs =
+                    getOutputsWithProfileFlag(AUDIO_OUTPUT_FLAG_PRIMARY);
+            for (size_t i = 0; i < outputs.size(); i++) {
+                ALOGD("voice_conc:calling restoreOutput after call mode for primary output");
+                mpClientInterface->restoreOutput(outputs[i]);
+            }
         }
        //call invalidate tracks so that any open streams can fall back to deep buffer/compress path from ULL
         for (int i = AUDIO_STREAM_SYSTEM; i < (int)AUDIO_STREAM_CNT; i++) {
@@ -804,13 +884,7 @@ void AudioPolicyManagerCustom::setPhoneState(audio_mode_t state)
 
 #endif
 #ifdef RECORD_PLAY_CONCURRENCY
-    char recConcPropValue[PROPERTY_VALUE_MAX];
-    bool prop_rec_play_enabled = false;
-
-    if (property_get("rec.playback.conc.disabled", recConcPropValue, NULL)) {
-        prop_rec_play_enabled = atoi(recConcPropValue) || !strncmp("true", recConcPropValue, 4);
-    }
-    if (prop_rec_play_enabled) {
+    if (policyConfig().recPlaybackConcDisabled) {
         if (AUDIO_MODE_IN_COMMUNICATION == mEngine->getPhoneState()) {
             ALOGD("phone state changed to MODE_IN_COMM invlaidating music and voice streams");
             // call invalidate for voice streams, so that it can use deepbuffer with VoIP out device from HAL
@@ -819,18 +893,12 @@ void AudioPolicyManagerCustom::setPhoneState(audio_mode_t state)
             mpClientInterface->invalidateStream(AUDIO_STREAM_MUSIC);
 
             // close compress output to make sure session will be closed before timeout(60sec)
-            for (size_t i = 0; i < mOutputs.size(); i++) {
-
-                sp<SwAudioOutputDescriptor> outputDesc = mOutputs.valueAt(i);
-                if ((outputDesc == NULL) || (outputDesc->mProfile == NULL)) {
-                   ALOGD("ouput desc / profile is NULL");
-                   continue;
-                }
-
-                if (outputDesc->mProfile->mFlags & AUDIO_OUTPUT_FLAG_COMPRESS_OFFLOAD) {
-                    ALOGD("calling closeOutput on call mode for COMPRESS output");
-                    closeOutput(mOutputs.keyAt(i));
-                }
+            Vector<audio_io_handle_t> outputs =
+                    getOutputsWithProfileFlag(AUDIO_OUTPUT_FLAG_COMPRESS_OFFLOAD);
+            for (size_t i = 0; i < outputs.size(); i++) {
+                ALOGD("calling closeOutput on call mode for COMPRESS output");
+                closeOutput(outputs[i]);
+                invalidateOutputIndex();
             }
         } else if ((oldState == AUDIO_MODE_IN_COMMUNICATION) &&
                     (mEngine->getPhoneState() == AUDIO_MODE_NORMAL)) {
@@ -840,6 +908,7 @@ void AudioPolicyManagerCustom::setPhoneState(audio_mode_t state)
     }
 #endif
     mPrevPhoneState = oldState;
+    invalidateOutputDecisions();
     int delayMs = 0;
     if (isStateInCall(state)) {
         nsecs_t sysTime = systemTime();
@@ -1208,15 +1277,133 @@ status_t AudioPolicyManagerCustom::checkAndSetVolume(audio_stream_type_t stream,
 
     return NO_ERROR;
 }
+void AudioPolicyManagerCustom::releaseOutput(audio_io_handle_t output,
+                                             audio_stream_type_t stream,
+                                             audio_session_t session)
+{
+    // closes direct outputs once their last client is gone
+    AudioPolicyManager::releaseOutput(output, stream, session);
+    invalidateOutputIndex();
+}
+
 bool AudioPolicyManagerCustom::isDirectOutput(audio_io_handle_t output) {
-    for (size_t i = 0; i < mOutputs.size(); i++) {
-        audio_io_handle_t curOutput = mOutputs.keyAt(i);
+    updateOutputIndex();
+    if (mOutputIndexOverflow) {
+        ssize_t index = mOutputs.indexOfKey(output);
+        return (index >= 0) && (mOutputs.valueAt(index)->mFlags & AUDIO_OUTPUT_FLAG_DIRECT);
+    }
+    ssize_t index = mOutputIndexPositions.indexOfKey(output);
+    return (index >= 0) && (mDirectOutputs & (1ULL << mOutputIndexPositions.valueAt(index)));
+}
+
+void AudioPolicyManagerCustom::invalidateOutputIndex()
+{
+    mOutputIndexValid = false;
+}
+
+audio_output_flags_t AudioPolicyManagerCustom::getOutputIndexFlags(
+        const sp<SwAudioOutputDescriptor>& desc)
+{
+    // duplicated outputs have no profile and are never matched by profile flags
+    if ((desc == NULL) || (desc->mProfile == NULL) || desc->isDuplicated())
+        return AUDIO_OUTPUT_FLAG_NONE;
+    return (audio_output_flags_t)desc->mProfile->mFlags;
+}
+
+void AudioPolicyManagerCustom::updateOutputIndex()
+{
+    if (mOutputIndexValid) {
+#ifdef AUDIO_POLICY_INDEX_CHECK
+        checkOutputIndex();
+#endif
+        return;
+    }
+
+    mOutputIndexHandles.clear();
+    mOutputIndexPositions.clear();
+    memset(mOutputsByProfileFlag, 0, sizeof(mOutputsByProfileFlag));
+    mDirectOutputs = 0;
+    mOutputIndexOverflow = (mOutputs.size() > OUTPUT_INDEX_MAX_OUTPUTS);
+    if (mOutputIndexOverflow) {
+        ALOGW("%zu outputs open, output index disabled", mOutputs.size());
+    } else {
+        for (size_t i = 0; i < mOutputs.size(); i++) {
+            sp<SwAudioOutputDescriptor> desc = mOutputs.valueAt(i);
+            uint32_t profileFlags = getOutputIndexFlags(desc);
+
+            mOutputIndexHandles.add(mOutputs.keyAt(i));
+            mOutputIndexPositions.add(mOutputs.keyAt(i), i);
+            for (size_t bit = 0; bit < OUTPUT_INDEX_FLAG_BITS; bit++) {
+                if (profileFlags & (1U << bit))
+                    mOutputsByProfileFlag[bit] |= 1ULL << i;
+            }
+            if (desc->mFlags & AUDIO_OUTPUT_FLAG_DIRECT)
+                mDirectOutputs |= 1ULL << i;
+        }
+    }
+    mOutputIndexValid = true;
+}
+
+#ifdef AUDIO_POLICY_INDEX_CHECK
+void AudioPolicyManagerCustom::checkOutputIndex()
+{
+    // an out of sync index means a path opening or closing outputs does not invalidate it
+    bool consistent = mOutputIndexOverflow ||
+                      (mOutputIndexHandles.size() == mOutputs.size());
+
+    for (size_t i = 0; consistent && !mOutputIndexOverflow && i < mOutputs.size(); i++) {
         sp<SwAudioOutputDescriptor> desc = mOutputs.valueAt(i);
-        if ((curOutput == output) && (desc->mFlags & AUDIO_OUTPUT_FLAG_DIRECT)) {
-            return true;
+        uint32_t profileFlags = getOutputIndexFlags(desc);
+        ssize_t index = mOutputIndexPositions.indexOfKey(mOutputs.keyAt(i));
+
+        if (index < 0) {
+            consistent = false;
+            break;
+        }
+        size_t pos = mOutputIndexPositions.valueAt(index);
+        for (size_t bit = 0; bit < OUTPUT_INDEX_FLAG_BITS; bit++) {
+            if (((mOutputsByProfileFlag[bit] >> pos) & 1) != ((profileFlags >> bit) & 1))
+                consistent = false;
+        }
+        if (((mDirectOutputs >> pos) & 1) != ((desc->mFlags & AUDIO_OUTPUT_FLAG_DIRECT) != 0))
+            consistent = false;
+    }
+    if (!consistent) {
+        ALOGE("output index out of sync with %zu open outputs, rebuilding", mOutputs.size());
+        mOutputIndexValid = false;
+        updateOutputIndex();
+    }
+}
+#endif
+
+Vector<audio_io_handle_t> AudioPolicyManagerCustom::getOutputsWithProfileFlag(
+        audio_output_flags_t flag, audio_output_flags_t excludedFlags)
+{
+    Vector<audio_io_handle_t> outputs;
+    uint64_t matches = 0, excluded = 0;
+
+    updateOutputIndex();
+    if (mOutputIndexOverflow) {
+        for (size_t i = 0; i < mOutputs.size(); i++) {
+            uint32_t profileFlags = getOutputIndexFlags(mOutputs.valueAt(i));
+            if ((profileFlags & flag) && !(profileFlags & excludedFlags))
+                outputs.add(mOutputs.keyAt(i));
         }
+        return outputs;
+    }
+
+    for (size_t bit = 0; bit < OUTPUT_INDEX_FLAG_BITS; bit++) {
+        if (flag & (1U << bit))
+            matches |= mOutputsByProfileFlag[bit];
+        if (excludedFlags & (1U << bit))
+            excluded |= mOutputsByProfileFlag[bit];
     }
-    return false;
+    matches &= ~excluded;
+    while (matches) {
+        outputs.add(mOutputIndexHandles[__builtin_ctzll(matches)]);
+        matches &= matches - 1;
+    }
+    return outputs;
 }
 
 status_t AudioPolicyManagerCustom::getOutputForAttr(const audio_attributes_t *attr,
@@ -1233,7 +1420,7 @@ status_t AudioPolicyManagerCustom::getOutputForAttr(const audio_attributes_t *at
 {
     audio_offload_info_t tOffloadInfo = AUDIO_INFO_INITIALIZER;
 
-    bool pcmOffloadEnabled = property_get_bool("audio.offload.track.enable", false);
+    bool pcmOffloadEnabled = policyConfig().pcmOffloadTrack;
 
     if (offloadInfo == NULL && pcmOffloadEnabled) {
         tOffloadInfo.sample_rate  = samplingRate;
@@ -1257,68 +1444,49 @@ status_t AudioPolicyManagerCustom::getOutputForAttr(const audio_attributes_t *at
                                                 offloadInfo);
 }
 
-audio_io_handle_t AudioPolicyManagerCustom::getOutputForDevice(
-        audio_devices_t device,
-        audio_session_t session __unused,
+void AudioPolicyManagerCustom::getVoipHalState(uint32_t *mode,
+                                               uint32_t *voipOutCount,
+                                               uint32_t *voipSampleRate)
+{
+    int halMode, inCall, outCount, sampleRate;
+
+    // one batched query answered by the HAL without parameter parsing
+    String8 valueStr = mpClientInterface->getParameters((audio_io_handle_t)0,
+                                                        String8("hal_state"));
+    if (sscanf(valueStr.string(), "hal_state=%d,%d,%d,%d",
+               &halMode, &inCall, &outCount, &sampleRate) == 4) {
+        *mode = halMode;
+        if (outCount >= 0 && sampleRate >= 0) {
+            *voipOutCount = outCount;
+            *voipSampleRate = sampleRate;
+        }
+        return;
+    }
+
+    // HAL without batched state support: query all keys in a single call
+    int value = 0;
+    valueStr = mpClientInterface->getParameters((audio_io_handle_t)0,
+                    String8("audio_mode;voip_out_stream_count;voip_sample_rate"));
+    AudioParameter result = AudioParameter(valueStr);
+    if (result.getInt(String8("audio_mode"), value) == NO_ERROR) {
+        *mode = value;
+    }
+    if (result.getInt(String8("voip_out_stream_count"), value) == NO_ERROR) {
+        *voipOutCount = value;
+    }
+    if (result.getInt(String8("voip_sample_rate"), value) == NO_ERROR) {
+        *voipSampleRate = value;
+    }
+}
+
+bool AudioPolicyManagerCustom::getOutputFlagsForDevice(
         audio_stream_type_t stream,
         uint32_t samplingRate,
         audio_format_t format,
         audio_channel_mask_t channelMask,
-        audio_output_flags_t flags,
+        audio_output_flags_t& flags,
         const audio_offload_info_t *offloadInfo)
 {
-    audio_io_handle_t output = AUDIO_IO_HANDLE_NONE;
-    uint32_t latency = 0;
-    status_t status;
-
-#ifdef AUDIO_POLICY_TEST
-    if (mCurOutput != 0) {
-        ALOGV("getOutput() test output mCurOutput %d, samplingRate %d, format %d, channelMask %x, mDirectOutput %d",
-                mCurOutput, mTestSamplingRate, mTestFormat, mTestChannels, mDirectOutput);
-
-        if (mTestOutputs[mCurOutput] == 0) {
-            ALOGV("getOutput() opening test output");
-            sp<AudioOutputDescriptor> outputDesc = new SwAudioOutputDescriptor(NULL,
-                                                                               mpClientInterface);
-            outputDesc->mDevice = mTestDevice;
-            outputDesc->mLatency = mTestLatencyMs;
-            outputDesc->mFlags =
-                    (audio_output_flags_t)(mDirectOutput ? AUDIO_OUTPUT_FLAG_DIRECT : 0);
-            outputDesc->mRefCount[stream] = 0;
-            audio_config_t config = AUDIO_CONFIG_INITIALIZER;
-            config.sample_rate = mTestSamplingRate;
-            config.channel_mask = mTestChannels;
-            config.format = mTestFormat;
-            if (offloadInfo != NULL) {
-                config.offload_info = *offloadInfo;
-            }
-            status = mpClientInterface->openOutput(0,
-                                                  &mTestOutputs[mCurOutput],
-                                                  &config,
-                                                  &outputDesc->mDevice,
-                                                  String8(""),
-                                                  &outputDesc->mLatency,
-                                                  outputDesc->mFlags);
-            if (status == NO_ERROR) {
-                outputDesc->mSamplingRate = config.sample_rate;
-                outputDesc->mFormat = config.format;
-                outputDesc->mChannelMask = config.channel_mask;
-                AudioParameter outputCmd = AudioParameter();
-                outputCmd.addInt(String8("set_id"),mCurOutput);
-                mpClientInterface->setParameters(mTestOutputs[mCurOutput],outputCmd.toString());
-                addOutput(mTestOutputs[mCurOutput], outputDesc);
-            }
-        }
-        return mTestOutputs[mCurOutput];
-    }
-#endif //AUDIO_POLICY_TEST
-    if (((flags & AUDIO_OUTPUT_FLAG_COMPRESS_OFFLOAD) != 0) &&
-            (stream != AUDIO_STREAM_MUSIC)) {
-        // compress should not be used for non-music streams
-        ALOGE("Offloading only allowed with music stream");
-        return 0;
-       }
-
     if ((stream == AUDIO_STREAM_VOICE_CALL) &&
         (channelMask == 1) &&
         (samplingRate == 8000 || samplingRate == 16000)) {
@@ -1326,35 +1494,13 @@ audio_io_handle_t AudioPolicyManagerCustom::getOutputForDevice(
         // audio mode is MODE_IN_COMMUNCATION; AND
         // voip output is not opened already; AND
         // requested sample rate matches with that of voip input stream (if opened already)
-        int value = 0;
         uint32_t mode = 0, voipOutCount = 1, voipSampleRate = 1;
-        String8 valueStr = mpClientInterface->getParameters((audio_io_handle_t)0,
-                                                           String8("audio_mode"));
-        AudioParameter result = AudioParameter(valueStr);
-        if (result.getInt(String8("audio_mode"), value) == NO_ERROR) {
-            mode = value;
-        }
-
-        valueStr =  mpClientInterface->getParameters((audio_io_handle_t)0,
-                                              String8("voip_out_stream_count"));
-        result = AudioParameter(valueStr);
-        if (result.getInt(String8("voip_out_stream_count"), value) == NO_ERROR) {
-            voipOutCount = value;
-        }
-
-        valueStr = mpClientInterface->getParameters((audio_io_handle_t)0,
-                                              String8("voip_sample_rate"));
-        result = AudioParameter(valueStr);
-        if (result.getInt(String8("voip_sample_rate"), value) == NO_ERROR) {
-            voipSampleRate = value;
-        }
+        getVoipHalState(&mode, &voipOutCount, &voipSampleRate);
 
         if ((mode == AUDIO_MODE_IN_COMMUNICATION) && (voipOutCount == 0) &&
             ((voipSampleRate == 0) || (voipSampleRate == samplingRate))) {
             if (audio_is_linear_pcm(format)) {
-                char propValue[PROPERTY_VALUE_MAX] = {0};
-                property_get("use.voice.path.for.pcm.voip", propValue, "0");
-                bool voipPcmSysPropEnabled = !strncmp("true", propValue, sizeof("true"));
+                bool voipPcmSysPropEnabled = policyConfig().voipPcmUseVoicePath;
                 if (voipPcmSysPropEnabled && (format == AUDIO_FORMAT_PCM_16_BIT)) {
                     flags = (audio_output_flags_t)((flags &~AUDIO_OUTPUT_FLAG_FAST) |
                                 AUDIO_OUTPUT_FLAG_VOIP_RX | AUDIO_OUTPUT_FLAG_DIRECT);
@@ -1365,16 +1511,8 @@ audio_io_handle_t AudioPolicyManagerCustom::getOutputForDevice(
     }
 
 #ifdef VOICE_CONCURRENCY
-    char propValue[PROPERTY_VALUE_MAX];
-    bool prop_play_enabled=false, prop_voip_enabled = false;
-
-    if(property_get("voice.playback.conc.disabled", propValue, NULL)) {
-       prop_play_enabled = atoi(propValue) || !strncmp("true", propValue, 4);
-    }
-
-    if(property_get("voice.voip.conc.disabled", propValue, NULL)) {
-       prop_voip_enabled = atoi(propValue) || !strncmp("true", propValue, 4);
-    }
+    bool prop_play_enabled = policyConfig().voicePlaybackConcDisabled;
+    bool prop_voip_enabled = policyConfig().voiceVoipConcDisabled;
 
     if (prop_play_enabled && mvoice_call_state) {
         //check if voice call is active  / running in background
@@ -1386,7 +1524,7 @@ audio_io_handle_t AudioPolicyManagerCustom::getOutputForDevice(
                 if(prop_voip_enabled) {
                    ALOGD("voice_conc:getoutput:IN call mode return no o/p for VoIP %x",
                         flags );
-                   return 0;
+                   return false;
                 }
             }
             else {
@@ -1416,18 +1554,14 @@ audio_io_handle_t AudioPolicyManagerCustom::getOutputForDevice(
             if(AUDIO_OUTPUT_FLAG_VOIP_RX  & flags) {
                     ALOGD("voice_conc:getoutput:IN call mode return no o/p for VoIP %x",
                         flags );
-               return 0;
+               return false;
             }
         }
      }
 #endif
 #ifdef RECORD_PLAY_CONCURRENCY
-    char recConcPropValue[PROPERTY_VALUE_MAX];
-    bool prop_rec_play_enabled = false;
+    bool prop_rec_play_enabled = policyConfig().recPlaybackConcDisabled;
 
-    if (property_get("rec.playback.conc.disabled", recConcPropValue, NULL)) {
-        prop_rec_play_enabled = atoi(recConcPropValue) || !strncmp("true", recConcPropValue, 4);
-    }
     if ((prop_rec_play_enabled) &&
             ((true == mIsInputRequestOnProgress) || (mInputs.activeInputsCount() > 0))) {
         if (AUDIO_MODE_IN_COMMUNICATION == mEngine->getPhoneState()) {
@@ -1519,7 +1653,7 @@ audio_io_handle_t AudioPolicyManagerCustom::getOutputForDevice(
         flags = (audio_output_flags_t)(flags &~AUDIO_OUTPUT_FLAG_DEEP_BUFFER);
     } else if (/* stream == AUDIO_STREAM_MUSIC && */
             flags == AUDIO_OUTPUT_FLAG_NONE &&
-            property_get_bool("audio.deep_buffer.media", false /* default_value */)) {
+            policyConfig().deepBufferMedia) {
         flags = (audio_output_flags_t)AUDIO_OUTPUT_FLAG_DEEP_BUFFER;
     }
 
@@ -1527,8 +1661,114 @@ audio_io_handle_t AudioPolicyManagerCustom::getOutputForDevice(
         flags = AUDIO_OUTPUT_FLAG_TTS;
     }
 
+    return true;
+}
+
+audio_io_handle_t AudioPolicyManagerCustom::getOutputForDevice(
+        audio_devices_t device,
+        audio_session_t session __unused,
+        audio_stream_type_t stream,
+        uint32_t samplingRate,
+        audio_format_t format,
+        audio_channel_mask_t channelMask,
+        audio_output_flags_t flags,
+        const audio_offload_info_t *offloadInfo)
+{
+    audio_io_handle_t output = AUDIO_IO_HANDLE_NONE;
+    uint32_t latency = 0;
+    status_t status;
+
+#ifdef AUDIO_POLICY_TEST
+    if (mCurOutput != 0) {
+        ALOGV("getOutput() test output mCurOutput %d, samplingRate %d, format %d, channelMask %x, mDirectOutput %d",
+                mCurOutput, mTestSamplingRate, mTestFormat, mTestChannels, mDirectOutput);
+
+        if (mTestOutputs[mCurOutput] == 0) {
+            ALOGV("getOutput() opening test output");
+            sp<AudioOutputDescriptor> outputDesc = new SwAudioOutputDescriptor(NULL,
+                                                                               mpClientInterface);
+            outputDesc->mDevice = mTestDevice;
+            outputDesc->mLatency = mTestLatencyMs;
+            outputDesc->mFlags =
+                    (audio_output_flags_t)(mDirectOutput ? AUDIO_OUTPUT_FLAG_DIRECT : 0);
+            outputDesc->mRefCount[stream] = 0;
+            audio_config_t config = AUDIO_CONFIG_INITIALIZER;
+            config.sample_rate = mTestSamplingRate;
+            config.channel_mask = mTestChannels;
+            config.format = mTestFormat;
+            if (offloadInfo != NULL) {
+                config.offload_info = *offloadInfo;
+            }
+            status = mpClientInterface->openOutput(0,
+                                                  &mTestOutputs[mCurOutput],
+                                                  &config,
+                                                  &outputDesc->mDevice,
+                                                  String8(""),
+                                                  &outputDesc->mLatency,
+                                                  outputDesc->mFlags);
+            if (status == NO_ERROR) {
+                outputDesc->mSamplingRate = config.sample_rate;
+                outputDesc->mFormat = config.format;
+                outputDesc->mChannelMask = config.channel_mask;
+                AudioParameter outputCmd = AudioParameter();
+                outputCmd.addInt(String8("set_id"),mCurOutput);
+                mpClientInterface->setParameters(mTestOutputs[mCurOutput],outputCmd.toString());
+                addOutput(mTestOutputs[mCurOutput], outputDesc);
+                invalidateOutputIndex();
+            }
+        }
+        return mTestOutputs[mCurOutput];
+    }
+#endif //AUDIO_POLICY_TEST
+    if (((flags & AUDIO_OUTPUT_FLAG_COMPRESS_OFFLOAD) != 0) &&
+            (stream != AUDIO_STREAM_MUSIC)) {
+        // compress should not be used for non-music streams
+        ALOGE("Offloading only allowed with music stream");
+        return 0;
+       }
+
+    // the VoIP direct output decision depends on live HAL state and is never cached
+    bool voipCandidate = (stream == AUDIO_STREAM_VOICE_CALL) && (channelMask == 1) &&
+                         (samplingRate == 8000 || samplingRate == 16000);
+    bool recPlayActive = false;
+#ifdef RECORD_PLAY_CONCURRENCY
+    recPlayActive = mIsInputRequestOnProgress || (mInputs.activeInputsCount() > 0);
+#endif
+    OutputDecisionKey decisionKey(device, stream, samplingRate, format, channelMask, flags,
+                                  offloadInfo, recPlayActive);
+    // reloads the property snapshot first, which may invalidate the cache
+    policyConfig();
+    ssize_t decisionIndex = voipCandidate ? -1 : mOutputDecisions.indexOfKey(decisionKey);
     sp<IOProfile> profile;
 
+    if (decisionIndex >= 0) {
+        const OutputDecision& decision = mOutputDecisions.valueAt(decisionIndex);
+        flags = decision.flags;
+        profile = decision.profile;
+        mOutputDecisionHits++;
+    } else {
+        if (!getOutputFlagsForDevice(stream, samplingRate, format, channelMask, flags,
+                                     offloadInfo)) {
+            return 0;
+        }
+        if (((flags & AUDIO_OUTPUT_FLAG_DIRECT) != 0) ||
+                !audio_is_linear_pcm(format) || samplingRate > MAX_MIXER_SAMPLING_RATE ||
+                audio_channel_count_from_out_mask(channelMask) > 2) {
+            profile = getProfileForDirectOutput(device,
+                                               samplingRate,
+                                               format,
+                                               channelMask,
+                                               (audio_output_flags_t)flags);
+        }
+        if (!voipCandidate) {
+            if (mOutputDecisions.size() >= OUTPUT_DECISION_CACHE_MAX_ENTRIES) {
+                mOutputDecisions.clear();
+            }
+            mOutputDecisions.add(decisionKey, OutputDecision(flags, profile));
+            mOutputDecisionMisses++;
+        }
+    }
+
     // skip direct output selection if the request can obviously be attached to a mixed output
     // and not explicitly requested
     if (((flags & AUDIO_OUTPUT_FLAG_DIRECT) == 0) &&
@@ -1544,13 +1784,9 @@ audio_io_handle_t AudioPolicyManagerCustom::getOutputForDevice(
     // This may prevent offloading in rare situations where effects are left active by apps
     // in the background.
 
-    if (((flags & AUDIO_OUTPUT_FLAG_COMPRESS_OFFLOAD) == 0) ||
-            !mEffects.isNonOffloadableEffectEnabled()) {
-        profile = getProfileForDirectOutput(device,
-                                           samplingRate,
-                                           format,
-                                           channelMask,
-                                           (audio_output_flags_t)flags);
+    if (((flags & AUDIO_OUTPUT_FLAG_COMPRESS_OFFLOAD) != 0) &&
+            mEffects.isNonOffloadableEffectEnabled()) {
+        profile = 0;
     }
 
     if (profile != 0) {
@@ -1573,6 +1809,7 @@ audio_io_handle_t AudioPolicyManagerCustom::getOutputForDevice(
         // close direct output if currently open and configured with different parameters
         if (outputDesc != NULL) {
             closeOutput(outputDesc->mIoHandle);
+            invalidateOutputIndex();
         }
 
         // if the selected profile is offloaded and no offload info was specified,
@@ -1637,6 +1874,7 @@ audio_io_handle_t AudioPolicyManagerCustom::getOutputForDevice(
 
         audio_io_handle_t srcOutput = getOutputForEffect();
         addOutput(output, outputDesc);
+        invalidateOutputIndex();
         audio_io_handle_t dstOutput = getOutputForEffect();
         if (dstOutput == output) {
             mpClientInterface->moveEffects(AUDIO_SESSION_OUTPUT_MIX, srcOutput, dstOutput);
@@ -1684,16 +1922,8 @@ status_t AudioPolicyManagerCustom::getInputForAttr(const audio_attributes_t *att
     audio_source_t inputSource = attr->source;
 #ifdef VOICE_CONCURRENCY
 
-    char propValue[PROPERTY_VALUE_MAX];
-    bool prop_rec_enabled=false, prop_voip_enabled = false;
-
-    if(property_get("voice.record.conc.disabled", propValue, NULL)) {
-        prop_rec_enabled = atoi(propValue) || !strncmp("true", propValue, 4);
-    }
-
-    if(property_get("voice.voip.conc.disabled", propValue, NULL)) {
-        prop_voip_enabled = atoi(propValue) || !strncmp("true", propValue, 4);
-     }
+    bool prop_rec_enabled = policyConfig().voiceRecordConcDisabled;
+    bool prop_voip_enabled = policyConfig().voiceVoipConcDisabled;
 
     if (prop_rec_enabled && mvoice_call_state) {
          //check if voice call is active  / running in background
@@ -1796,14 +2026,7 @@ status_t AudioPolicyManagerCustom::startInput(audio_io_handle_t input,
 #ifdef RECORD_PLAY_CONCURRENCY
     mIsInputRequestOnProgress = true;
 
-    char getPropValue[PROPERTY_VALUE_MAX];
-    bool prop_rec_play_enabled = false;
-
-    if (property_get("rec.playback.conc.disabled", getPropValue, NULL)) {
-        prop_rec_play_enabled = atoi(getPropValue) || !strncmp("true", getPropValue, 4);
-    }
-
-    if ((prop_rec_play_enabled) &&(mInputs.activeInputsCount() == 0)){
+    if ((policyConfig().recPlaybackConcDisabled) &&(mInputs.activeInputsCount() == 0)){
         // send update to HAL on record playback concurrency
         AudioParameter param = AudioParameter();
         param.add(String8("rec_play_conc_on"), String8("true"));
@@ -1821,18 +2044,13 @@ status_t AudioPolicyManagerCustom::startInput(audio_io_handle_t input,
             }
         }
         // close compress tracks
-        for (size_t i = 0; i < mOutputs.size(); i++) {
-            sp<SwAudioOutputDescriptor> outputDesc = mOutputs.valueAt(i);
-            if ((outputDesc == NULL) || (outputDesc->mProfile == NULL)) {
-               ALOGD("ouput desc / profile is NULL");
-               continue;
-            }
-            if (outputDesc->mProfile->mFlags
-                            & AUDIO_OUTPUT_FLAG_COMPRESS_OFFLOAD) {
-                // close compress  sessions
-                ALOGD("calling closeOutput on record conc for COMPRESS output");
-                closeOutput(mOutputs.keyAt(i));
-            }
+        Vector<audio_io_handle_t> outputs =
+                getOutputsWithProfileFlag(AUDIO_OUTPUT_FLAG_COMPRESS_OFFLOAD);
+        for (size_t i = 0; i < outputs.size(); i++) {
+            // close compress  sessions
+            ALOGD("calling closeOutput on record conc for COMPRESS output");
+            closeOutput(outputs[i]);
+            invalidateOutputIndex();
         }
     }
 #endif
@@ -1882,14 +2100,7 @@ status_t AudioPolicyManagerCustom::stopInput(audio_io_handle_t input,
     status_t status;
     status = AudioPolicyManager::stopInput(input, session);
 #ifdef RECORD_PLAY_CONCURRENCY
-    char propValue[PROPERTY_VALUE_MAX];
-    bool prop_rec_play_enabled = false;
-
-    if (property_get("rec.playback.conc.disabled", propValue, NULL)) {
-        prop_rec_play_enabled = atoi(propValue) || !strncmp("true", propValue, 4);
-    }
-
-    if ((prop_rec_play_enabled) && (mInputs.activeInputsCount() == 0)) {
+    if ((policyConfig().recPlaybackConcDisabled) && (mInputs.activeInputsCount() == 0)) {
 
         //send update to HAL on record playback concurrency
         AudioParameter param = AudioParameter();
@@ -1915,7 +2126,15 @@ AudioPolicyManagerCustom::AudioPolicyManagerCustom(AudioPolicyClientInterface *c
     : AudioPolicyManager(clientInterface),
       mHdmiAudioDisabled(false),
       mHdmiAudioEvent(false),
-      mPrevPhoneState(0)
+      mPrevPhoneState(0),
+      mPolicyConfigSerial(0),
+      mPolicyConfigValid(false),
+      mOutputDecisionHits(0),
+      mOutputDecisionMisses(0),
+      mOutputDecisionInvalidations(0),
+      mOutputIndexValid(false),
+      mOutputIndexOverflow(false),
+      mDirectOutputs(0)
 {
     char ssr_enabled[PROPERTY_VALUE_MAX] = {0};
     bool prop_ssr_enabled = false;
@@ -35,6 +35,13 @@ namespace android {
 #ifndef AUDIO_EXTN_AFE_PROXY_ENABLED
 #define AUDIO_DEVICE_OUT_PROXY 0x1000000
 #endif
+
+// maximum number of memoized output decisions kept by getOutputForDevice()
+#define OUTPUT_DECISION_CACHE_MAX_ENTRIES 32
+// open outputs tracked by the output flag index, one bit per output
+#define OUTPUT_INDEX_MAX_OUTPUTS 64
+// number of audio_output_flags_t bits indexed
+#define OUTPUT_INDEX_FLAG_BITS 32
 // ----------------------------------------------------------------------------
 
 class AudioPolicyManagerCustom: public AudioPolicyManager
@@ -50,9 +57,17 @@ public:
                                           const char *device_address,
                                           const char *device_name);
         virtual void setPhoneState(audio_mode_t state);
+        virtual void setForceUse(audio_policy_force_use_t usage,
+                                 audio_policy_forced_cfg_t config);
+
+        virtual status_t dump(int fd);
 
         virtual bool isOffloadSupported(const audio_offload_info_t& offloadInfo);
 
+        virtual void releaseOutput(audio_io_handle_t output,
+                                   audio_stream_type_t stream,
+                                   audio_session_t session);
+
         virtual status_t getInputForAttr(const audio_attributes_t *attr,
                                          audio_io_handle_t *input,
                                          audio_session_t session,
@@ -126,6 +141,20 @@ private:
                 audio_channel_mask_t channelMask,
                 audio_output_flags_t flags,
                 const audio_offload_info_t *offloadInfo);
+        // queries the audio mode and VoIP stream state from the HAL in one round trip,
+        // leaving the outputs untouched for values the HAL does not report
+        void getVoipHalState(uint32_t *mode, uint32_t *voipOutCount, uint32_t *voipSampleRate);
+        // applies the voice/record concurrency, WFD and offload rules to the requested
+        // output flags. Returns false if no output must be granted to the request.
+        bool getOutputFlagsForDevice(audio_stream_type_t stream,
+                                     uint32_t samplingRate,
+                                     audio_format_t format,
+                                     audio_channel_mask_t channelMask,
+                                     audio_output_flags_t& flags,
+                                     const audio_offload_info_t *offloadInfo);
+        // drops all memoized output decisions. Must be called whenever phone state,
+        // connected devices, forced usages or policy properties change.
+        void invalidateOutputDecisions();
         // internal method to fill offload info in case of Direct PCM
         status_t getOutputForAttr(const audio_attributes_t *attr,
                 audio_io_handle_t *output,
@@ -145,6 +174,82 @@ private:
         // Used for record + playback concurrency
         bool mIsInputRequestOnProgress;
 #endif
+        // typed snapshot of the system properties consulted when opening outputs and inputs
+        struct PolicyConfig {
+            bool voicePlaybackConcDisabled;  // voice.playback.conc.disabled
+            bool voiceRecordConcDisabled;    // voice.record.conc.disabled
+            bool voiceVoipConcDisabled;      // voice.voip.conc.disabled
+            bool recPlaybackConcDisabled;    // rec.playback.conc.disabled
+            bool pcm16BitOffloadEnabled;     // audio.offload.pcm.16bit.enable
+            bool pcm24BitOffloadEnabled;     // audio.offload.pcm.24bit.enable
+            bool offloadDisabled;            // audio.offload.disable
+            bool offloadWithVideo;           // audio.offload.video
+            bool streamingOffloadWithVideo;  // av.streaming.offload.enable
+            bool pcmOffloadTrack;            // audio.offload.track.enable
+            bool deepBufferMedia;            // audio.deep_buffer.media
+            bool voipPcmUseVoicePath;        // use.voice.path.for.pcm.voip
+            int offloadMinDurationSecs;      // audio.offload.min.duration.secs, -1 if not set
+        };
+        // returns the current snapshot, reloading it only if a system property changed
+        // since it was taken
+        const PolicyConfig& policyConfig();
+        PolicyConfig mPolicyConfig;
+        uint32_t mPolicyConfigSerial;
+        bool mPolicyConfigValid;
+
+        // request tuple the output flags and direct profile of getOutputForDevice() depend on
+        struct OutputDecisionKey {
+            OutputDecisionKey() { memset(this, 0, sizeof(*this)); }
+            OutputDecisionKey(audio_devices_t device, audio_stream_type_t stream,
+                              uint32_t samplingRate, audio_format_t format,
+                              audio_channel_mask_t channelMask, audio_output_flags_t flags,
+                              const audio_offload_info_t *offloadInfo, bool recPlayActive);
+            bool operator<(const OutputDecisionKey& other) const {
+                return memcmp(this, &other, sizeof(*this)) < 0;
+            }
+
+            uint32_t device;
+            uint32_t stream;
+            uint32_t samplingRate;
+            uint32_t format;
+            uint32_t channelMask;
+            uint32_t flags;
+            // offload info digest: only its presence and usage are consulted, 0 if absent
+            uint32_t offloadUsage;
+            uint32_t recPlayActive;
+        };
+        struct OutputDecision {
+            OutputDecision() : flags(AUDIO_OUTPUT_FLAG_NONE) {}
+            OutputDecision(audio_output_flags_t flags, const sp<IOProfile>& profile)
+                : flags(flags), profile(profile) {}
+
+            audio_output_flags_t flags;
+            sp<IOProfile> profile;
+        };
+        KeyedVector<OutputDecisionKey, OutputDecision> mOutputDecisions;
+        uint32_t mOutputDecisionHits;
+        uint32_t mOutputDecisionMisses;
+        uint32_t mOutputDecisionInvalidations;
+
+        // index of the open outputs by profile flag, rebuilt on first use after a change.
+        // Every path opening or closing an output must call invalidateOutputIndex().
+        void invalidateOutputIndex();
+        void updateOutputIndex();
+#ifdef AUDIO_POLICY_INDEX_CHECK
+        // debug builds: verifies the index against mOutputs before each use
+        void checkOutputIndex();
+#endif
+        static audio_output_flags_t getOutputIndexFlags(const sp<SwAudioOutputDescriptor>& desc);
+        // returns the open, non duplicated outputs whose profile has any of flag set and
+        // none of excludedFlags
+        Vector<audio_io_handle_t> getOutputsWithProfileFlag(audio_output_flags_t flag,
+                audio_output_flags_t excludedFlags = AUDIO_OUTPUT_FLAG_NONE);
+        bool mOutputIndexValid;
+        bool mOutputIndexOverflow;
+        Vector<audio_io_handle_t> mOutputIndexHandles;                 // position -> handle
+        KeyedVector<audio_io_handle_t, size_t> mOutputIndexPositions;  // handle -> position
+        uint64_t mOutputsByProfileFlag[OUTPUT_INDEX_FLAG_BITS];        // flag bit -> positions
+        uint64_t mDirectOutputs;                                       // DIRECT descriptors
 };
 
 };
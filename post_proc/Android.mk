@@ -56,8 +56,12 @@ include $(CLEAR_VARS)
 LOCAL_SRC_FILES := EffectsHwAcc.cpp
 
 LOCAL_C_INCLUDES := \
+    external/tinyalsa/include \
+    $(TARGET_OUT_INTERMEDIATES)/KERNEL_OBJ/usr/include \
     $(call include-path-for, audio-effects)
 
+LOCAL_ADDITIONAL_DEPENDENCIES := $(TARGET_OUT_INTERMEDIATES)/KERNEL_OBJ/usr
+
 LOCAL_SHARED_LIBRARIES := \
     liblog \
     libeffects
@@ -36,6 +36,7 @@
 #include <media/EffectsFactoryApi.h>
 #include <audio_effects/effect_hwaccelerator.h>
 #include "EffectsHwAcc.h"
+#include "hw_accelerator.h"
 
 namespace android {
 
@@ -47,7 +48,7 @@ namespace android {
 EffectsHwAcc::EffectsBufferProvider::EffectsBufferProvider()
              : AudioBufferProvider(), mEffectsHandle(NULL),
                mInputBuffer(NULL), mOutputBuffer(NULL),
-               mInputBufferFrameCountOffset(0)
+               mInputBufferFrameCountOffset(0), mInputBufferFrameCount(0)
 {
 }
 
@@ -63,6 +64,30 @@ EffectsHwAcc::EffectsBufferProvider::~EffectsBufferProvider()
         free(mOutputBuffer);
 }
 
+size_t EffectsHwAcc::EffectsBufferProvider::inputFramesFor(size_t outputFrameCount) const
+{
+    return ((outputFrameCount * mEffectsConfig.inputCfg.samplingRate) /
+             mEffectsConfig.outputCfg.samplingRate) +
+           (((outputFrameCount * mEffectsConfig.inputCfg.samplingRate) %
+              mEffectsConfig.outputCfg.samplingRate) ? 1 : 0);
+}
+
+// drop frameCount frames consumed by the accelerator from the staging buffer,
+// keeping any residual frames at its start
+void EffectsHwAcc::EffectsBufferProvider::consumeInputFrames(size_t frameCount)
+{
+    size_t frameSize = FRAME_SIZE(mEffectsConfig.inputCfg.format) *
+                       popcount(mEffectsConfig.inputCfg.channels);
+
+    if (frameCount >= mInputBufferFrameCountOffset) {
+        mInputBufferFrameCountOffset = 0;
+        return;
+    }
+    mInputBufferFrameCountOffset -= frameCount;
+    memmove(mInputBuffer, (char *)mInputBuffer + frameCount * frameSize,
+            mInputBufferFrameCountOffset * frameSize);
+}
+
 status_t EffectsHwAcc::EffectsBufferProvider::getNextBuffer(
                        AudioBufferProvider::Buffer *pBuffer,
                        int64_t pts)
@@ -73,60 +98,90 @@ status_t EffectsHwAcc::EffectsBufferProvider::getNextBuffer(
     size_t reqOutputFrameCount = pBuffer->frameCount;
     int ret = 0;
 
-    if (mTrackBufferProvider != NULL) {
-        while (1) {
-            reqInputFrameCount = ((reqOutputFrameCount *
-                                   mEffectsConfig.inputCfg.samplingRate)/
-                                   mEffectsConfig.outputCfg.samplingRate) +
-                                   (((reqOutputFrameCount *
-                                     mEffectsConfig.inputCfg.samplingRate)%
-                                     mEffectsConfig.outputCfg.samplingRate) ? 1 : 0);
-            ALOGV("InputFrameCount: %d, OutputFrameCount: %d, InputBufferFrameCountOffset: %d",
-                  reqInputFrameCount, reqOutputFrameCount,
-                  mInputBufferFrameCountOffset);
-            frameCount = reqInputFrameCount - mInputBufferFrameCountOffset;
-            offset = mInputBufferFrameCountOffset *
-                     FRAME_SIZE(mEffectsConfig.inputCfg.format) *
-                     popcount(mEffectsConfig.inputCfg.channels);
-            while (frameCount) {
-                pBuffer->frameCount = frameCount;
-                ret = mTrackBufferProvider->getNextBuffer(pBuffer, pts);
-                if (ret == OK) {
-                    int bytesInBuffer = pBuffer->frameCount *
-                                        FRAME_SIZE(mEffectsConfig.inputCfg.format) *
-                                        popcount(mEffectsConfig.inputCfg.channels);
-                    memcpy((char *)mInputBuffer+offset, pBuffer->i8, bytesInBuffer);
-                    frameCount -= pBuffer->frameCount;
-                    mInputBufferFrameCountOffset += pBuffer->frameCount;
-                    offset += bytesInBuffer;
-                    mTrackBufferProvider->releaseBuffer(pBuffer);
-                } else
-                    break;
+    if (mTrackBufferProvider == NULL) {
+        ALOGE("EffBufferProvider::getNextBuffer() error: NULL track buffer provider");
+        return NO_INIT;
+    }
+
+    size_t frameSize = FRAME_SIZE(mEffectsConfig.inputCfg.format) *
+                       popcount(mEffectsConfig.inputCfg.channels);
+    reqInputFrameCount = inputFramesFor(reqOutputFrameCount);
+    if (reqInputFrameCount > mInputBufferFrameCount) {
+        // staging buffer is sized for the configured frame count and rate ratio
+        reqOutputFrameCount = (mInputBufferFrameCount *
+                               mEffectsConfig.outputCfg.samplingRate) /
+                              mEffectsConfig.inputCfg.samplingRate;
+        reqInputFrameCount = inputFramesFor(reqOutputFrameCount);
+    }
+
+    while (1) {
+        AudioBufferProvider::Buffer trackBuffer;
+        void *input = mInputBuffer;
+        bool direct = false;
+
+        ALOGV("InputFrameCount: %d, OutputFrameCount: %d, InputBufferFrameCountOffset: %d",
+              reqInputFrameCount, reqOutputFrameCount,
+              mInputBufferFrameCountOffset);
+        frameCount = (reqInputFrameCount > mInputBufferFrameCountOffset) ?
+                     reqInputFrameCount - mInputBufferFrameCountOffset : 0;
+        offset = mInputBufferFrameCountOffset * frameSize;
+        ret = OK;
+        while (frameCount) {
+            trackBuffer.frameCount = frameCount;
+            ret = mTrackBufferProvider->getNextBuffer(&trackBuffer, pts);
+            if (ret != OK)
+                break;
+            if (mInputBufferFrameCountOffset == 0 && trackBuffer.frameCount == frameCount) {
+                // the whole chunk is contiguous in the track buffer: the accelerator
+                // reads it from there and the track buffer is released after process
+                input = trackBuffer.raw;
+                direct = true;
+                break;
             }
-            if (ret == OK) {
-                mEffectsConfig.inputCfg.buffer.frameCount = reqInputFrameCount;
-                mEffectsConfig.inputCfg.buffer.raw = (void *)mInputBuffer;
-                mEffectsConfig.outputCfg.buffer.frameCount = reqOutputFrameCount;
-                mEffectsConfig.outputCfg.buffer.raw = (void *)mOutputBuffer;
-
-                ret = (*mEffectsHandle)->process(mEffectsHandle,
-                                              &mEffectsConfig.inputCfg.buffer,
-                                              &mEffectsConfig.outputCfg.buffer);
-                if (ret == -ENODATA) {
-                    ALOGV("Continue to provide more data for initial buffering");
-                    mInputBufferFrameCountOffset -= reqInputFrameCount;
-                    continue;
-                }
-                if (ret > 0)
-                    mInputBufferFrameCountOffset -= reqInputFrameCount;
-                pBuffer->raw = (void *)mOutputBuffer;
-                pBuffer->frameCount = reqOutputFrameCount;
+            memcpy((char *)mInputBuffer + offset, trackBuffer.i8,
+                   trackBuffer.frameCount * frameSize);
+            frameCount -= trackBuffer.frameCount;
+            mInputBufferFrameCountOffset += trackBuffer.frameCount;
+            offset += trackBuffer.frameCount * frameSize;
+            mTrackBufferProvider->releaseBuffer(&trackBuffer);
+        }
+        if (ret != OK) {
+            pBuffer->raw = NULL;
+            pBuffer->frameCount = 0;
+            return ret;
+        }
+
+        mEffectsConfig.inputCfg.buffer.frameCount = reqInputFrameCount;
+        mEffectsConfig.inputCfg.buffer.raw = input;
+        mEffectsConfig.outputCfg.buffer.frameCount = reqOutputFrameCount;
+        mEffectsConfig.outputCfg.buffer.raw = (void *)mOutputBuffer;
+
+        ret = (*mEffectsHandle)->process(mEffectsHandle,
+                                      &mEffectsConfig.inputCfg.buffer,
+                                      &mEffectsConfig.outputCfg.buffer);
+        if (direct) {
+            if (ret != -ENODATA && ret <= 0) {
+                // input not consumed: keep it as residual for the next call
+                memcpy(mInputBuffer, trackBuffer.raw, reqInputFrameCount * frameSize);
+                mInputBufferFrameCountOffset = reqInputFrameCount;
             }
+            mTrackBufferProvider->releaseBuffer(&trackBuffer);
+        } else if (ret == -ENODATA || ret > 0) {
+            consumeInputFrames(reqInputFrameCount);
+        }
+        if (ret == -ENODATA) {
+            ALOGV("Continue to provide more data for initial buffering");
+            continue;
+        }
+        if (ret < 0) {
+            // no output this time, e.g. the accelerator is late
+            pBuffer->raw = NULL;
+            pBuffer->frameCount = 0;
             return ret;
         }
-    } else {
-        ALOGE("EffBufferProvider::getNextBuffer() error: NULL track buffer provider");
-        return NO_INIT;
+        pBuffer->raw = (void *)mOutputBuffer;
+        pBuffer->frameCount = reqOutputFrameCount;
+        return ret;
     }
 }
 
@@ -143,7 +198,7 @@ void EffectsHwAcc::EffectsBufferProvider::releaseBuffer(
 }
 
 EffectsHwAcc::EffectsHwAcc(uint32_t sampleRate)
-             : mEnabled(false), mFd(-1), mBufferProvider(NULL),
+             : mEnabled(false), mFd(-1), mLatencyUs(0), mBufferProvider(NULL),
                mInputSampleRate(sampleRate), mOutputSampleRate(sampleRate)
 {
 }
@@ -205,7 +260,7 @@ status_t EffectsHwAcc::prepareEffects(AudioBufferProvider **bufferProvider,
     int cmdStatus;
     uint32_t replySize;
     uint32_t size = (sizeof(effect_param_t) + 2 * sizeof(int32_t) - 1) /
-                    (sizeof(uint32_t) + 1);
+                    sizeof(uint32_t) + 1;
     uint32_t buf32[size];
     effect_param_t *param = (effect_param_t *)buf32;
 
@@ -300,10 +355,27 @@ status_t EffectsHwAcc::prepareEffects(AudioBufferProvider **bufferProvider,
     }
     mFd = *(int32_t *)(param->data + sizeof(int32_t));
 
-    pHwAccbp->mInputBuffer = calloc(6*frameCount,
-                                    /* 6 times buffering to account for an input of
-                                       192kHz to an output of 32kHz - may be a least
-                                       sampling rate of rendering device */
+    param->psize = sizeof(int32_t);
+    *(int32_t *)param->data = HW_ACCELERATOR_LATENCY_US;
+    param->vsize = sizeof(int32_t);
+    replySize = sizeof(effect_param_t) +
+                ((param->psize - 1) / sizeof(int) + 1) * sizeof(int) +
+                param->vsize;
+    status = (*pHwAccbp->mEffectsHandle)->command(pHwAccbp->mEffectsHandle,
+                                          EFFECT_CMD_GET_PARAM,
+                                          sizeof(effect_param_t) + param->psize,
+                                          param, &replySize, param);
+    if ((status == 0) && (param->status == 0))
+        mLatencyUs = *(int32_t *)(param->data + sizeof(int32_t));
+    else
+        mLatencyUs = 0;
+    ALOGV("h/w acc effects latency %u us", mLatencyUs);
+
+    // staging buffer holds the input needed for one output buffer at the actual
+    // rate ratio, plus one frame for rounding
+    pHwAccbp->mInputBufferFrameCount = ((uint64_t)frameCount * mInputSampleRate +
+                                        mOutputSampleRate - 1) / mOutputSampleRate + 1;
+    pHwAccbp->mInputBuffer = calloc(pHwAccbp->mInputBufferFrameCount,
                                     FRAME_SIZE(pHwAccbp->mEffectsConfig.inputCfg.format) *
                                     popcount(channelMask));
     if (!pHwAccbp->mInputBuffer)
@@ -69,10 +69,19 @@ public:
         void *mInputBuffer;
         void *mOutputBuffer;
         uint32_t mInputBufferFrameCountOffset;
+        uint32_t mInputBufferFrameCount;    // capacity of mInputBuffer in frames
+
+    private:
+        size_t inputFramesFor(size_t outputFrameCount) const;
+        void consumeInputFrames(size_t frameCount);
     };
 
+    // delay added by the accelerator pipeline, reported by the effect
+    uint32_t getLatencyUs() const { return mLatencyUs; }
+
     bool mEnabled;
     int32_t mFd;
+    uint32_t mLatencyUs;
 
     EffectsBufferProvider* mBufferProvider;
 
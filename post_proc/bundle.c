@@ -212,7 +212,6 @@ int offload_effects_bundle_hal_start_output(audio_io_handle_t output, int pcm_id
 {
     int ret = 0;
     struct listnode *node;
-    char mixer_string[128];
     output_context_t * out_ctxt = NULL;
 
     ALOGV("%s output %d pcm_id %d", __func__, output, pcm_id);
@@ -242,28 +241,15 @@ int offload_effects_bundle_hal_start_output(audio_io_handle_t output, int pcm_id
     out_ctxt->pcm_device_id = pcm_id;
 
     /* populate the mixer control to send offload parameters */
-    snprintf(mixer_string, sizeof(mixer_string),
-             "%s %d", "Audio Effects Config", out_ctxt->pcm_device_id);
-    out_ctxt->mixer = mixer_open(MIXER_CARD);
-    if (!out_ctxt->mixer) {
-        ALOGE("Failed to open mixer");
+    if (offload_update_mixer_and_effects_ctl(MIXER_CARD, out_ctxt->pcm_device_id,
+                                             &out_ctxt->mixer, &out_ctxt->ctl) != 0) {
         out_ctxt->ctl = NULL;
         out_ctxt->ref_ctl = NULL;
         ret = -EINVAL;
         free(out_ctxt);
         goto exit;
-    } else {
-        out_ctxt->ctl = mixer_get_ctl_by_name(out_ctxt->mixer, mixer_string);
-        if (!out_ctxt->ctl) {
-            ALOGE("mixer_get_ctl_by_name failed");
-            mixer_close(out_ctxt->mixer);
-            out_ctxt->mixer = NULL;
-            ret = -EINVAL;
-            free(out_ctxt);
-            goto exit;
-        }
-        out_ctxt->ref_ctl = out_ctxt->ctl;
     }
+    out_ctxt->ref_ctl = out_ctxt->ctl;
 
     list_init(&out_ctxt->effects_list);
 
@@ -306,7 +292,7 @@ int offload_effects_bundle_hal_stop_output(audio_io_handle_t output, int pcm_id)
     }
 
     if (out_ctxt->mixer)
-        mixer_close(out_ctxt->mixer);
+        offload_close_mixer(&out_ctxt->mixer);
 
     list_for_each(fx_node, &out_ctxt->effects_list) {
         effect_context_t *fx_ctxt = node_to_item(fx_node,
@@ -329,6 +315,16 @@ exit:
     return ret;
 }
 
+__attribute__ ((visibility ("default")))
+void offload_effects_bundle_hal_set_mixer_ops(struct mixer *(*acquire)(int card),
+                                              void (*release)(struct mixer *mixer),
+                                              struct mixer_ctl *(*get_ctl)(struct mixer *mixer,
+                                                                           const char *name))
+{
+    ALOGV("%s", __func__);
+    offload_set_mixer_ops(acquire, release, get_ctl);
+}
+
 __attribute__ ((visibility ("default")))
 int offload_effects_bundle_set_hpx_state(bool hpx_state)
 {
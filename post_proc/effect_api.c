@@ -57,6 +57,7 @@
 #include <stdbool.h>
 #include <cutils/log.h>
 #include <errno.h>
+#include <time.h>
 #include <tinyalsa/asoundlib.h>
 #include <sound/audio_effects.h>
 #include <sound/devdep_params.h>
@@ -99,36 +100,63 @@ const int map_reverb_opensl_preset_2_offload_preset
     {6, 20}
 };
 
+/* shared mixer pool of the audio HAL, NULL when the library is not loaded by the HAL */
+static struct mixer *(*hal_mixer_acquire)(int card);
+static void (*hal_mixer_release)(struct mixer *mixer);
+static struct mixer_ctl *(*hal_mixer_get_ctl)(struct mixer *mixer, const char *name);
+
+void offload_set_mixer_ops(struct mixer *(*acquire)(int card),
+                           void (*release)(struct mixer *mixer),
+                           struct mixer_ctl *(*get_ctl)(struct mixer *mixer,
+                                                        const char *name))
+{
+    if (!acquire || !release || !get_ctl)
+        acquire = NULL, release = NULL, get_ctl = NULL;
+    hal_mixer_acquire = acquire;
+    hal_mixer_release = release;
+    hal_mixer_get_ctl = get_ctl;
+}
+
 int offload_update_mixer_and_effects_ctl(int card, int device_id,
                                          struct mixer **mixer,
                                          struct mixer_ctl **ctl)
 {
     char mixer_string[128];
+    struct timespec start, end;
 
     snprintf(mixer_string, sizeof(mixer_string),
              "%s %d", "Audio Effects Config", device_id);
     ALOGV("%s: mixer_string: %s", __func__, mixer_string);
-    *mixer = mixer_open(card);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    *mixer = hal_mixer_acquire ? hal_mixer_acquire(card) : mixer_open(card);
     if (!(*mixer)) {
         ALOGE("Failed to open mixer");
         *ctl = NULL;
         return -EINVAL;
     } else {
-        *ctl = mixer_get_ctl_by_name(*mixer, mixer_string);
+        *ctl = hal_mixer_get_ctl ? hal_mixer_get_ctl(*mixer, mixer_string) :
+                                   mixer_get_ctl_by_name(*mixer, mixer_string);
         if (!*ctl) {
             ALOGE("mixer_get_ctl_by_name failed");
-            mixer_close(*mixer);
+            offload_close_mixer(mixer);
             *mixer = NULL;
             return -EINVAL;
         }
     }
-    ALOGV("mixer: %p, ctl: %p", *mixer, *ctl);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    ALOGV("mixer: %p, ctl: %p, %s in %ld us", *mixer, *ctl,
+          hal_mixer_acquire ? "shared" : "opened",
+          (long)((end.tv_sec - start.tv_sec) * 1000000 +
+                 (end.tv_nsec - start.tv_nsec) / 1000));
     return 0;
 }
 
 void offload_close_mixer(struct mixer **mixer)
 {
-    mixer_close(*mixer);
+    if (hal_mixer_release)
+        hal_mixer_release(*mixer);
+    else
+        mixer_close(*mixer);
 }
 
 void offload_bassboost_set_device(struct bass_boost_params *bassboost,
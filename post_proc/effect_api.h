@@ -38,6 +38,10 @@ int offload_update_mixer_and_effects_ctl(int card, int device_id,
                                          struct mixer **mixer,
                                          struct mixer_ctl **ctl);
 void offload_close_mixer(struct mixer **mixer);
+void offload_set_mixer_ops(struct mixer *(*acquire)(int card),
+                           void (*release)(struct mixer *mixer),
+                           struct mixer_ctl *(*get_ctl)(struct mixer *mixer,
+                                                        const char *name));
 
 #define OFFLOAD_SEND_BASSBOOST_ENABLE_FLAG      (1 << 0)
 #define OFFLOAD_SEND_BASSBOOST_STRENGTH         \
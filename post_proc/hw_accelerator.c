@@ -33,7 +33,11 @@
 
 #include <cutils/list.h>
 #include <cutils/log.h>
+#include <cutils/properties.h>
+#include <errno.h>
 #include <fcntl.h>
+#include <poll.h>
+#include <stdlib.h>
 #include <tinyalsa/asoundlib.h>
 #include <sound/audio_effects.h>
 #include <audio_effects/effect_hwaccelerator.h>
@@ -54,6 +58,65 @@ const effect_descriptor_t hw_accelerator_descriptor = {
         "QTI",
 };
 
+/* wait until the driver is ready for events (POLLOUT to write, POLLIN to read) */
+static int hw_accelerator_wait(int fd, short events, int timeout_ms)
+{
+    struct pollfd pfd;
+    int ret;
+
+    pfd.fd = fd;
+    pfd.events = events;
+    pfd.revents = 0;
+    do {
+        ret = poll(&pfd, 1, timeout_ms);
+    } while (ret < 0 && errno == EINTR);
+    if (ret < 0)
+        return -errno;
+    if (ret == 0)
+        return -ETIMEDOUT;
+    if (pfd.revents & (POLLERR | POLLNVAL))
+        return -EIO;
+    return 0;
+}
+
+/* play time of one output buffer, the longest the mixer thread waits on a read */
+static int hw_accelerator_buffer_ms(effect_context_t *context, audio_buffer_t *out_buf)
+{
+    uint32_t rate = context->config.outputCfg.samplingRate;
+
+    if (rate == 0)
+        return 1;
+    return (int)(((uint64_t)out_buf->frameCount * 1000 + rate - 1) / rate);
+}
+
+/* -EAGAIN if the oldest buffer in flight is not back within one buffer duration */
+static int hw_accelerator_wait_output(hw_accelerator_context_t *hw_acc_ctxt,
+                                      audio_buffer_t *out_buf)
+{
+    int ret;
+
+    ret = hw_accelerator_wait(hw_acc_ctxt->fd, POLLIN,
+                              hw_accelerator_buffer_ms(&hw_acc_ctxt->common, out_buf));
+    if (ret == -ETIMEDOUT) {
+        ALOGW("%s: output late, %u buffers in flight", __func__, hw_acc_ctxt->in_flight);
+        return -EAGAIN;
+    }
+    if (ret < 0) {
+        ALOGE("%s: error %d waiting for read buffer", __func__, ret);
+        return -EFAULT;
+    }
+    return 0;
+}
+
+int hw_accelerator_get_latency_us(hw_accelerator_context_t *hw_acc_ctxt)
+{
+    uint32_t rate = hw_acc_ctxt->common.config.outputCfg.samplingRate;
+
+    if (rate == 0)
+        return 0;
+    return (int)(((uint64_t)hw_acc_ctxt->depth * hw_acc_ctxt->frame_count * 1000000) / rate);
+}
+
 int hw_accelerator_get_parameter(effect_context_t *context,
                                  effect_param_t *p, uint32_t *size)
 {
@@ -70,6 +133,7 @@ int hw_accelerator_get_parameter(effect_context_t *context,
 
     switch (param) {
     case HW_ACCELERATOR_FD:
+    case HW_ACCELERATOR_LATENCY_US:
         if (p->vsize < sizeof(int32_t))
            p->status = -EINVAL;
         p->vsize = sizeof(int32_t);
@@ -89,6 +153,11 @@ int hw_accelerator_get_parameter(effect_context_t *context,
         *(int32_t *)value = hw_acc_ctxt->fd;
         break;
 
+    case HW_ACCELERATOR_LATENCY_US:
+        *(int32_t *)value = hw_accelerator_get_latency_us(hw_acc_ctxt);
+        ALOGV("%s: HW_ACCELERATOR_LATENCY_US %d", __func__, *(int32_t *)value);
+        break;
+
     default:
         p->status = -EINVAL;
         break;
@@ -162,6 +231,7 @@ int hw_accelerator_init(effect_context_t *context)
     set_config(context, &context->config);
 
     hw_acc_ctxt->fd = -1;
+    hw_acc_ctxt->depth = HW_ACCELERATOR_DEFAULT_PIPELINE_DEPTH;
     memset(&(hw_acc_ctxt->cfg), 0, sizeof(struct msm_hwacc_effects_config));
 
     return 0;
@@ -196,6 +266,7 @@ int hw_accelerator_set_mode(effect_context_t *context, int32_t frame_count)
            hw_acc_ctxt->cfg.input.sample_rate, hw_acc_ctxt->cfg.input.num_channels,
            hw_acc_ctxt->cfg.input.bits_per_sample);
 
+    hw_acc_ctxt->frame_count = frame_count;
     hw_acc_ctxt->cfg.output.num_buf = 4;
     hw_acc_ctxt->cfg.input.num_buf = 2;
 
@@ -219,8 +290,23 @@ int hw_accelerator_set_mode(effect_context_t *context, int32_t frame_count)
 int hw_accelerator_enable(effect_context_t *context)
 {
     hw_accelerator_context_t *hw_acc_ctxt = (hw_accelerator_context_t *)context;
+    char value[PROPERTY_VALUE_MAX];
+    int depth;
 
     ALOGV("%s: ctxt %p", __func__, hw_acc_ctxt);
+    property_get(HW_ACCELERATOR_PIPELINE_DEPTH_PROPERTY, value, "");
+    depth = atoi(value);
+    if (depth < 1)
+        depth = HW_ACCELERATOR_DEFAULT_PIPELINE_DEPTH;
+    /* one write buffer must remain free for the buffer being queued */
+    if (depth > hw_acc_ctxt->cfg.output.num_buf - 1)
+        depth = hw_acc_ctxt->cfg.output.num_buf - 1;
+    hw_acc_ctxt->depth = depth;
+    hw_acc_ctxt->in_flight = 0;
+    hw_acc_ctxt->buf_len_set = false;
+    ALOGV("%s: pipeline depth %d, latency %d us", __func__, hw_acc_ctxt->depth,
+          hw_accelerator_get_latency_us(hw_acc_ctxt));
+
     hw_acc_ctxt->fd = open("/dev/msm_hweffects", O_RDWR | O_NONBLOCK);
     /* open driver */
     if (hw_acc_ctxt->fd < 0) {
@@ -270,13 +356,20 @@ int hw_accelerator_release(effect_context_t *context)
     return 0;
 }
 
+/* Pipelined process: the input buffer is queued before reading back the output of a buffer
+ * queued depth calls earlier, so the DSP works on buffer k+1 while buffer k is read. Returns
+ * -ENODATA while the pipeline fills, the number of input frames consumed otherwise, or 0 if
+ * the accelerator could not accept the input buffer this time. The write never blocks and
+ * the output is waited for, at most one buffer duration, before anything is queued: late
+ * output returns -EAGAIN with the input not consumed, so at most depth + 1 buffers are ever
+ * in flight. */
 int hw_accelerator_process(effect_context_t *context, audio_buffer_t *in_buf,
                            audio_buffer_t *out_buf)
 {
     hw_accelerator_context_t *hw_acc_ctxt = (hw_accelerator_context_t *)context;
     struct msm_hwacc_buf_cfg buf_cfg;
-    struct msm_hwacc_buf_avail buf_avail;
-    int ret = 0;
+    bool written = false;
+    int ret;
 
     ALOGV("%s: ctxt %p", __func__, hw_acc_ctxt);
     if (in_buf == NULL || in_buf->raw == NULL ||
@@ -290,39 +383,63 @@ int hw_accelerator_process(effect_context_t *context, audio_buffer_t *in_buf,
                          audio_bytes_per_sample(context->config.outputCfg.format) *
                          hw_acc_ctxt->cfg.input.num_channels;
 
-    if (ioctl(hw_acc_ctxt->fd, AUDIO_EFFECTS_GET_BUF_AVAIL, &buf_avail) < 0) {
-        ALOGE("AUDIO_EFFECTS_GET_BUF_AVAIL failed");
-        return -ENOMEM;
-    }
-
-    if (!hw_acc_ctxt->intial_buffer_done) {
+    /* buffer lengths only change with the format or the mixer frame count */
+    if (!hw_acc_ctxt->buf_len_set ||
+        hw_acc_ctxt->buf_len.output_len != buf_cfg.output_len ||
+        hw_acc_ctxt->buf_len.input_len != buf_cfg.input_len) {
         if (ioctl(hw_acc_ctxt->fd, AUDIO_EFFECTS_SET_BUF_LEN, &buf_cfg) < 0) {
             ALOGE("AUDIO_EFFECTS_BUF_CFG failed");
+            hw_acc_ctxt->buf_len_set = false;
             return -EFAULT;
         }
+        hw_acc_ctxt->buf_len = buf_cfg;
+        hw_acc_ctxt->buf_len_set = true;
+    }
+
+    /* once the pipeline is full this call reads, make sure the output is there first */
+    if (hw_acc_ctxt->in_flight >= hw_acc_ctxt->depth) {
+        ret = hw_accelerator_wait_output(hw_acc_ctxt, out_buf);
+        if (ret < 0)
+            return ret;
+    }
+
+    ret = hw_accelerator_wait(hw_acc_ctxt->fd, POLLOUT, 0);
+    if (ret == 0) {
         if (ioctl(hw_acc_ctxt->fd, AUDIO_EFFECTS_WRITE, (char *)in_buf->raw) < 0) {
-            ALOGE("AUDIO_EFFECTS_WRITE failed");
-            return -EFAULT;
+            if (errno != EAGAIN) {
+                ALOGE("AUDIO_EFFECTS_WRITE failed");
+                return -EFAULT;
+            }
+        } else {
+            written = true;
+            hw_acc_ctxt->in_flight++;
         }
+    } else if (ret != -ETIMEDOUT) {
+        ALOGE("%s: error %d waiting for write buffer", __func__, ret);
+        return -EFAULT;
+    }
+
+    if (written && hw_acc_ctxt->in_flight <= hw_acc_ctxt->depth) {
         ALOGV("Request for more data");
-        hw_acc_ctxt->intial_buffer_done = true;
         return -ENODATA;
     }
-    if (buf_avail.output_num_avail > 1) {
-        if (ioctl(hw_acc_ctxt->fd, AUDIO_EFFECTS_SET_BUF_LEN, &buf_cfg) < 0) {
-            ALOGE("AUDIO_EFFECTS_BUF_CFG failed");
-            return -EFAULT;
-        }
-        if (ioctl(hw_acc_ctxt->fd, AUDIO_EFFECTS_WRITE, (char *)in_buf->raw) < 0) {
-            ALOGE("AUDIO_EFFECTS_WRITE failed");
-            return -EFAULT;
-        }
-        ret = in_buf->frameCount;
+    if (hw_acc_ctxt->in_flight == 0) {
+        ALOGW("%s: accelerator not accepting data", __func__);
+        return -EAGAIN;
     }
+
+    /* pipeline still filling but the write was refused: drain what is in flight */
+    if (hw_acc_ctxt->in_flight < hw_acc_ctxt->depth) {
+        ret = hw_accelerator_wait_output(hw_acc_ctxt, out_buf);
+        if (ret < 0)
+            return ret;
+    }
+
     if (ioctl(hw_acc_ctxt->fd, AUDIO_EFFECTS_READ, (char *)out_buf->raw) < 0) {
         ALOGE("AUDIO_EFFECTS_READ failed");
         return -EFAULT;
     }
+    hw_acc_ctxt->in_flight--;
 
-    return ret;
+    return written ? (int)in_buf->frameCount : 0;
 }
@@ -35,8 +35,21 @@
 
 #include <linux/msm_audio.h>
 
+#if __cplusplus
+extern "C" {
+#endif
+
 #define HWACCELERATOR_OUTPUT_CHANNELS AUDIO_CHANNEL_OUT_STEREO
 
+/* Local parameter, in addition to those of effect_hwaccelerator.h: delay added by the
+ * accelerator pipeline in microseconds (int32_t, read only) */
+#define HW_ACCELERATOR_LATENCY_US 0x1000
+
+/* number of buffers kept in flight in the accelerator. 1 gives the legacy behavior of
+ * writing buffer k+1 before reading buffer k */
+#define HW_ACCELERATOR_PIPELINE_DEPTH_PROPERTY "audio.hwacc.pipeline.depth"
+#define HW_ACCELERATOR_DEFAULT_PIPELINE_DEPTH 1
+
 extern const effect_descriptor_t hw_accelerator_descriptor;
 
 typedef struct hw_accelerator_context_s {
@@ -44,7 +57,11 @@ typedef struct hw_accelerator_context_s {
 
     int fd;
     uint32_t device;
-    bool intial_buffer_done;
+    uint32_t depth;      /* buffers in flight between process calls */
+    uint32_t in_flight;  /* buffers written and not read back yet */
+    uint32_t frame_count;
+    bool buf_len_set;    /* buf_len has been sent to the driver */
+    struct msm_hwacc_buf_cfg buf_len;
     struct msm_hwacc_effects_config cfg;
 } hw_accelerator_context_t;
 
@@ -68,7 +85,13 @@ int hw_accelerator_release(effect_context_t *context);
 
 int hw_accelerator_set_mode(effect_context_t *context,  int32_t frame_count);
 
+int hw_accelerator_get_latency_us(hw_accelerator_context_t *hw_acc_ctxt);
+
 int hw_accelerator_process(effect_context_t *context, audio_buffer_t *in,
                            audio_buffer_t *out);
 
+#if __cplusplus
+} //extern "C"
+#endif
+
 #endif /* HW_ACCELERATOR_EFFECT_H_ */
@@ -96,31 +96,77 @@ typedef struct output_context_s {
 
 #define DISCARD_MEASUREMENTS_TIME_MS 2000 /* discard measurements older than this number of ms */
 
+/* proxy capture is disabled when no capture or measurement was requested for this long while
+ * effects are enabled. The next request resumes it and gets silence until new data arrives */
+#define CAPTURE_IDLE_TIMEOUT_MS 5000
+
 /* maximum number of buffers for which we keep track of the measurements */
 #define MEASUREMENT_WINDOW_MAX_SIZE_IN_BUFFERS 25 /* note: buffer index is stored in uint8_t */
 
+/* number of times a reader retries a snapshot overtaken by the capture thread */
+#define CAPTURE_READ_RETRIES 3
+
+/* Offload specific measurement mode and parameters, in addition to those of
+ * effect_visualizer.h. The spectrum and loudness are computed once per capture period on the
+ * capture thread from the 16 bit proxy capture and shared by all visualizers requesting them. */
+#define MEASUREMENT_MODE_SPECTRUM_LOUDNESS 0x2
+/* int32_t[SPECTRUM_NB_BANDS]: energy of each band in mB relative to a full scale sine */
+#define VISUALIZER_PARAM_SPECTRUM_BANDS 0x1000
+/* int32_t[LOUDNESS_IDX_CNT]: EBU R128 loudness in hundredths of LUFS */
+#define VISUALIZER_PARAM_LOUDNESS 0x1001
+
+#define LOUDNESS_IDX_MOMENTARY 0
+#define LOUDNESS_IDX_SHORT_TERM 1
+#define LOUDNESS_IDX_CNT 2
+
+#define SPECTRUM_FFT_ORDER 10
+#define SPECTRUM_FFT_SIZE (1 << SPECTRUM_FFT_ORDER)
+#define SPECTRUM_NB_BANDS 16
+#define SPECTRUM_MIN_MB (-9600)
+
 typedef struct buffer_stats_s {
     bool is_valid;
     uint16_t peak_u16; /* the positive peak of the absolute value of the samples in a buffer */
     float rms_squared; /* the average square of the samples in a buffer */
+    int64_t time_ms; /* CLOCK_MONOTONIC time at which the buffer was measured */
 } buffer_stats_t;
 
+/* Capture ring shared by all visualizer instances. The proxy port delivers one mix for all
+ * offloaded outputs, so the capture thread converts each period once and every effect reads
+ * its own snapshot from here.
+ * Single writer (capture thread), any number of readers, no lock: frames are numbered by
+ * write_seq, which is published with release semantics after the frames are written. A reader
+ * copies a window and then checks that the writer has not wrapped over it in the meantime.
+ * Measurements are protected by meas_seq, a seqlock counter which is odd while an entry is
+ * being rewritten. */
+typedef struct capture_ring_s {
+    /* 8 bit mono samples for each scaling mode, indexed by VISUALIZER_SCALING_MODE_xxx */
+    uint8_t buf[VISUALIZER_SCALING_MODE_AS_PLAYED + 1][CAPTURE_BUF_SIZE];
+    uint64_t write_seq; /* sequence number of the next frame to be written */
+    int64_t update_time_ms; /* CLOCK_MONOTONIC time of the last write, 0 if idle */
+    uint32_t meas_seq;
+    uint8_t meas_idx;
+    buffer_stats_t meas[MEASUREMENT_WINDOW_MAX_SIZE_IN_BUFFERS];
+    /* spectrum and loudness, protected by spectrum_seq in the same way as measurements */
+    uint32_t spectrum_seq;
+    int64_t spectrum_time_ms; /* 0 if never computed */
+    int32_t bands_mb[SPECTRUM_NB_BANDS];
+    int32_t loudness[LOUDNESS_IDX_CNT];
+} capture_ring_t;
+
 typedef struct visualizer_context_s {
     effect_context_t common;
 
-    uint32_t capture_idx;
     uint32_t capture_size;
     uint32_t scaling_mode;
-    uint32_t last_capture_idx;
+    uint64_t last_capture_seq;
     uint32_t latency;
-    struct timespec buffer_update_time;
-    uint8_t capture_buf[CAPTURE_BUF_SIZE];
+    bool attached; /* true while the output the effect is attached to is started */
     /* for measurements */
     uint8_t channel_count; /* to avoid recomputing it every time a buffer is processed */
     uint32_t meas_mode;
     uint8_t meas_wndw_size_in_buffers;
-    uint8_t meas_buffer_idx;
-    buffer_stats_t past_meas[MEASUREMENT_WINDOW_MAX_SIZE_IN_BUFFERS];
+    int64_t last_request_ms; /* CLOCK_MONOTONIC time of the last capture or measure request */
 } visualizer_context_t;
 
 
@@ -165,10 +211,20 @@ pthread_mutex_t thread_lock;
 /* cond is signaled when an output is started or stopped or an effect is enabled or disable: the
  * capture thread will reevaluate the capture and effect rocess conditions. */
 pthread_cond_t cond;
+/* written by the capture thread only, read by visualizer commands without lock */
+capture_ring_t capture_ring;
+/* true while effects are enabled but the capture thread has disabled proxy capture because no
+ * visualizer asked for data in the last CAPTURE_IDLE_TIMEOUT_MS */
+bool capture_parked;
 /* true when requesting the capture thread to exit */
 bool exit_thread;
 /* 0 if the capture thread was created successfully */
 int thread_status;
+/* shared mixer pool of the audio HAL, set by visualizer_hal_set_mixer_ops(). When not set the
+ * capture thread opens its own mixer */
+struct mixer *(*hal_mixer_acquire)(int card);
+void (*hal_mixer_release)(struct mixer *mixer);
+struct mixer_ctl *(*hal_mixer_get_ctl)(struct mixer *mixer, const char *name);
 
 
 #define DSP_OUTPUT_LATENCY_MS 0 /* Fudge factor for latency after capture point in audio DSP */
@@ -212,6 +268,7 @@ static void init_once() {
     pthread_cond_init(&cond, NULL);
     exit_thread = false;
     thread_status = -1;
+    memset(capture_ring.buf, 0x80, sizeof(capture_ring.buf));
 
     init_status = 0;
 }
@@ -300,10 +357,455 @@ bool effects_enabled() {
     return false;
 }
 
+/* returns the union of the measurement modes of all active visualizers */
+uint32_t measurement_modes() {
+    struct listnode *out_node;
+    uint32_t modes = MEASUREMENT_MODE_NONE;
+
+    list_for_each(out_node, &active_outputs_list) {
+        struct listnode *fx_node;
+        output_context_t *out_ctxt = node_to_item(out_node,
+                                                  output_context_t,
+                                                  outputs_list_node);
+
+        list_for_each(fx_node, &out_ctxt->effects_list) {
+            effect_context_t *fx_ctxt = node_to_item(fx_node,
+                                                         effect_context_t,
+                                                         output_node);
+            if (fx_ctxt->state == EFFECT_STATE_ACTIVE &&
+                    fx_ctxt->desc == &visualizer_descriptor)
+                modes |= ((visualizer_context_t *)fx_ctxt)->meas_mode;
+        }
+    }
+    return modes;
+}
+
+/* soundfx library, audio_extn_utils_get_time_us() of the HAL is not linked in */
+static int64_t get_time_ms() {
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) < 0)
+        return 0;
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/*
+ * Spectrum and loudness analysis, run on the capture thread only
+ */
+
+/* EBU R128 windows expressed in capture periods */
+#define LOUDNESS_MOMENTARY_BLOCKS \
+        ((400 * AUDIO_CAPTURE_SMP_RATE / 1000 + AUDIO_CAPTURE_PERIOD_SIZE - 1) / \
+         AUDIO_CAPTURE_PERIOD_SIZE)
+#define LOUDNESS_SHORT_TERM_BLOCKS \
+        ((3000 * AUDIO_CAPTURE_SMP_RATE / 1000 + AUDIO_CAPTURE_PERIOD_SIZE - 1) / \
+         AUDIO_CAPTURE_PERIOD_SIZE)
+
+typedef struct biquad_s {
+    double b0, b1, b2, a1, a2;
+} biquad_t;
+
+/* ITU-R BS.1770 K-weighting at 48 kHz: high shelf followed by RLB high pass */
+static const biquad_t k_weighting[2] = {
+    { 1.53512485958697, -2.69169618940638, 1.19839281085285,
+     -1.69065929318241, 0.73248077421585 },
+    { 1.0, -2.0, 1.0, -1.99004745483398, 0.99007225036621 },
+};
+
+typedef struct spectrum_analysis_s {
+    bool tables_ready;
+    bool active;
+    float window[SPECTRUM_FFT_SIZE];  /* Hann window */
+    float cos_tbl[SPECTRUM_FFT_SIZE / 2];
+    float sin_tbl[SPECTRUM_FFT_SIZE / 2];
+    uint16_t bitrev[SPECTRUM_FFT_SIZE / 2];
+    uint16_t band_edge[SPECTRUM_NB_BANDS + 1];  /* first bin of each band */
+    float history[SPECTRUM_FFT_SIZE];  /* last FFT_SIZE mono samples, oldest first */
+    float re[SPECTRUM_FFT_SIZE / 2];
+    float im[SPECTRUM_FFT_SIZE / 2];
+    float power[SPECTRUM_FFT_SIZE / 2 + 1];
+    /* K-weighting filter state (transposed direct form II) per channel and stage */
+    double kw_state[AUDIO_CAPTURE_CHANNEL_COUNT][2][2];
+    double block_ms[LOUDNESS_SHORT_TERM_BLOCKS];  /* K-weighted mean square per period */
+    uint32_t block_idx;
+    uint32_t block_cnt;
+} spectrum_analysis_t;
+
+static spectrum_analysis_t analysis;
+
+static void spectrum_init_tables() {
+    const uint32_t half = SPECTRUM_FFT_SIZE / 2;
+    uint32_t i;
+
+    for (i = 0; i < SPECTRUM_FFT_SIZE; i++)
+        analysis.window[i] = 0.5f - 0.5f * cosf(2.0f * (float)M_PI * i / SPECTRUM_FFT_SIZE);
+    for (i = 0; i < half; i++) {
+        uint32_t b, r = 0;
+
+        analysis.cos_tbl[i] = cosf(2.0f * (float)M_PI * i / SPECTRUM_FFT_SIZE);
+        analysis.sin_tbl[i] = sinf(2.0f * (float)M_PI * i / SPECTRUM_FFT_SIZE);
+        for (b = 0; b < SPECTRUM_FFT_ORDER - 1; b++)
+            r |= ((i >> b) & 1) << (SPECTRUM_FFT_ORDER - 2 - b);
+        analysis.bitrev[i] = r;
+    }
+    /* logarithmically spaced bands from the first bin to Nyquist, at least one bin wide */
+    analysis.band_edge[0] = 1;
+    for (i = 1; i <= SPECTRUM_NB_BANDS; i++) {
+        uint32_t edge = (uint32_t)(powf(2.0f, (float)i * (SPECTRUM_FFT_ORDER - 1) /
+                                   SPECTRUM_NB_BANDS) + 0.5f);
+        if (edge <= analysis.band_edge[i - 1])
+            edge = analysis.band_edge[i - 1] + 1;
+        analysis.band_edge[i] = edge;
+    }
+    analysis.band_edge[SPECTRUM_NB_BANDS] = half + 1;
+    analysis.tables_ready = true;
+}
+
+static void spectrum_reset() {
+    if (!analysis.tables_ready)
+        spectrum_init_tables();
+    memset(analysis.history, 0, sizeof(analysis.history));
+    memset(analysis.kw_state, 0, sizeof(analysis.kw_state));
+    analysis.block_idx = 0;
+    analysis.block_cnt = 0;
+    analysis.active = true;
+}
+
+/* Power spectrum of the windowed history: real FFT of size N computed as a complex FFT of
+ * size N/2 on the interleaved even/odd samples followed by a split step. Loops are kept free
+ * of dependencies across iterations so that they vectorize. */
+static void spectrum_compute_power() {
+    const uint32_t half = SPECTRUM_FFT_SIZE / 2;
+    float *re = analysis.re;
+    float *im = analysis.im;
+    uint32_t i, j, size;
+
+    for (i = 0; i < half; i++) {
+        uint32_t r = analysis.bitrev[i];
+        re[r] = analysis.history[2 * i] * analysis.window[2 * i];
+        im[r] = analysis.history[2 * i + 1] * analysis.window[2 * i + 1];
+    }
+
+    for (size = 2; size <= half; size <<= 1) {
+        uint32_t hsize = size >> 1;
+        uint32_t step = SPECTRUM_FFT_SIZE / size;
+
+        for (i = 0; i < half; i += size) {
+            for (j = 0; j < hsize; j++) {
+                float wr = analysis.cos_tbl[j * step];
+                float wi = -analysis.sin_tbl[j * step];
+                uint32_t a = i + j;
+                uint32_t b = a + hsize;
+                float tr = wr * re[b] - wi * im[b];
+                float ti = wr * im[b] + wi * re[b];
+                re[b] = re[a] - tr;
+                im[b] = im[a] - ti;
+                re[a] += tr;
+                im[a] += ti;
+            }
+        }
+    }
+
+    analysis.power[0] = (re[0] + im[0]) * (re[0] + im[0]);
+    analysis.power[half] = (re[0] - im[0]) * (re[0] - im[0]);
+    for (i = 1; i < half; i++) {
+        float er = 0.5f * (re[i] + re[half - i]);
+        float ei = 0.5f * (im[i] - im[half - i]);
+        float or = 0.5f * (im[i] + im[half - i]);
+        float oi = -0.5f * (re[i] - re[half - i]);
+        float c = analysis.cos_tbl[i];
+        float s = analysis.sin_tbl[i];
+        float xr = er + c * or + s * oi;
+        float xi = ei + c * oi - s * or;
+        analysis.power[i] = xr * xr + xi * xi;
+    }
+}
+
+static int32_t power_to_mb(double power, double full_scale) {
+    if (power <= 0)
+        return SPECTRUM_MIN_MB;
+    int32_t mb = (int32_t)(1000 * log10(power / full_scale));
+    return mb < SPECTRUM_MIN_MB ? SPECTRUM_MIN_MB : mb;
+}
+
+static int32_t mean_square_to_loudness(double sum, uint32_t count) {
+    /* LUFS = -0.691 + 10 * log10(sum of channel mean squares), reported in 0.01 LU */
+    if (count == 0 || sum <= 0)
+        return SPECTRUM_MIN_MB;
+    int32_t lufs = (int32_t)(100 * (-0.691 + 10 * log10(sum / count)));
+    return lufs < SPECTRUM_MIN_MB ? SPECTRUM_MIN_MB : lufs;
+}
+
+static void spectrum_process(audio_buffer_t *in, int64_t now_ms) {
+    const uint32_t frames = in->frameCount < SPECTRUM_FFT_SIZE ?
+            in->frameCount : SPECTRUM_FFT_SIZE;
+    const uint32_t half = SPECTRUM_FFT_SIZE / 2;
+    /* one sided energy of a full scale sine through the Hann window */
+    const double full_scale = 3.0 * SPECTRUM_FFT_SIZE * SPECTRUM_FFT_SIZE / 32.0;
+    int32_t bands_mb[SPECTRUM_NB_BANDS];
+    int32_t loudness[LOUDNESS_IDX_CNT];
+    double block_ms = 0;
+    uint32_t i, ch, b;
+
+    if (!analysis.active)
+        spectrum_reset();
+
+    /* mono mix at full 16 bit precision */
+    memmove(analysis.history, analysis.history + frames,
+            (SPECTRUM_FFT_SIZE - frames) * sizeof(float));
+    for (i = 0; i < frames; i++) {
+        const int16_t *smp = in->s16 + (in->frameCount - frames + i) * AUDIO_CAPTURE_CHANNEL_COUNT;
+        analysis.history[SPECTRUM_FFT_SIZE - frames + i] =
+                (smp[0] + smp[1]) * (0.5f / 32768.0f);
+    }
+    spectrum_compute_power();
+    for (b = 0; b < SPECTRUM_NB_BANDS; b++) {
+        double energy = 0;
+        for (i = analysis.band_edge[b]; i < analysis.band_edge[b + 1] && i <= half; i++)
+            energy += analysis.power[i];
+        bands_mb[b] = power_to_mb(energy, full_scale);
+    }
+
+    /* K-weighted mean square of this period, summed over channels */
+    for (ch = 0; ch < AUDIO_CAPTURE_CHANNEL_COUNT; ch++) {
+        double acc = 0;
+        for (i = 0; i < in->frameCount; i++) {
+            double x = in->s16[i * AUDIO_CAPTURE_CHANNEL_COUNT + ch] / 32768.0;
+            uint32_t stage;
+            for (stage = 0; stage < 2; stage++) {
+                const biquad_t *f = &k_weighting[stage];
+                double *z = analysis.kw_state[ch][stage];
+                double y = f->b0 * x + z[0];
+                z[0] = f->b1 * x - f->a1 * y + z[1];
+                z[1] = f->b2 * x - f->a2 * y;
+                x = y;
+            }
+            acc += x * x;
+        }
+        block_ms += acc / in->frameCount;
+    }
+    analysis.block_ms[analysis.block_idx] = block_ms;
+    if (++analysis.block_idx >= LOUDNESS_SHORT_TERM_BLOCKS)
+        analysis.block_idx = 0;
+    if (analysis.block_cnt < LOUDNESS_SHORT_TERM_BLOCKS)
+        analysis.block_cnt++;
+
+    const uint32_t momentary_cnt = analysis.block_cnt < LOUDNESS_MOMENTARY_BLOCKS ?
+            analysis.block_cnt : LOUDNESS_MOMENTARY_BLOCKS;
+    double sum = 0;
+    for (i = 0; i < analysis.block_cnt; i++) {
+        /* walk back from the most recent block */
+        uint32_t idx = (analysis.block_idx + LOUDNESS_SHORT_TERM_BLOCKS - 1 - i) %
+                LOUDNESS_SHORT_TERM_BLOCKS;
+        sum += analysis.block_ms[idx];
+        if (i + 1 == momentary_cnt)
+            loudness[LOUDNESS_IDX_MOMENTARY] = mean_square_to_loudness(sum, momentary_cnt);
+    }
+    loudness[LOUDNESS_IDX_SHORT_TERM] = mean_square_to_loudness(sum, analysis.block_cnt);
+
+    __atomic_add_fetch(&capture_ring.spectrum_seq, 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    memcpy(capture_ring.bands_mb, bands_mb, sizeof(bands_mb));
+    memcpy(capture_ring.loudness, loudness, sizeof(loudness));
+    capture_ring.spectrum_time_ms = now_ms;
+    __atomic_add_fetch(&capture_ring.spectrum_seq, 1, __ATOMIC_RELEASE);
+}
+
+/* true if an active visualizer requested data recently. Called with lock held */
+bool capture_demanded() {
+    struct listnode *out_node;
+    int64_t now_ms = get_time_ms();
+
+    list_for_each(out_node, &active_outputs_list) {
+        struct listnode *fx_node;
+        output_context_t *out_ctxt = node_to_item(out_node,
+                                                  output_context_t,
+                                                  outputs_list_node);
+
+        list_for_each(fx_node, &out_ctxt->effects_list) {
+            effect_context_t *fx_ctxt = node_to_item(fx_node,
+                                                         effect_context_t,
+                                                         output_node);
+            if (fx_ctxt->state != EFFECT_STATE_ACTIVE || fx_ctxt->ops.process == NULL)
+                continue;
+            if (fx_ctxt->desc != &visualizer_descriptor)
+                return true;
+            int64_t last_ms = __atomic_load_n(&((visualizer_context_t *)fx_ctxt)->last_request_ms,
+                                              __ATOMIC_SEQ_CST);
+            if (now_ms - last_ms < CAPTURE_IDLE_TIMEOUT_MS)
+                return true;
+        }
+    }
+    return false;
+}
+
+/* Append one capture period to the shared ring. Called from the capture thread only */
+void capture_ring_write(audio_buffer_t *in, uint32_t meas_modes) {
+    uint64_t seq = capture_ring.write_seq;
+    uint32_t capt_idx = (uint32_t)(seq % CAPTURE_BUF_SIZE);
+    int64_t now_ms = get_time_ms();
+    int32_t norm_shift = 32;
+    uint32_t i;
+
+    if (meas_modes & MEASUREMENT_MODE_SPECTRUM_LOUDNESS)
+        spectrum_process(in, now_ms);
+    else
+        analysis.active = false;
+
+    /* all code below assumes stereo 16 bit PCM input */
+    if (meas_modes & MEASUREMENT_MODE_PEAK_RMS) {
+        /* find the peak and RMS squared for the new buffer */
+        buffer_stats_t *stats = &capture_ring.meas[capture_ring.meas_idx];
+        int16_t max_sample = 0;
+        float rms_squared_acc = 0;
+
+        for (i = 0; i < in->frameCount * AUDIO_CAPTURE_CHANNEL_COUNT; i++) {
+            if (in->s16[i] > max_sample) {
+                max_sample = in->s16[i];
+            } else if (-in->s16[i] > max_sample) {
+                max_sample = -in->s16[i];
+            }
+            rms_squared_acc += (in->s16[i] * in->s16[i]);
+        }
+        __atomic_add_fetch(&capture_ring.meas_seq, 1, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+        stats->peak_u16 = (uint16_t)max_sample;
+        stats->rms_squared = rms_squared_acc / (in->frameCount * AUDIO_CAPTURE_CHANNEL_COUNT);
+        stats->time_ms = now_ms;
+        stats->is_valid = true;
+        __atomic_add_fetch(&capture_ring.meas_seq, 1, __ATOMIC_RELEASE);
+        if (++capture_ring.meas_idx >= MEASUREMENT_WINDOW_MAX_SIZE_IN_BUFFERS)
+            capture_ring.meas_idx = 0;
+    }
+
+    /* derive the normalized capture scaling factor from peak value in current buffer:
+     * this gives more interesting captures for display. */
+    for (i = 0; i < in->frameCount * AUDIO_CAPTURE_CHANNEL_COUNT; i++) {
+        int32_t smp = in->s16[i];
+        if (smp < 0) smp = -smp - 1; /* take care to keep the max negative in range */
+        int32_t clz = __builtin_clz(smp);
+        if (norm_shift > clz) norm_shift = clz;
+    }
+    /* A maximum amplitude signal will have 17 leading zeros, which we want to
+     * translate to a shift of 8 (for converting 16 bit to 8 bit) */
+    norm_shift = 25 - norm_shift;
+    /* Never scale by less than 8 to avoid returning unaltered PCM signal. */
+    if (norm_shift < 3) {
+        norm_shift = 3;
+    }
+    /* add one to combine the division by 2 needed after summing
+     * left and right channels below */
+    norm_shift++;
+
+    uint8_t *norm = capture_ring.buf[VISUALIZER_SCALING_MODE_NORMALIZED];
+    uint8_t *played = capture_ring.buf[VISUALIZER_SCALING_MODE_AS_PLAYED];
+    for (i = 0; i < in->frameCount; i++, capt_idx++) {
+        if (capt_idx >= CAPTURE_BUF_SIZE) {
+            /* wrap around */
+            capt_idx = 0;
+        }
+        int32_t smp = in->s16[2 * i] + in->s16[2 * i + 1];
+        norm[capt_idx] = ((uint8_t)(smp >> norm_shift))^0x80;
+        played[capt_idx] = ((uint8_t)(smp >> 9))^0x80;
+    }
+
+    __atomic_store_n(&capture_ring.update_time_ms, now_ms, __ATOMIC_RELAXED);
+    __atomic_store_n(&capture_ring.write_seq, seq + in->frameCount, __ATOMIC_RELEASE);
+}
+
+/* Copy the size frames ending delay frames before the last written one. Can be called from any
+ * thread without lock. Returns the sequence number of the last written frame seen by the copy. */
+uint64_t capture_ring_read(uint32_t scaling_mode, uint8_t *dst, uint32_t size, uint32_t delay) {
+    const uint8_t *buf = capture_ring.buf[scaling_mode == VISUALIZER_SCALING_MODE_AS_PLAYED ?
+            VISUALIZER_SCALING_MODE_AS_PLAYED : VISUALIZER_SCALING_MODE_NORMALIZED];
+    uint64_t end = 0;
+    int retry;
+
+    if (size > CAPTURE_BUF_SIZE - AUDIO_CAPTURE_PERIOD_SIZE)
+        size = CAPTURE_BUF_SIZE - AUDIO_CAPTURE_PERIOD_SIZE;
+
+    for (retry = 0; retry < CAPTURE_READ_RETRIES; retry++) {
+        uint8_t *out = dst;
+        uint32_t remaining = size;
+        int64_t start;
+
+        end = __atomic_load_n(&capture_ring.write_seq, __ATOMIC_ACQUIRE);
+        start = (int64_t)end - size - delay;
+        if (start < 0) {
+            /* nothing captured that far back yet */
+            uint32_t silence = -start < (int64_t)size ? (uint32_t)-start : size;
+            memset(out, 0x80, silence);
+            out += silence;
+            remaining -= silence;
+            start = 0;
+        }
+        uint32_t idx = (uint32_t)(start % CAPTURE_BUF_SIZE);
+        while (remaining > 0) {
+            uint32_t chunk = CAPTURE_BUF_SIZE - idx;
+            if (chunk > remaining)
+                chunk = remaining;
+            memcpy(out, buf + idx, chunk);
+            out += chunk;
+            remaining -= chunk;
+            idx = 0;
+        }
+
+        /* the copy is consistent if the writer, including the period it may be writing
+         * right now, has not wrapped over the first frame we read */
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        uint64_t now = __atomic_load_n(&capture_ring.write_seq, __ATOMIC_RELAXED);
+        if (now + AUDIO_CAPTURE_PERIOD_SIZE <= (uint64_t)start + CAPTURE_BUF_SIZE)
+            return end;
+    }
+    ALOGV("%s reader overtaken by capture thread", __func__);
+    memset(dst, 0x80, size);
+    return end;
+}
+
+/* Snapshot the spectrum and loudness. Can be called from any thread without lock.
+ * Returns false if no recent analysis is available */
+bool capture_ring_read_spectrum(int32_t *bands_mb, int32_t *loudness) {
+    uint32_t seq;
+    int64_t time_ms;
+    int retry;
+
+    for (retry = 0; retry < CAPTURE_READ_RETRIES; retry++) {
+        seq = __atomic_load_n(&capture_ring.spectrum_seq, __ATOMIC_ACQUIRE);
+        if (seq & 1)
+            continue;
+        if (bands_mb != NULL)
+            memcpy(bands_mb, capture_ring.bands_mb, sizeof(capture_ring.bands_mb));
+        if (loudness != NULL)
+            memcpy(loudness, capture_ring.loudness, sizeof(capture_ring.loudness));
+        time_ms = capture_ring.spectrum_time_ms;
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&capture_ring.spectrum_seq, __ATOMIC_RELAXED) == seq)
+            return time_ms != 0 && get_time_ms() - time_ms <= DISCARD_MEASUREMENTS_TIME_MS;
+    }
+    return false;
+}
+
+/* Snapshot the measurement window. Can be called from any thread without lock */
+void capture_ring_read_measurements(buffer_stats_t *meas) {
+    uint32_t seq;
+    int retry;
+
+    for (retry = 0; retry < CAPTURE_READ_RETRIES; retry++) {
+        seq = __atomic_load_n(&capture_ring.meas_seq, __ATOMIC_ACQUIRE);
+        if (seq & 1)
+            continue;
+        memcpy(meas, capture_ring.meas, sizeof(capture_ring.meas));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&capture_ring.meas_seq, __ATOMIC_RELAXED) == seq)
+            return;
+    }
+    memset(meas, 0, sizeof(capture_ring.meas));
+}
+
 int set_control(const char* name, struct mixer *mixer, int value) {
     struct mixer_ctl *ctl;
 
-    ctl = mixer_get_ctl_by_name(mixer, name);
+    ctl = hal_mixer_get_ctl ? hal_mixer_get_ctl(mixer, name) : mixer_get_ctl_by_name(mixer, name);
     if (ctl == NULL) {
         ALOGW("%s: could not get %s ctl", __func__, name);
         return -EINVAL;
@@ -350,6 +852,7 @@ void *capture_thread_loop(void *arg)
     struct pcm *pcm = NULL;
     int ret;
     int retry_num = 0;
+    int64_t resume_ms = 0;
 
     ALOGD("thread enter");
 
@@ -357,10 +860,10 @@ void *capture_thread_loop(void *arg)
 
     pthread_mutex_lock(&lock);
 
-    mixer = mixer_open(MIXER_CARD);
+    mixer = hal_mixer_acquire ? hal_mixer_acquire(MIXER_CARD) : mixer_open(MIXER_CARD);
     while (mixer == NULL && retry_num < RETRY_NUMBER) {
         usleep(RETRY_US);
-        mixer = mixer_open(MIXER_CARD);
+        mixer = hal_mixer_acquire ? hal_mixer_acquire(MIXER_CARD) : mixer_open(MIXER_CARD);
         retry_num++;
     }
     if (mixer == NULL) {
@@ -372,7 +875,12 @@ void *capture_thread_loop(void *arg)
         if (exit_thread) {
             break;
         }
-        if (effects_enabled()) {
+        if (effects_enabled() && capture_demanded()) {
+            if (capture_parked) {
+                ALOGD("%s: capture resumed", __func__);
+                __atomic_store_n(&capture_parked, false, __ATOMIC_SEQ_CST);
+                resume_ms = get_time_ms();
+            }
             if (!capture_enabled) {
                 ret = configure_proxy_capture(mixer, 1);
                 if (ret == 0) {
@@ -397,6 +905,18 @@ void *capture_thread_loop(void *arg)
                 ALOGD("%s: capture DISABLED", __func__);
                 capture_enabled = false;
             }
+            if (effects_enabled()) {
+                /* publish parked state before checking demand again: a reader either sees
+                 * it and signals cond, or its request is seen by capture_demanded() */
+                if (!capture_parked)
+                    ALOGD("%s: no request for %d ms, capture parked",
+                          __func__, CAPTURE_IDLE_TIMEOUT_MS);
+                __atomic_store_n(&capture_parked, true, __ATOMIC_SEQ_CST);
+                if (capture_demanded())
+                    continue;
+            } else {
+                __atomic_store_n(&capture_parked, false, __ATOMIC_SEQ_CST);
+            }
             pthread_cond_wait(&cond, &lock);
         }
         if (!capture_enabled)
@@ -409,6 +929,12 @@ void *capture_thread_loop(void *arg)
         if (ret == 0) {
             struct listnode *out_node;
 
+            if (resume_ms != 0) {
+                ALOGV("%s: first capture %lld ms after resume", __func__,
+                      (long long)(get_time_ms() - resume_ms));
+                resume_ms = 0;
+            }
+            capture_ring_write(&buf, measurement_modes());
             list_for_each(out_node, &active_outputs_list) {
                 output_context_t *out_ctxt = node_to_item(out_node,
                                                           output_context_t,
@@ -433,7 +959,10 @@ void *capture_thread_loop(void *arg)
             pcm_close(pcm);
         configure_proxy_capture(mixer, 0);
     }
-    mixer_close(mixer);
+    if (hal_mixer_release)
+        hal_mixer_release(mixer);
+    else
+        mixer_close(mixer);
     pthread_mutex_unlock(&lock);
 
     ALOGD("thread exit");
@@ -496,6 +1025,25 @@ exit:
     return ret;
 }
 
+__attribute__ ((visibility ("default")))
+void visualizer_hal_set_mixer_ops(struct mixer *(*acquire)(int card),
+                                  void (*release)(struct mixer *mixer),
+                                  struct mixer_ctl *(*get_ctl)(struct mixer *mixer,
+                                                               const char *name)) {
+    ALOGV("%s", __func__);
+
+    if (lib_init() != 0)
+        return;
+
+    pthread_mutex_lock(&thread_lock);
+    if (acquire && release && get_ctl) {
+        hal_mixer_acquire = acquire;
+        hal_mixer_release = release;
+        hal_mixer_get_ctl = get_ctl;
+    }
+    pthread_mutex_unlock(&thread_lock);
+}
+
 __attribute__ ((visibility ("default")))
 int visualizer_hal_stop_output(audio_io_handle_t output, int pcm_id) {
     int ret;
@@ -579,19 +1127,14 @@ void get_config(effect_context_t *context, effect_config_t *config)
  * Visualizer operations
  */
 
-uint32_t visualizer_get_delta_time_ms_from_updated_time(visualizer_context_t* visu_ctxt) {
+uint32_t visualizer_get_delta_time_ms_from_updated_time(visualizer_context_t* visu_ctxt __unused) {
     uint32_t delta_ms = 0;
-    if (visu_ctxt->buffer_update_time.tv_sec != 0) {
-        struct timespec ts;
-        if (clock_gettime(CLOCK_MONOTONIC, &ts) == 0) {
-            time_t secs = ts.tv_sec - visu_ctxt->buffer_update_time.tv_sec;
-            long nsec = ts.tv_nsec - visu_ctxt->buffer_update_time.tv_nsec;
-            if (nsec < 0) {
-                --secs;
-                nsec += 1000000000;
-            }
-            delta_ms = secs * 1000 + nsec / 1000000;
-        }
+    int64_t update_time_ms = __atomic_load_n(&capture_ring.update_time_ms, __ATOMIC_RELAXED);
+
+    if (update_time_ms != 0) {
+        int64_t now_ms = get_time_ms();
+        if (now_ms > update_time_ms)
+            delta_ms = (uint32_t)(now_ms - update_time_ms);
     }
     return delta_ms;
 }
@@ -600,18 +1143,50 @@ int visualizer_reset(effect_context_t *context)
 {
     visualizer_context_t * visu_ctxt = (visualizer_context_t *)context;
 
-    visu_ctxt->capture_idx = 0;
-    visu_ctxt->last_capture_idx = 0;
-    visu_ctxt->buffer_update_time.tv_sec = 0;
+    visu_ctxt->last_capture_seq = 0;
     visu_ctxt->latency = DSP_OUTPUT_LATENCY_MS;
-    memset(visu_ctxt->capture_buf, 0x80, CAPTURE_BUF_SIZE);
     return 0;
 }
 
-int visualizer_init(effect_context_t *context)
+/* Record a capture or measurement request and wake up the capture thread if it is parked */
+void visualizer_request_data(visualizer_context_t *visu_ctxt, bool locked) {
+    __atomic_store_n(&visu_ctxt->last_request_ms, get_time_ms(), __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&capture_parked, __ATOMIC_SEQ_CST)) {
+        if (!locked)
+            pthread_mutex_lock(&lock);
+        pthread_cond_signal(&cond);
+        if (!locked)
+            pthread_mutex_unlock(&lock);
+    }
+}
+
+int visualizer_enable(effect_context_t *context)
+{
+    visualizer_context_t * visu_ctxt = (visualizer_context_t *)context;
+
+    /* start capturing right away so that the first requests get data */
+    __atomic_store_n(&visu_ctxt->last_request_ms, get_time_ms(), __ATOMIC_SEQ_CST);
+    return 0;
+}
+
+int visualizer_start(effect_context_t *context, output_context_t *output __unused)
 {
-    int32_t i;
+    visualizer_context_t * visu_ctxt = (visualizer_context_t *)context;
+
+    __atomic_store_n(&visu_ctxt->attached, true, __ATOMIC_RELEASE);
+    return 0;
+}
+
+int visualizer_stop(effect_context_t *context, output_context_t *output __unused)
+{
+    visualizer_context_t * visu_ctxt = (visualizer_context_t *)context;
+
+    __atomic_store_n(&visu_ctxt->attached, false, __ATOMIC_RELEASE);
+    return 0;
+}
 
+int visualizer_init(effect_context_t *context)
+{
     visualizer_context_t * visu_ctxt = (visualizer_context_t *)context;
 
     context->config.inputCfg.accessMode = EFFECT_BUFFER_ACCESS_READ;
@@ -638,12 +1213,6 @@ int visualizer_init(effect_context_t *context)
     visu_ctxt->channel_count = popcount(context->config.inputCfg.channels);
     visu_ctxt->meas_mode = MEASUREMENT_MODE_NONE;
     visu_ctxt->meas_wndw_size_in_buffers = MEASUREMENT_WINDOW_MAX_SIZE_IN_BUFFERS;
-    visu_ctxt->meas_buffer_idx = 0;
-    for (i=0 ; i<visu_ctxt->meas_wndw_size_in_buffers ; i++) {
-        visu_ctxt->past_meas[i].is_valid = false;
-        visu_ctxt->past_meas[i].peak_u16 = 0;
-        visu_ctxt->past_meas[i].rms_squared = 0;
-    }
 
     set_config(context, &context->config);
 
@@ -666,6 +1235,7 @@ int visualizer_init(effect_context_t *context)
 int visualizer_get_parameter(effect_context_t *context, effect_param_t *p, uint32_t *size)
 {
     visualizer_context_t *visu_ctxt = (visualizer_context_t *)context;
+    const uint32_t max_size = *size;
 
     p->status = 0;
     *size = sizeof(effect_param_t) + sizeof(uint32_t);
@@ -692,6 +1262,27 @@ int visualizer_get_parameter(effect_context_t *context, effect_param_t *p, uint3
         p->vsize = sizeof(uint32_t);
         *size += sizeof(uint32_t);
         break;
+    case VISUALIZER_PARAM_SPECTRUM_BANDS:
+    case VISUALIZER_PARAM_LOUDNESS: {
+        const bool bands = *(uint32_t *)p->data == VISUALIZER_PARAM_SPECTRUM_BANDS;
+        const uint32_t vsize = bands ? SPECTRUM_NB_BANDS * sizeof(int32_t) :
+                                       LOUDNESS_IDX_CNT * sizeof(int32_t);
+        int32_t *value = (int32_t *)((uint32_t *)p->data + 1);
+        uint32_t i;
+
+        if (!(visu_ctxt->meas_mode & MEASUREMENT_MODE_SPECTRUM_LOUDNESS) ||
+                max_size < *size + vsize) {
+            p->status = -EINVAL;
+            break;
+        }
+        visualizer_request_data(visu_ctxt, true);
+        if (!capture_ring_read_spectrum(bands ? value : NULL, bands ? NULL : value)) {
+            for (i = 0; i < vsize / sizeof(int32_t); i++)
+                value[i] = SPECTRUM_MIN_MB;
+        }
+        p->vsize = vsize;
+        *size += vsize;
+        } break;
     default:
         p->status = -EINVAL;
     }
@@ -729,13 +1320,12 @@ int visualizer_set_parameter(effect_context_t *context, effect_param_t *p, uint3
     return 0;
 }
 
-/* Real process function called from capture thread. Called with lock held */
+/* Process function called from capture thread with lock held. The capture period has already
+ * been converted into capture_ring by capture_ring_write(), shared by all visualizers. */
 int visualizer_process(effect_context_t *context,
                        audio_buffer_t *inBuffer,
                        audio_buffer_t *outBuffer)
 {
-    visualizer_context_t *visu_ctxt = (visualizer_context_t *)context;
-
     if (!effect_exists(context))
         return -EINVAL;
 
@@ -746,83 +1336,6 @@ int visualizer_process(effect_context_t *context,
         return -EINVAL;
     }
 
-    // perform measurements if needed
-    if (visu_ctxt->meas_mode & MEASUREMENT_MODE_PEAK_RMS) {
-        // find the peak and RMS squared for the new buffer
-        uint32_t inIdx;
-        int16_t max_sample = 0;
-        float rms_squared_acc = 0;
-        for (inIdx = 0 ; inIdx < inBuffer->frameCount * visu_ctxt->channel_count ; inIdx++) {
-            if (inBuffer->s16[inIdx] > max_sample) {
-                max_sample = inBuffer->s16[inIdx];
-            } else if (-inBuffer->s16[inIdx] > max_sample) {
-                max_sample = -inBuffer->s16[inIdx];
-            }
-            rms_squared_acc += (inBuffer->s16[inIdx] * inBuffer->s16[inIdx]);
-        }
-        // store the measurement
-        visu_ctxt->past_meas[visu_ctxt->meas_buffer_idx].peak_u16 = (uint16_t)max_sample;
-        visu_ctxt->past_meas[visu_ctxt->meas_buffer_idx].rms_squared =
-                rms_squared_acc / (inBuffer->frameCount * visu_ctxt->channel_count);
-        visu_ctxt->past_meas[visu_ctxt->meas_buffer_idx].is_valid = true;
-        if (++visu_ctxt->meas_buffer_idx >= visu_ctxt->meas_wndw_size_in_buffers) {
-            visu_ctxt->meas_buffer_idx = 0;
-        }
-    }
-
-    /* all code below assumes stereo 16 bit PCM output and input */
-    int32_t shift;
-
-    if (visu_ctxt->scaling_mode == VISUALIZER_SCALING_MODE_NORMALIZED) {
-        /* derive capture scaling factor from peak value in current buffer
-         * this gives more interesting captures for display. */
-        shift = 32;
-        int len = inBuffer->frameCount * 2;
-        int i;
-        for (i = 0; i < len; i++) {
-            int32_t smp = inBuffer->s16[i];
-            if (smp < 0) smp = -smp - 1; /* take care to keep the max negative in range */
-            int32_t clz = __builtin_clz(smp);
-            if (shift > clz) shift = clz;
-        }
-        /* A maximum amplitude signal will have 17 leading zeros, which we want to
-         * translate to a shift of 8 (for converting 16 bit to 8 bit) */
-        shift = 25 - shift;
-        /* Never scale by less than 8 to avoid returning unaltered PCM signal. */
-        if (shift < 3) {
-            shift = 3;
-        }
-        /* add one to combine the division by 2 needed after summing
-         * left and right channels below */
-        shift++;
-    } else {
-        assert(visu_ctxt->scaling_mode == VISUALIZER_SCALING_MODE_AS_PLAYED);
-        shift = 9;
-    }
-
-    uint32_t capt_idx;
-    uint32_t in_idx;
-    uint8_t *buf = visu_ctxt->capture_buf;
-    for (in_idx = 0, capt_idx = visu_ctxt->capture_idx;
-         in_idx < inBuffer->frameCount;
-         in_idx++, capt_idx++) {
-        if (capt_idx >= CAPTURE_BUF_SIZE) {
-            /* wrap around */
-            capt_idx = 0;
-        }
-        int32_t smp = inBuffer->s16[2 * in_idx] + inBuffer->s16[2 * in_idx + 1];
-        smp = smp >> shift;
-        buf[capt_idx] = ((uint8_t)smp)^0x80;
-    }
-
-    /* XXX the following two should really be atomic, though it probably doesn't
-     * matter much for visualization purposes */
-    visu_ctxt->capture_idx = capt_idx;
-    /* update last buffer update time stamp */
-    if (clock_gettime(CLOCK_MONOTONIC, &visu_ctxt->buffer_update_time) < 0) {
-        visu_ctxt->buffer_update_time.tv_sec = 0;
-    }
-
     if (context->state != EFFECT_STATE_ACTIVE) {
         ALOGV("%s DONE inactive", __func__);
         return -ENODATA;
@@ -847,7 +1360,9 @@ int visualizer_command(effect_context_t * context, uint32_t cmdCode, uint32_t cm
         if (!context->offload_enabled)
             break;
 
-        if (context->state == EFFECT_STATE_ACTIVE) {
+        visualizer_request_data(visu_ctxt, false);
+        if (context->state == EFFECT_STATE_ACTIVE &&
+                __atomic_load_n(&visu_ctxt->attached, __ATOMIC_ACQUIRE)) {
             int32_t latency_ms = visu_ctxt->latency;
             const uint32_t delta_ms = visualizer_get_delta_time_ms_from_updated_time(visu_ctxt);
             latency_ms -= delta_ms;
@@ -855,71 +1370,43 @@ int visualizer_command(effect_context_t * context, uint32_t cmdCode, uint32_t cm
                 latency_ms = 0;
             }
             const uint32_t delta_smp = context->config.inputCfg.samplingRate * latency_ms / 1000;
-
-            int32_t capture_point = visu_ctxt->capture_idx - visu_ctxt->capture_size - delta_smp;
-            int32_t capture_size = visu_ctxt->capture_size;
-            if (capture_point < 0) {
-                int32_t size = -capture_point;
-                if (size > capture_size)
-                    size = capture_size;
-
-                memcpy(pReplyData,
-                       visu_ctxt->capture_buf + CAPTURE_BUF_SIZE + capture_point,
-                       size);
-                pReplyData = (void *)((size_t)pReplyData + size);
-                capture_size -= size;
-                capture_point = 0;
-            }
-            memcpy(pReplyData,
-                   visu_ctxt->capture_buf + capture_point,
-                   capture_size);
-
+            const uint64_t capture_seq = capture_ring_read(visu_ctxt->scaling_mode, pReplyData,
+                                                           visu_ctxt->capture_size, delta_smp);
 
             /* if audio framework has stopped playing audio although the effect is still
-             * active we must clear the capture buffer to return silence */
-            if ((visu_ctxt->last_capture_idx == visu_ctxt->capture_idx) &&
-                    (visu_ctxt->buffer_update_time.tv_sec != 0)) {
-                if (delta_ms > MAX_STALL_TIME_MS) {
-                    ALOGV("%s capture going to idle", __func__);
-                    visu_ctxt->buffer_update_time.tv_sec = 0;
-                    memset(pReplyData, 0x80, visu_ctxt->capture_size);
-                }
+             * active we must return silence */
+            if (visu_ctxt->last_capture_seq == capture_seq && delta_ms > MAX_STALL_TIME_MS) {
+                ALOGV("%s capture idle", __func__);
+                memset(pReplyData, 0x80, visu_ctxt->capture_size);
             }
-            visu_ctxt->last_capture_idx = visu_ctxt->capture_idx;
+            visu_ctxt->last_capture_seq = capture_seq;
         } else {
             memset(pReplyData, 0x80, visu_ctxt->capture_size);
         }
         break;
 
     case VISUALIZER_CMD_MEASURE: {
+        buffer_stats_t past_meas[MEASUREMENT_WINDOW_MAX_SIZE_IN_BUFFERS];
         uint16_t peak_u16 = 0;
         float sum_rms_squared = 0.0f;
         uint8_t nb_valid_meas = 0;
-        /* reset measurements if last measurement was too long ago (which implies stored
-         * measurements aren't relevant anymore and shouldn't bias the new one) */
-        const int32_t delay_ms = visualizer_get_delta_time_ms_from_updated_time(visu_ctxt);
-        if (delay_ms > DISCARD_MEASUREMENTS_TIME_MS) {
-            uint32_t i;
-            ALOGV("Discarding measurements, last measurement is %dms old", delay_ms);
-            for (i=0 ; i<visu_ctxt->meas_wndw_size_in_buffers ; i++) {
-                visu_ctxt->past_meas[i].is_valid = false;
-                visu_ctxt->past_meas[i].peak_u16 = 0;
-                visu_ctxt->past_meas[i].rms_squared = 0;
-            }
-            visu_ctxt->meas_buffer_idx = 0;
-        } else {
-            /* only use actual measurements, otherwise the first RMS measure happening before
-             * MEASUREMENT_WINDOW_MAX_SIZE_IN_BUFFERS have been played will always be artificially
-             * low */
-            uint32_t i;
-            for (i=0 ; i < visu_ctxt->meas_wndw_size_in_buffers ; i++) {
-                if (visu_ctxt->past_meas[i].is_valid) {
-                    if (visu_ctxt->past_meas[i].peak_u16 > peak_u16) {
-                        peak_u16 = visu_ctxt->past_meas[i].peak_u16;
-                    }
-                    sum_rms_squared += visu_ctxt->past_meas[i].rms_squared;
-                    nb_valid_meas++;
+        uint32_t i;
+        /* ignore measurements done too long ago (which implies they aren't relevant anymore
+         * and shouldn't bias the new one) */
+        const int64_t discard_ms = get_time_ms() - DISCARD_MEASUREMENTS_TIME_MS;
+
+        visualizer_request_data(visu_ctxt, false);
+        capture_ring_read_measurements(past_meas);
+        /* only use actual measurements, otherwise the first RMS measure happening before
+         * MEASUREMENT_WINDOW_MAX_SIZE_IN_BUFFERS have been played will always be artificially
+         * low */
+        for (i=0 ; i < visu_ctxt->meas_wndw_size_in_buffers ; i++) {
+            if (past_meas[i].is_valid && past_meas[i].time_ms >= discard_ms) {
+                if (past_meas[i].peak_u16 > peak_u16) {
+                    peak_u16 = past_meas[i].peak_u16;
                 }
+                sum_rms_squared += past_meas[i].rms_squared;
+                nb_valid_meas++;
             }
         }
         float rms = nb_valid_meas == 0 ? 0.0f : sqrtf(sum_rms_squared / nb_valid_meas);
@@ -985,6 +1472,9 @@ int effect_lib_create(const effect_uuid_t *uuid,
         context = (effect_context_t *)visu_ctxt;
         context->ops.init = visualizer_init;
         context->ops.reset = visualizer_reset;
+        context->ops.enable = visualizer_enable;
+        context->ops.start = visualizer_start;
+        context->ops.stop = visualizer_stop;
         context->ops.process = visualizer_process;
         context->ops.set_parameter = visualizer_set_parameter;
         context->ops.get_parameter = visualizer_get_parameter;
@@ -1107,6 +1597,15 @@ int effect_command(effect_handle_t self, uint32_t cmdCode, uint32_t cmdSize,
     int retsize;
     int status = 0;
 
+    /* Capture and measurement are served from capture_ring without taking the lock held by
+     * the capture thread. The framework serializes commands and release on a given handle
+     * so the context cannot go away underneath us. */
+    if ((cmdCode == VISUALIZER_CMD_CAPTURE || cmdCode == VISUALIZER_CMD_MEASURE) &&
+            context != NULL && context->ops.command != NULL &&
+            context->state != EFFECT_STATE_UNINITIALIZED)
+        return context->ops.command(context, cmdCode, cmdSize,
+                                    pCmdData, replySize, pReplyData);
+
     pthread_mutex_lock(&lock);
 
     if (!effect_exists(context)) {